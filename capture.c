@@ -0,0 +1,291 @@
+#define _GNU_SOURCE // O_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+#define CAPTURE_BUFFER (256 * 1024)
+#define CAPTURE_HEAD_MAX 48             // 类型 + 最多4个变长整数
+
+struct capture {
+    int fd;
+    int failed;                         // 写入出错后不再记录
+    char *buf;
+    size_t len;
+    uint64_t last_us;                   // 上一条记录的单调时钟时间
+    uint64_t next_conn;
+    struct capture_stats stats;
+};
+
+struct capture_reader {
+    FILE *file;
+    long end;                           // 打开时的文件长度：之后追加的记录不读（录制文件可能还在增长）
+    uint64_t time_us;
+    uint64_t conn_base;                 // 当前SEGMENT的连接编号偏移
+    uint64_t conn_max;
+    char *data;
+    size_t data_cap;
+};
+
+static uint64_t clock_us(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static size_t put_varint(char *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (char)v;
+    return n;
+}
+
+static int write_all(struct capture *cap, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(cap->fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write capture");
+            cap->failed = 1;
+            return -1;
+        }
+        data += n;
+        len -= n;
+        cap->stats.file_bytes += n;
+    }
+    return 0;
+}
+
+struct capture* capture_open(const char *path) {
+    struct capture *cap = calloc(1, sizeof(*cap));
+    if (!cap) {
+        perror("calloc capture");
+        return NULL;
+    }
+    cap->buf = malloc(CAPTURE_BUFFER);
+    if (!cap->buf) {
+        perror("malloc capture buffer");
+        free(cap);
+        return NULL;
+    }
+    cap->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (cap->fd == -1) {
+        perror("open capture");
+        free(cap->buf);
+        free(cap);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(cap->fd, &st) == 0 && st.st_size == 0) {
+        memcpy(cap->buf, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC));
+        cap->len = strlen(CAPTURE_MAGIC);
+    }
+    cap->buf[cap->len++] = CAPTURE_SEGMENT;
+    cap->len += put_varint(cap->buf + cap->len, clock_us(CLOCK_REALTIME));
+    cap->last_us = clock_us(CLOCK_MONOTONIC);
+    cap->next_conn = 1;
+    return cap;
+}
+
+void capture_close(struct capture *cap) {
+    if (!cap) {
+        return;
+    }
+    capture_flush(cap);
+    close(cap->fd);
+    free(cap->buf);
+    free(cap);
+}
+
+int capture_flush(struct capture *cap) {
+    if (cap->failed) {
+        return -1;
+    }
+    int result = write_all(cap, cap->buf, cap->len);
+    cap->len = 0;
+    return result;
+}
+
+// 写记录头：类型、时间差、连接编号；缓冲区放不下时先写出
+static int capture_head(struct capture *cap, int type, uint64_t conn) {
+    if (cap->failed) {
+        return -1;
+    }
+    if (cap->len + CAPTURE_HEAD_MAX > CAPTURE_BUFFER && capture_flush(cap) == -1) {
+        return -1;
+    }
+    uint64_t now = clock_us(CLOCK_MONOTONIC);
+    cap->buf[cap->len++] = (char)type;
+    cap->len += put_varint(cap->buf + cap->len, now - cap->last_us);
+    cap->len += put_varint(cap->buf + cap->len, conn);
+    cap->last_us = now;
+    cap->stats.records++;
+    return 0;
+}
+
+uint64_t capture_conn_open(struct capture *cap, int port) {
+    uint64_t conn = cap->next_conn++;
+    if (capture_head(cap, CAPTURE_OPEN, conn) == 0) {
+        cap->len += put_varint(cap->buf + cap->len, port);
+        cap->stats.connections++;
+    }
+    return conn;
+}
+
+void capture_conn_data(struct capture *cap, uint64_t conn, const void *data, size_t len) {
+    if (capture_head(cap, CAPTURE_DATA, conn) == -1) {
+        return;
+    }
+    cap->len += put_varint(cap->buf + cap->len, len);
+    cap->stats.bytes += len;
+    if (cap->len + len <= CAPTURE_BUFFER) {
+        memcpy(cap->buf + cap->len, data, len);
+        cap->len += len;
+        return;
+    }
+    // 大块数据不经过缓冲区
+    if (capture_flush(cap) == 0) {
+        write_all(cap, data, len);
+    }
+}
+
+void capture_conn_close(struct capture *cap, uint64_t conn) {
+    capture_head(cap, CAPTURE_CLOSE, conn);
+}
+
+void capture_get_stats(const struct capture *cap, struct capture_stats *stats) {
+    *stats = cap->stats;
+}
+
+struct capture_reader* capture_reader_open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("fopen capture");
+        return NULL;
+    }
+    char magic[sizeof(CAPTURE_MAGIC)];
+    if (fread(magic, 1, strlen(CAPTURE_MAGIC), file) != strlen(CAPTURE_MAGIC) ||
+        memcmp(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        fclose(file);
+        return NULL;
+    }
+    struct capture_reader *reader = calloc(1, sizeof(*reader));
+    if (!reader) {
+        perror("calloc capture_reader");
+        fclose(file);
+        return NULL;
+    }
+    reader->file = file;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        reader->end = ftell(file);
+    }
+    fseek(file, strlen(CAPTURE_MAGIC), SEEK_SET);
+    return reader;
+}
+
+void capture_reader_close(struct capture_reader *reader) {
+    if (!reader) {
+        return;
+    }
+    fclose(reader->file);
+    free(reader->data);
+    free(reader);
+}
+
+// 返回值: 0=成功, -1=文件结束或编码过长
+static int get_varint(FILE *file, uint64_t *value) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(file);
+        if (c == EOF) {
+            return -1;
+        }
+        v |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *value = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int capture_read(struct capture_reader *reader, struct capture_record *rec) {
+    while (1) {
+        if (ftell(reader->file) >= reader->end) {
+            return 0;
+        }
+        int type = getc(reader->file);
+        if (type == EOF) {
+            return 0;
+        }
+        uint64_t value;
+        if (type == CAPTURE_SEGMENT) {
+            // 新进程开始追加：时间从头计起，连接编号接在前面的编号之后
+            if (get_varint(reader->file, &value) == -1) {
+                return 0;
+            }
+            reader->time_us = value;
+            reader->conn_base = reader->conn_max;
+            continue;
+        }
+        if (type != CAPTURE_OPEN && type != CAPTURE_DATA && type != CAPTURE_CLOSE) {
+            fprintf(stderr, "capture: unknown record type %d at offset %ld\n", type, ftell(reader->file) - 1);
+            return -1;
+        }
+
+        uint64_t delta, conn;
+        if (get_varint(reader->file, &delta) == -1 || get_varint(reader->file, &conn) == -1) {
+            return 0;
+        }
+        reader->time_us += delta;
+        memset(rec, 0, sizeof(*rec));
+        rec->type = type;
+        rec->time_us = reader->time_us;
+        rec->conn = reader->conn_base + conn;
+        if (rec->conn > reader->conn_max) {
+            reader->conn_max = rec->conn;
+        }
+
+        if (type == CAPTURE_OPEN) {
+            if (get_varint(reader->file, &value) == -1) {
+                return 0;
+            }
+            rec->port = (int)value;
+        } else if (type == CAPTURE_DATA) {
+            if (get_varint(reader->file, &value) == -1) {
+                return 0;
+            }
+            // 长度超出文件剩余部分：写到一半被截断（或长度本身坏了），不能按它去分配
+            if (value > (uint64_t)(reader->end - ftell(reader->file))) {
+                return 0;
+            }
+            if (value > reader->data_cap) {
+                char *data = realloc(reader->data, value);
+                if (!data) {
+                    perror("realloc capture data");
+                    return -1;
+                }
+                reader->data = data;
+                reader->data_cap = value;
+            }
+            if (fread(reader->data, 1, value, reader->file) != value) {
+                return 0;
+            }
+            rec->data = reader->data;
+            rec->len = value;
+        }
+        return 1;
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 流量录制文件：按到达顺序记录每个连接的建立、收到的字节和关闭，供replay按原时间线重放
+// - 只追加写：文件头之后是一串记录，进程每次打开文件先写一条SEGMENT记录（当时的绝对时间），
+//   后续记录的时间是相对上一条记录的微秒差（单调时钟），数字都用LEB128变长编码
+// - 连接编号在一个SEGMENT内从1递增；读取时不同SEGMENT的编号自动错开，不会冲突
+// - 写入先攒在内存缓冲区，满了或capture_flush时一次write；进程崩溃时最多丢掉缓冲区里的记录，
+//   末尾被截断的记录读取时当作文件结束
+
+#define CAPTURE_MAGIC "EPCAP001"
+
+enum capture_type {
+    CAPTURE_SEGMENT = 1,    // 绝对时间（CLOCK_REALTIME微秒）
+    CAPTURE_OPEN = 2,       // 时间差、连接编号、本地端口
+    CAPTURE_DATA = 3,       // 时间差、连接编号、长度、数据
+    CAPTURE_CLOSE = 4,      // 时间差、连接编号
+};
+
+struct capture;
+struct capture_reader;
+
+struct capture_stats {
+    unsigned long long connections;
+    unsigned long long records;
+    unsigned long long bytes;           // 录下的请求字节数（不含记录头）
+    unsigned long long file_bytes;      // 已写入文件的字节数
+};
+
+struct capture_record {
+    int type;
+    uint64_t time_us;                   // 绝对时间（SEGMENT的时间加上之后的时间差）
+    uint64_t conn;                      // 整个文件内唯一
+    int port;                           // CAPTURE_OPEN：服务器的监听端口
+    const char *data;                   // CAPTURE_DATA：只在下一次capture_read之前有效
+    size_t len;
+};
+
+// 以追加方式打开（不存在则创建）录制文件，失败返回NULL
+struct capture* capture_open(const char *path);
+
+// 写出缓冲区并关闭
+void capture_close(struct capture *cap);
+
+// 写出缓冲区里的记录；写入失败时返回-1，之后的记录都被丢弃
+int capture_flush(struct capture *cap);
+
+// 记录新连接，返回连接编号
+uint64_t capture_conn_open(struct capture *cap, int port);
+void capture_conn_data(struct capture *cap, uint64_t conn, const void *data, size_t len);
+void capture_conn_close(struct capture *cap, uint64_t conn);
+
+void capture_get_stats(const struct capture *cap, struct capture_stats *stats);
+
+// 读取录制文件
+struct capture_reader* capture_reader_open(const char *path);
+void capture_reader_close(struct capture_reader *reader);
+
+// 读取下一条记录（SEGMENT记录在内部处理，不返回）
+// 返回值: 1=读到记录, 0=文件结束（包括末尾被截断的记录）, -1=格式错误
+int capture_read(struct capture_reader *reader, struct capture_record *rec);
+
+#endif
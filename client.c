@@ -0,0 +1,532 @@
+#define _GNU_SOURCE // SOCK_NONBLOCK, getaddrinfo
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "client.h"
+
+#define CLIENT_MAGIC 0xEB
+#define CLIENT_HEADER_SIZE 12
+#define CLIENT_MAX_PAYLOAD (64 * 1024)  // 服务器接受的最大请求payload
+#define CLIENT_READ_SIZE (64 * 1024)    // 每次read前接收缓冲区至少留出的空间
+#define CLIENT_MAX_IOV 1024             // 一次writev最多合并的请求数
+#define CLIENT_MAX_EVENTS 64
+#define CLIENT_WELCOME_MAX 256          // 文本欢迎消息的最大长度
+
+enum client_conn_state {
+    CONN_CLOSED = 0,
+    CONN_CONNECTING,
+    CONN_READY,
+};
+
+// 一个请求：帧头和payload连续存放，发送时就是一个iov
+struct client_request {
+    struct client_request *next;
+    uint32_t id;
+    client_callback cb;
+    void *arg;
+    uint32_t frame_len;
+    char frame[];
+};
+
+struct client_conn {
+    int fd;
+    int state;                          // enum client_conn_state
+    uint32_t generation;                // 每次断开加一，识别旧连接遗留的事件和回调中的重连
+    int epollout;                       // 已注册EPOLLOUT（连接中或发送缓冲区满）
+    int welcome;                        // 还没收到第一个字节：默认档案先发一行文本欢迎消息
+    struct client_request *head;        // 所有未完成的请求，按提交顺序
+    struct client_request *tail;
+    struct client_request *unsent;      // 第一个还没完整写出的请求
+    size_t unsent_offset;               // unsent已写出的字节数
+    int outstanding;
+    char *in_buf;
+    size_t in_len;
+    size_t in_cap;
+};
+
+struct client_pool {
+    int epoll_fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint32_t next_id;
+    int closing;
+    client_callback push_cb;
+    void *push_arg;
+    struct client_pool_stats stats;
+    int count;
+    struct client_conn conns[];
+};
+
+static void put_be16(char *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static void put_be32(char *p, uint32_t v) {
+    uint32_t be = htonl(v);
+    memcpy(p, &be, 4);
+}
+
+static uint32_t get_be32(const char *p) {
+    uint32_t be;
+    memcpy(&be, p, 4);
+    return ntohl(be);
+}
+
+static void conn_set_events(struct client_pool *pool, int idx, int epollout) {
+    struct client_conn *c = &pool->conns[idx];
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | (epollout ? EPOLLOUT : 0);
+    event.data.u64 = (uint64_t)c->generation << 32 | (uint32_t)idx;
+    if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_MOD, c->fd, &event) == -1) {
+        perror("epoll_ctl MOD client");
+        return;
+    }
+    c->epollout = epollout;
+}
+
+// 连接断开：所有未完成的请求以CLIENT_STATUS_DISCONNECTED回调，下次有请求分到这个连接时重连
+static void conn_fail(struct client_pool *pool, struct client_conn *c) {
+    struct client_request *req = c->head;
+    struct client_reply reply = { CLIENT_STATUS_DISCONNECTED, 0, NULL, 0 };
+
+    close(c->fd);
+    c->fd = -1;
+    c->state = CONN_CLOSED;
+    c->generation++;
+    c->head = c->tail = c->unsent = NULL;
+    c->unsent_offset = 0;
+    pool->stats.outstanding -= c->outstanding;
+    pool->stats.failed += c->outstanding;
+    c->outstanding = 0;
+    c->in_len = 0;
+
+    // 先把链表摘下来再回调，回调里提交的请求进入新的连接
+    while (req) {
+        struct client_request *next = req->next;
+        reply.opcode = (uint8_t)req->frame[1];
+        req->cb(req->arg, &reply);
+        free(req);
+        req = next;
+    }
+}
+
+static int conn_open(struct client_pool *pool, int idx) {
+    struct client_conn *c = &pool->conns[idx];
+    int fd = socket(pool->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&pool->addr, pool->addr_len) == -1 && errno != EINPROGRESS) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+
+    c->fd = fd;
+    c->state = CONN_CONNECTING;
+    c->welcome = 1;
+    c->epollout = 1;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    event.data.u64 = (uint64_t)c->generation << 32 | (uint32_t)idx;
+    if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl ADD client");
+        close(fd);
+        c->fd = -1;
+        c->state = CONN_CLOSED;
+        return -1;
+    }
+    return 0;
+}
+
+struct client_pool* client_pool_create(const char *host, const char *port, int connections) {
+    if (connections <= 0) {
+        return NULL;
+    }
+    struct client_pool *pool = calloc(1, sizeof(*pool) + connections * sizeof(struct client_conn));
+    if (!pool) {
+        perror("calloc client_pool");
+        return NULL;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "getaddrinfo %s:%s: %s\n", host, port, gai_strerror(err));
+        free(pool);
+        return NULL;
+    }
+    memcpy(&pool->addr, res->ai_addr, res->ai_addrlen);
+    pool->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    pool->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (pool->epoll_fd == -1) {
+        perror("epoll_create1");
+        free(pool);
+        return NULL;
+    }
+    pool->count = connections;
+    pool->next_id = 1;
+    for (int i = 0; i < connections; i++) {
+        pool->conns[i].fd = -1;
+        if (conn_open(pool, i) == -1) {
+            client_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void client_pool_destroy(struct client_pool *pool) {
+    pool->closing = 1;
+    for (int i = 0; i < pool->count; i++) {
+        struct client_conn *c = &pool->conns[i];
+        if (c->state != CONN_CLOSED) {
+            conn_fail(pool, c);
+        }
+        free(c->in_buf);
+    }
+    close(pool->epoll_fd);
+    free(pool);
+}
+
+int client_pool_fd(const struct client_pool *pool) {
+    return pool->epoll_fd;
+}
+
+void client_pool_set_push(struct client_pool *pool, client_callback cb, void *arg) {
+    pool->push_cb = cb;
+    pool->push_arg = arg;
+}
+
+void client_pool_get_stats(const struct client_pool *pool, struct client_pool_stats *stats) {
+    *stats = pool->stats;
+}
+
+// 选未完成请求最少的连接；断开的连接排在最后，全都断开时重连其中一个
+static int conn_pick(struct client_pool *pool) {
+    int best = -1;
+    for (int i = 0; i < pool->count; i++) {
+        struct client_conn *c = &pool->conns[i];
+        if (best == -1) {
+            best = i;
+            continue;
+        }
+        struct client_conn *b = &pool->conns[best];
+        if ((b->state == CONN_CLOSED && c->state != CONN_CLOSED) ||
+            ((b->state == CONN_CLOSED) == (c->state == CONN_CLOSED) && c->outstanding < b->outstanding)) {
+            best = i;
+        }
+    }
+    if (pool->conns[best].state == CONN_CLOSED && conn_open(pool, best) == -1) {
+        return -1;
+    }
+    return best;
+}
+
+// 帧头 + 若干段payload拼成一个请求，挂到选中连接的队列末尾
+static int request_submit(struct client_pool *pool, uint8_t opcode, const struct iovec *parts, int nparts,
+                          client_callback cb, void *arg) {
+    size_t length = 0;
+    for (int i = 0; i < nparts; i++) {
+        length += parts[i].iov_len;
+    }
+    if (pool->closing || length > CLIENT_MAX_PAYLOAD || !cb) {
+        return -1;
+    }
+    int idx = conn_pick(pool);
+    if (idx == -1) {
+        return -1;
+    }
+    struct client_request *req = malloc(sizeof(*req) + CLIENT_HEADER_SIZE + length);
+    if (!req) {
+        perror("malloc client_request");
+        return -1;
+    }
+
+    req->next = NULL;
+    req->id = pool->next_id++;
+    if (pool->next_id == 0) {
+        // request_id 0 留给服务器推送
+        pool->next_id = 1;
+    }
+    req->cb = cb;
+    req->arg = arg;
+    req->frame_len = CLIENT_HEADER_SIZE + length;
+    req->frame[0] = (char)CLIENT_MAGIC;
+    req->frame[1] = (char)opcode;
+    put_be16(req->frame + 2, 0);
+    put_be32(req->frame + 4, req->id);
+    put_be32(req->frame + 8, (uint32_t)length);
+    size_t offset = CLIENT_HEADER_SIZE;
+    for (int i = 0; i < nparts; i++) {
+        memcpy(req->frame + offset, parts[i].iov_base, parts[i].iov_len);
+        offset += parts[i].iov_len;
+    }
+
+    struct client_conn *c = &pool->conns[idx];
+    if (c->tail) {
+        c->tail->next = req;
+    } else {
+        c->head = req;
+    }
+    c->tail = req;
+    if (!c->unsent) {
+        c->unsent = req;
+        c->unsent_offset = 0;
+    }
+    c->outstanding++;
+    pool->stats.outstanding++;
+    pool->stats.requests++;
+    return 0;
+}
+
+int client_send(struct client_pool *pool, uint8_t opcode, const void *payload, uint32_t length,
+                client_callback cb, void *arg) {
+    struct iovec part = { (void*)payload, length };
+    return request_submit(pool, opcode, &part, length ? 1 : 0, cb, arg);
+}
+
+int client_get(struct client_pool *pool, const char *key, size_t key_len, client_callback cb, void *arg) {
+    return client_send(pool, CLIENT_OP_GET, key, (uint32_t)key_len, cb, arg);
+}
+
+int client_set(struct client_pool *pool, const char *key, size_t key_len, const void *value, size_t value_len,
+               client_callback cb, void *arg) {
+    char len_be[2];
+    if (key_len > 0xffff) {
+        return -1;
+    }
+    put_be16(len_be, (uint16_t)key_len);
+    struct iovec parts[3] = {
+        { len_be, 2 },
+        { (void*)key, key_len },
+        { (void*)value, value_len },
+    };
+    return request_submit(pool, CLIENT_OP_SET, parts, 3, cb, arg);
+}
+
+// 把连接上还没写出的请求合并成一次writev（超过CLIENT_MAX_IOV个时分几次）
+static void conn_flush(struct client_pool *pool, struct client_conn *c) {
+    if (c->state != CONN_READY || c->epollout) {
+        return;
+    }
+    while (c->unsent) {
+        struct iovec iov[CLIENT_MAX_IOV];
+        int iovcnt = 0;
+        for (struct client_request *r = c->unsent; r && iovcnt < CLIENT_MAX_IOV; r = r->next) {
+            size_t skip = iovcnt == 0 ? c->unsent_offset : 0;
+            iov[iovcnt].iov_base = r->frame + skip;
+            iov[iovcnt].iov_len = r->frame_len - skip;
+            iovcnt++;
+        }
+        pool->stats.writev_calls++;
+        ssize_t n = writev(c->fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn_set_events(pool, c - pool->conns, 1);
+                return;
+            }
+            perror("writev client");
+            conn_fail(pool, c);
+            return;
+        }
+        size_t left = n;
+        while (c->unsent && left >= c->unsent->frame_len - c->unsent_offset) {
+            left -= c->unsent->frame_len - c->unsent_offset;
+            c->unsent = c->unsent->next;
+            c->unsent_offset = 0;
+        }
+        c->unsent_offset += left;
+    }
+}
+
+void client_pool_flush(struct client_pool *pool) {
+    for (int i = 0; i < pool->count; i++) {
+        conn_flush(pool, &pool->conns[i]);
+    }
+}
+
+// 处理接收缓冲区里所有完整的回复帧，返回完成的请求数；连接出错时返回-1（已经conn_fail）
+static int conn_dispatch(struct client_pool *pool, struct client_conn *c) {
+    uint32_t generation = c->generation;
+    size_t pos = 0;
+    int done = 0;
+
+    if (c->welcome && c->in_len > 0) {
+        // 第一个字节不是帧头：跳过默认档案的文本欢迎消息
+        if ((unsigned char)c->in_buf[0] != CLIENT_MAGIC) {
+            const char *nl = memchr(c->in_buf, '\n', c->in_len);
+            if (!nl) {
+                if (c->in_len < CLIENT_WELCOME_MAX) {
+                    return 0;
+                }
+                fprintf(stderr, "client: unexpected data from server\n");
+                conn_fail(pool, c);
+                return -1;
+            }
+            pos = nl - c->in_buf + 1;
+        }
+        c->welcome = 0;
+    }
+
+    while (c->in_len - pos >= CLIENT_HEADER_SIZE) {
+        const char *frame = c->in_buf + pos;
+        uint32_t length = get_be32(frame + 8);
+        if ((unsigned char)frame[0] != CLIENT_MAGIC) {
+            fprintf(stderr, "client: bad frame from server\n");
+            conn_fail(pool, c);
+            return -1;
+        }
+        if (c->in_len - pos < CLIENT_HEADER_SIZE + (size_t)length) {
+            break;
+        }
+        struct client_reply reply;
+        reply.status = (unsigned char)frame[2] << 8 | (unsigned char)frame[3];
+        reply.opcode = (uint8_t)frame[1];
+        reply.payload = frame + CLIENT_HEADER_SIZE;
+        reply.length = length;
+        uint32_t id = get_be32(frame + 4);
+        pos += CLIENT_HEADER_SIZE + length;
+
+        if (id == 0) {
+            if (pool->push_cb) {
+                pool->push_cb(pool->push_arg, &reply);
+            }
+        } else {
+            // 回复通常按顺序到达，就是队首；工作线程处理的命令可能先后交错
+            struct client_request *prev = NULL, *req = c->head;
+            while (req && req->id != id) {
+                prev = req;
+                req = req->next;
+            }
+            if (!req) {
+                continue;
+            }
+            if (prev) {
+                prev->next = req->next;
+            } else {
+                c->head = req->next;
+            }
+            if (c->tail == req) {
+                c->tail = prev;
+            }
+            c->outstanding--;
+            pool->stats.outstanding--;
+            pool->stats.replies++;
+            done++;
+            req->cb(req->arg, &reply);
+            free(req);
+        }
+        if (c->generation != generation) {
+            // 回调里的client_pool_flush让连接断开了（可能已经重连），缓冲区已经清空
+            return done;
+        }
+    }
+
+    if (pos > 0) {
+        memmove(c->in_buf, c->in_buf + pos, c->in_len - pos);
+        c->in_len -= pos;
+    }
+    return done;
+}
+
+// 读完socket里的数据并处理回复，返回完成的请求数
+static int conn_read(struct client_pool *pool, struct client_conn *c) {
+    int done = 0;
+    while (1) {
+        if (c->in_cap - c->in_len < CLIENT_READ_SIZE) {
+            size_t new_cap = c->in_cap ? c->in_cap * 2 : 2 * CLIENT_READ_SIZE;
+            char *buf = realloc(c->in_buf, new_cap);
+            if (!buf) {
+                perror("realloc client in_buf");
+                conn_fail(pool, c);
+                return done;
+            }
+            c->in_buf = buf;
+            c->in_cap = new_cap;
+        }
+        ssize_t n = read(c->fd, c->in_buf + c->in_len, c->in_cap - c->in_len);
+        if (n > 0) {
+            c->in_len += n;
+            int result = conn_dispatch(pool, c);
+            if (result == -1) {
+                return done;
+            }
+            done += result;
+            if (c->state != CONN_READY) {
+                return done;
+            }
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return done;
+        }
+        if (n == -1) {
+            perror("read client");
+        }
+        done += c->outstanding;
+        conn_fail(pool, c);
+        return done;
+    }
+}
+
+int client_pool_process(struct client_pool *pool) {
+    struct epoll_event events[CLIENT_MAX_EVENTS];
+    int done = 0;
+    int n = epoll_wait(pool->epoll_fd, events, CLIENT_MAX_EVENTS, 0);
+
+    for (int i = 0; i < n; i++) {
+        int idx = (int)(uint32_t)events[i].data.u64;
+        struct client_conn *c = &pool->conns[idx];
+        uint32_t mask = events[i].events;
+        if ((uint32_t)(events[i].data.u64 >> 32) != c->generation || c->state == CONN_CLOSED) {
+            // 这个连接在本轮前面的回调里已经断开
+            continue;
+        }
+
+        if (c->state == CONN_CONNECTING) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (!(mask & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                continue;
+            }
+            getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0) {
+                fprintf(stderr, "client: connect: %s\n", strerror(err));
+                done += c->outstanding;
+                conn_fail(pool, c);
+                continue;
+            }
+            c->state = CONN_READY;
+            pool->stats.connects++;
+            conn_set_events(pool, idx, 0);
+        } else if ((mask & EPOLLOUT) && c->epollout) {
+            conn_set_events(pool, idx, 0);
+        }
+
+        if (mask & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+            // 出错或对端关闭时read返回0或-1，先收完已经到达的回复再断开
+            done += conn_read(pool, c);
+        }
+    }
+    client_pool_flush(pool);
+    return done;
+}
@@ -0,0 +1,81 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// epoll_server的异步客户端库（二进制协议）
+// - 连接池：对同一个服务器开多个连接，每个请求发到未完成请求最少的连接上
+// - 流水线：每个连接上可以同时有任意多个未完成的请求，回复按request_id匹配（通常就是队首）
+// - 批量发送：client_send只是把请求挂进发送队列，client_pool_flush时每个连接一次writev
+// - 融入调用者的事件循环：连接池内部有自己的epoll，对外只有一个fd（client_pool_fd），
+//   调用者把它注册到自己的epoll里监听EPOLLIN，可读时调用client_pool_process
+// 回调在client_pool_process/client_pool_flush里执行，可以在回调里继续client_send；
+// 不能在回调里销毁连接池。不是线程安全的，只在一个线程里使用
+
+// 和服务器的enum bin_opcode一致
+enum client_opcode {
+    CLIENT_OP_PING = 1,
+    CLIENT_OP_TIME = 2,
+    CLIENT_OP_ECHO = 3,
+    CLIENT_OP_HELP = 4,
+    CLIENT_OP_STATS = 6,
+    CLIENT_OP_GET = 10,
+    CLIENT_OP_SET = 9,
+    CLIENT_OP_DEL = 11,
+    CLIENT_OP_MESSAGE = 16,             // 订阅推送，交给push回调
+};
+
+#define CLIENT_STATUS_DISCONNECTED (-1) // 回复前连接断开或连不上，payload为NULL
+
+struct client_reply {
+    int status;                         // 服务器的enum bin_status（0=成功），或CLIENT_STATUS_DISCONNECTED
+    uint8_t opcode;
+    const char *payload;                // 只在回调期间有效
+    uint32_t length;
+};
+
+typedef void (*client_callback)(void *arg, const struct client_reply *reply);
+
+struct client_pool_stats {
+    unsigned long long requests;        // client_send提交的请求数
+    unsigned long long replies;
+    unsigned long long failed;          // 因连接断开以CLIENT_STATUS_DISCONNECTED回调的请求数
+    unsigned long long writev_calls;
+    unsigned long long connects;        // 建立（包括重新建立）连接的次数
+    int outstanding;                    // 已提交还没收到回复的请求数
+};
+
+struct client_pool;
+
+// 创建连接池：host:port上的connections个连接（非阻塞connect，立即返回），失败返回NULL
+struct client_pool* client_pool_create(const char *host, const char *port, int connections);
+
+// 关闭所有连接；未完成的请求以CLIENT_STATUS_DISCONNECTED回调
+void client_pool_destroy(struct client_pool *pool);
+
+// 连接池内部的epoll fd，注册到调用者的epoll监听EPOLLIN
+int client_pool_fd(const struct client_pool *pool);
+
+// 处理所有就绪的连接（不阻塞）：读回复、回调、发出排队的请求，返回本次完成的请求数
+int client_pool_process(struct client_pool *pool);
+
+// 提交一个请求（payload被拷贝），回复或失败时调用cb；成功返回0，参数错误或内存不足返回-1
+// 请求先进发送队列，client_pool_flush或下一次client_pool_process时发出
+int client_send(struct client_pool *pool, uint8_t opcode, const void *payload, uint32_t length,
+                client_callback cb, void *arg);
+
+// 键值命令的便捷封装
+int client_get(struct client_pool *pool, const char *key, size_t key_len, client_callback cb, void *arg);
+int client_set(struct client_pool *pool, const char *key, size_t key_len, const void *value, size_t value_len,
+               client_callback cb, void *arg);
+
+// 把所有连接上排队的请求发出去（每个连接一次writev，写不完的等EPOLLOUT）
+void client_pool_flush(struct client_pool *pool);
+
+// 订阅推送（opcode 16，request_id为0）的回调，默认丢弃
+void client_pool_set_push(struct client_pool *pool, client_callback cb, void *arg);
+
+void client_pool_get_stats(const struct client_pool *pool, struct client_pool_stats *stats);
+
+#endif
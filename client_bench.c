@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "client.h"
+
+// 客户端库的吞吐基准：自己的epoll循环里只注册连接池的fd，
+// 每个连接保持depth个未完成的请求，一个回复到达就补发一个，直到发完count个
+// 对比 -d 1（每个连接一问一答，吞吐 = 连接数 / RTT）和 -d 64 的差别
+
+#define DEFAULT_CONNECTIONS 4
+#define DEFAULT_DEPTH 64
+#define DEFAULT_COUNT 1000000
+#define BENCH_VALUE "0123456789abcdef0123456789abcdef"
+
+struct bench;
+
+// 一个在途请求的位置：回复到达后用同一个位置补发下一个请求
+struct slot {
+    struct bench *bench;
+    uint64_t sent_ns;
+};
+
+struct bench {
+    struct client_pool *pool;
+    int op;                             // CLIENT_OP_PING/GET/SET
+    long issued;
+    long completed;
+    long errors;
+    long count;
+    double latency_sum_ns;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void on_reply(void *arg, const struct client_reply *reply);
+
+static int issue(struct slot *slot) {
+    struct bench *b = slot->bench;
+    char key[32];
+    int key_len = snprintf(key, sizeof(key), "bench:%ld", b->issued % 1000);
+
+    slot->sent_ns = now_ns();
+    b->issued++;
+    switch (b->op) {
+    case CLIENT_OP_GET:
+        return client_get(b->pool, key, key_len, on_reply, slot);
+    case CLIENT_OP_SET:
+        return client_set(b->pool, key, key_len, BENCH_VALUE, strlen(BENCH_VALUE), on_reply, slot);
+    default:
+        return client_send(b->pool, CLIENT_OP_PING, NULL, 0, on_reply, slot);
+    }
+}
+
+static void on_reply(void *arg, const struct client_reply *reply) {
+    struct slot *slot = arg;
+    struct bench *b = slot->bench;
+
+    b->completed++;
+    b->latency_sum_ns += now_ns() - slot->sent_ns;
+    // get不存在的键回复NOT_FOUND(3)，也算正常完成
+    if (reply->status != 0 && !(reply->status == 3 && b->op == CLIENT_OP_GET)) {
+        b->errors++;
+    }
+    if (b->issued < b->count && issue(slot) == -1) {
+        b->errors++;
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c connections] [-d depth] [-n count] [-t ping|get|set] host:port\n", prog);
+    fprintf(stderr, "  -c connections   connections in the pool (default: %d)\n", DEFAULT_CONNECTIONS);
+    fprintf(stderr, "  -d depth         outstanding requests per connection (default: %d)\n", DEFAULT_DEPTH);
+    fprintf(stderr, "  -n count         total requests (default: %d)\n", DEFAULT_COUNT);
+    fprintf(stderr, "  -t type          request type (default: ping)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int connections = DEFAULT_CONNECTIONS;
+    int depth = DEFAULT_DEPTH;
+    struct bench b;
+    int opt;
+
+    memset(&b, 0, sizeof(b));
+    b.count = DEFAULT_COUNT;
+    b.op = CLIENT_OP_PING;
+    while ((opt = getopt(argc, argv, "c:d:n:t:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 'n':
+            b.count = atol(optarg);
+            break;
+        case 't':
+            if (strcmp(optarg, "ping") == 0) {
+                b.op = CLIENT_OP_PING;
+            } else if (strcmp(optarg, "get") == 0) {
+                b.op = CLIENT_OP_GET;
+            } else if (strcmp(optarg, "set") == 0) {
+                b.op = CLIENT_OP_SET;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc || connections <= 0 || depth <= 0 || b.count <= 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    char host[256];
+    const char *colon = strrchr(argv[optind], ':');
+    if (!colon || (size_t)(colon - argv[optind]) >= sizeof(host)) {
+        fprintf(stderr, "Expected host:port, got %s\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(host, argv[optind], colon - argv[optind]);
+    host[colon - argv[optind]] = '\0';
+
+    b.pool = client_pool_create(host, colon + 1, connections);
+    if (!b.pool) {
+        exit(EXIT_FAILURE);
+    }
+    // 调用者自己的事件循环：连接池对外只有一个fd
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = b.pool;
+    if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_pool_fd(b.pool), &event) == -1) {
+        perror("epoll");
+        exit(EXIT_FAILURE);
+    }
+
+    long inflight = (long)connections * depth;
+    if (inflight > b.count) {
+        inflight = b.count;
+    }
+    struct slot *slots = calloc(inflight, sizeof(*slots));
+    if (!slots) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t start = now_ns();
+    for (long i = 0; i < inflight; i++) {
+        slots[i].bench = &b;
+        if (issue(&slots[i]) == -1) {
+            fprintf(stderr, "client_send failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    client_pool_flush(b.pool);
+
+    struct client_pool_stats st;
+    do {
+        struct epoll_event events[1];
+        int n = epoll_wait(epoll_fd, events, 1, 1000);
+        if (n == -1) {
+            perror("epoll_wait");
+            break;
+        }
+        client_pool_process(b.pool);
+        client_pool_get_stats(b.pool, &st);
+    } while (st.outstanding > 0);
+    double elapsed = (now_ns() - start) / 1e9;
+
+    printf("connections=%d depth=%d requests=%ld errors=%ld failed=%llu\n", connections, depth, b.completed,
+           b.errors, st.failed);
+    printf("%.0f req/s, avg latency %.1f us, %.1f requests per writev\n", b.completed / elapsed,
+           b.latency_sum_ns / (b.completed ? b.completed : 1) / 1000,
+           (double)st.requests / (st.writev_calls ? st.writev_calls : 1));
+    client_pool_destroy(b.pool);
+    close(epoll_fd);
+    free(slots);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE // MAP_NORESERVE, MAP_STACK, madvise
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "coro.h"
+
+#define CORO_ARENA_STACKS 64        // 每次mmap一块切出的栈数，避免每个栈一个映射
+#define CORO_POOL_KEEP 1024         // 池里超过该数量的空闲栈把物理页还给内核
+#define CORO_STACK_CANARY 0xC0C0DEADBEEFC0C0ULL
+
+struct coro {
+    ucontext_t ctx;
+    ucontext_t caller;      // coro_resume的调用者，挂起或结束时切回这里
+    void (*fn)(void *arg);
+    void *arg;
+    char *stack;            // 栈的最低地址，放哨兵值
+    int finished;
+    struct coro *next;      // 空闲池链表
+};
+
+static struct coro *current = NULL;
+static struct coro *pool = NULL;
+static int pooled = 0;
+static int active = 0;
+static int stacks = 0;
+static unsigned long long switches = 0;
+
+// 一次mmap出CORO_ARENA_STACKS个栈放进池里
+// 不加保护页：每个保护页都会把映射拆开，十万个栈会超过vm.max_map_count，改用哨兵值检查
+// noinline：内联进coro_create后，gcc把getcontext当作setjmp，对这里的局部变量误报clobbered
+__attribute__((noinline)) static int coro_pool_grow(void) {
+    size_t size = (size_t)CORO_ARENA_STACKS * CORO_STACK_SIZE;
+    char *arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (arena == MAP_FAILED) {
+        perror("mmap coro stacks");
+        return -1;
+    }
+    // 大页会让每个栈实际占满32KB甚至整块2MB，这里只要按4KB页按需分配
+    if (madvise(arena, size, MADV_NOHUGEPAGE) == -1) {
+        perror("madvise MADV_NOHUGEPAGE");
+    }
+
+    for (int i = 0; i < CORO_ARENA_STACKS; i++) {
+        struct coro *co = malloc(sizeof(*co));
+        if (!co) {
+            // 已切出的栈留在池里，剩下的映射不再使用
+            perror("malloc coro");
+            return pooled > 0 ? 0 : -1;
+        }
+        co->stack = arena + (size_t)i * CORO_STACK_SIZE;
+        co->next = pool;
+        pool = co;
+        pooled++;
+        stacks++;
+    }
+    return 0;
+}
+
+static void coro_check_stack(const struct coro *co) {
+    if (*(const uint64_t*)co->stack != CORO_STACK_CANARY) {
+        fprintf(stderr, "coroutine stack overflow (stack size %d)\n", CORO_STACK_SIZE);
+        abort();
+    }
+}
+
+static void coro_main(void) {
+    struct coro *co = current;
+    co->fn(co->arg);
+    co->finished = 1;
+    setcontext(&co->caller);
+}
+
+struct coro* coro_create(void (*fn)(void *arg), void *arg) {
+    if (!pool && coro_pool_grow() == -1) {
+        return NULL;
+    }
+    struct coro *co = pool;
+    pool = co->next;
+    pooled--;
+
+    if (getcontext(&co->ctx) == -1) {
+        perror("getcontext");
+        co->next = pool;
+        pool = co;
+        pooled++;
+        return NULL;
+    }
+    co->ctx.uc_stack.ss_sp = co->stack;
+    co->ctx.uc_stack.ss_size = CORO_STACK_SIZE;
+    co->ctx.uc_link = NULL;
+    makecontext(&co->ctx, coro_main, 0);
+    *(uint64_t*)co->stack = CORO_STACK_CANARY;
+
+    co->fn = fn;
+    co->arg = arg;
+    co->finished = 0;
+    co->next = NULL;
+    active++;
+    return co;
+}
+
+// 协程结束：放回池里；池太大时释放栈的物理页（映射保留，下次使用时按需重新分配）
+static void coro_release(struct coro *co) {
+    active--;
+    if (pooled >= CORO_POOL_KEEP && madvise(co->stack, CORO_STACK_SIZE, MADV_DONTNEED) == -1) {
+        perror("madvise coro stack");
+    }
+    co->next = pool;
+    pool = co;
+    pooled++;
+}
+
+int coro_resume(struct coro *co) {
+    if (current) {
+        fprintf(stderr, "coro_resume called inside a coroutine\n");
+        abort();
+    }
+
+    current = co;
+    switches++;
+    if (swapcontext(&co->caller, &co->ctx) == -1) {
+        perror("swapcontext");
+        abort();
+    }
+    current = NULL;
+    coro_check_stack(co);
+
+    if (co->finished) {
+        coro_release(co);
+        return 0;
+    }
+    return 1;
+}
+
+void coro_yield(void) {
+    struct coro *co = current;
+    if (!co) {
+        fprintf(stderr, "coro_yield called outside a coroutine\n");
+        abort();
+    }
+    switches++;
+    if (swapcontext(&co->ctx, &co->caller) == -1) {
+        perror("swapcontext");
+        abort();
+    }
+}
+
+struct coro* coro_current(void) {
+    return current;
+}
+
+void coro_get_stats(struct coro_stats *out) {
+    out->active = active;
+    out->pooled = pooled;
+    out->stacks = stacks;
+    out->switches = switches;
+}
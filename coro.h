@@ -0,0 +1,38 @@
+#ifndef CORO_H
+#define CORO_H
+
+// 轻量级有栈协程：让连接的处理函数按顺序写读写步骤，遇到EAGAIN时挂起，
+// 等事件循环收到就绪事件再恢复，不用手写状态机
+// - 基于ucontext，只在事件循环线程使用，不支持嵌套（协程里不能再resume别的协程）
+// - 栈按CORO_STACK_SIZE从大块mmap里切出并放回池里复用，只有真正用到的页占用内存：
+//   栈顶用到的页 + 栈底哨兵所在的一页，加上约2KB的上下文，十万个挂起的处理函数约1GB
+// - 栈底有哨兵值，每次切换回来时检查，栈溢出时直接abort而不是悄悄破坏内存
+//   处理函数不要在栈上放大缓冲区，否则每个挂起的协程都要多占几页
+
+#define CORO_STACK_SIZE (32 * 1024)
+
+struct coro;
+
+struct coro_stats {
+    int active;             // 已创建、尚未结束的协程
+    int pooled;             // 池里空闲的协程（连同栈）
+    int stacks;             // 已mmap的栈总数
+    unsigned long long switches;
+};
+
+// 创建协程，第一次coro_resume时开始执行fn(arg)；失败返回NULL
+struct coro* coro_create(void (*fn)(void *arg), void *arg);
+
+// 切换到协程执行，直到它调用coro_yield或fn返回
+// 返回值: 1=协程挂起, 0=协程已结束（已放回池里，不能再使用）
+int coro_resume(struct coro *co);
+
+// 在协程内调用：挂起当前协程，回到coro_resume的调用者
+void coro_yield(void);
+
+// 当前正在执行的协程，不在协程内时为NULL
+struct coro* coro_current(void);
+
+void coro_get_stats(struct coro_stats *stats);
+
+#endif
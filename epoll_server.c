@@ -1,4 +1,7 @@
+#define _GNU_SOURCE // accept4, TCP_* 选项
+#define _FILE_OFFSET_BITS 64 // sendfile支持超过2GB的文件
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -6,95 +9,908 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <linux/errqueue.h>
 #include <time.h>
 #include <signal.h>
+#include "kv_store.h"
+#include "worker_pool.h"
+#include "coro.h"
+#include "capture.h"
+#include "scan.h"
+#include "shm_ring.h"
+#include "http.h"
+#include "journal.h"
 
 #define MAX_EVENTS 1000
+#define MAX_PRIORITY_EVENTS 64
+#define PRIORITY_CHECK_EVENTS 64   // 普通事件每处理这么多个，再看一次高优先级集合
 #define BUFFER_SIZE 4096
 #define DEFAULT_PORT 8080
 #define LISTEN_BACKLOG 128
+#define MAX_LISTENERS 8
+#define MAX_WRITE_IOV 64
+#define LARGE_DATA_SIZE (10 * 1024 * 1024) // 10MB
+#define FILE_CACHE_SIZE 256      // 文件缓存最多保留的打开fd数
+#define FILE_CACHE_BUCKETS 512
+#define FILE_CACHE_TTL 5         // 缓存项超过该秒数后重新fstatat校验文件是否被替换
+#define MAX_FILE_NAME 255
+#define PROXY_SPLICE_SIZE (64 * 1024) // 每次splice进管道的最大字节数（默认管道容量）
+#define KV_DEFAULT_MEMORY_MB 64
+#define DEFAULT_WORKER_THREADS 4
+#define DEFAULT_DRAIN_TIMEOUT 10  // 退出时等待连接发完回复的秒数
+#define DRAIN_POLL_MS 100
+#define TCP_SAMPLE_INTERVAL_MS 1000  // 采样TCP_INFO/SIOCOUTQ的周期
+#define ZC_LINGER_SECONDS 10         // 关闭时最多等零拷贝完成通知的秒数，超时后RST丢弃未发数据再释放
+#define TCP_SAMPLE_BATCH 1024        // 每个周期最多采样的连接数，连接多时轮流采样
+#define SLOW_CONSUMER_BYTES (1024 * 1024) // 待发送数据（用户态队列 + 内核未确认）超过该值算积压
+#define SLOW_CONSUMER_SAMPLES 3      // 连续这么多次采样都积压才标记为慢消费者
+#define HIST_BUCKETS 32              // 直方图按2的幂分桶
+#define SHM_MAX_SESSIONS 64          // 共享内存客户端数上限
+#define SHM_POLL_US 200              // 最近这么久内有共享内存请求时，事件循环轮询队列而不是睡眠
+#define SHM_SPIN_US 20               // 轮询模式下每轮最多连续轮询这么久，再回到epoll_wait看其他fd
+#define UPGRADE_ENV "EPOLL_SERVER_UPGRADE_FD" // 热升级：新进程从这个环境变量得知继承的Unix socket
+#define MGET_MAX_KEYS 64
+#define MAX_CHANNEL_NAME 128
+#define CHANNEL_BUCKETS 1024
+#define SUB_MAX_PENDING (1024 * 1024) // 订阅者发送队列积压超过该值时按其策略丢弃消息或断开
+#define OUT_CHUNK_POOL_SIZE 65536     // 复用的空数据块（只有头部）个数上限
+#define CO_READ_CHUNK 1024            // 协程栈上的读缓冲，保持挂起的协程只占用栈顶一页
+#define CO_STREAM_CHUNK (16 * 1024)   // stream每次co_write的字节数
+#define JOURNAL_DEFAULT_INTERVAL_MS 10 // 审计日志组提交的默认间隔
+
+// 二进制协议：连接上收到的第一个字节是BIN_MAGIC时，该连接切换为二进制帧
+// 帧 = 12字节帧头 + payload，回复带上请求的request_id，客户端可以乱序流水线
+#define BIN_MAGIC 0xEB
+#define BIN_HEADER_SIZE 12
+#define MAX_BIN_PAYLOAD (64 * 1024)
+
+enum bin_opcode {
+    BIN_OP_PING = 1,        // 回复空payload
+    BIN_OP_TIME = 2,        // 回复8字节Unix时间（秒，网络字节序）
+    BIN_OP_ECHO = 3,        // 原样返回payload
+    BIN_OP_HELP = 4,
+    BIN_OP_QUIT = 5,
+    BIN_OP_STATS = 6,
+    BIN_OP_LARGE = 7,       // 回复10MB数据
+    BIN_OP_FILE = 8,        // payload为文件名，回复文件内容
+    BIN_OP_SET = 9,         // payload为 2字节键长 + 键 + 值
+    BIN_OP_GET = 10,        // payload为键，回复值
+    BIN_OP_DEL = 11,        // payload为键
+    BIN_OP_MGET = 12,       // payload为若干个 2字节键长 + 键，回复若干个 4字节值长 + 值
+    BIN_OP_SUBSCRIBE = 13,  // payload为 1字节积压策略(enum sub_policy) + 频道名
+    BIN_OP_UNSUBSCRIBE = 14,// payload为频道名
+    BIN_OP_PUBLISH = 15,    // payload为 2字节频道名长 + 频道名 + 消息，回复4字节订阅者数
+    BIN_OP_MESSAGE = 16,    // 服务器推送（request_id为0），payload同PUBLISH
+    BIN_OP_CONNS = 17,      // 回复conns命令的文本
+    BIN_OP_DURABLE = 18,    // payload为1字节：1=之后的变更命令等审计日志落盘后才回复，0=关闭
+};
+
+enum bin_status {
+    BIN_STATUS_OK = 0,
+    BIN_STATUS_UNKNOWN_OP = 1,
+    BIN_STATUS_FAILED = 2,  // payload为错误描述
+    BIN_STATUS_NOT_FOUND = 3,
+};
+
+// 二进制帧头（线上为网络字节序，这里保存解析后的主机字节序）
+struct bin_header {
+    uint8_t magic;
+    uint8_t opcode;
+    uint16_t status;        // 请求中为0
+    uint32_t request_id;
+    uint32_t length;        // payload长度
+};
+
+enum conn_protocol {
+    PROTO_UNKNOWN = 0,      // 还没收到数据
+    PROTO_TEXT,             // 以换行分隔的文本命令
+    PROTO_BINARY,
+    PROTO_HTTP,             // HTTP/1.1监听端口上的连接，accept时确定
+};
+
+// 旧版本glibc头文件中可能缺少零拷贝相关定义（Linux 4.14+）
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+#define WELCOME_MSG "Welcome to Carlos's Echo Server!\n"
+
+// 监听socket的配置档案（-P <name> 指定主端口，-l <port>:<name> 追加监听端口）
+// 数值为0表示保持内核默认值
+struct socket_profile {
+    const char *name;
+    int defer_accept_secs;  // TCP_DEFER_ACCEPT：数据到达后才唤醒accept，0=关闭
+    int fastopen_qlen;      // TCP_FASTOPEN 队列长度，0=关闭
+    int coalesce_welcome;   // 欢迎消息与第一条回复合并成一次写入
+    int sndbuf;             // SO_SNDBUF（字节）
+    int rcvbuf;             // SO_RCVBUF（字节），同时设置在监听socket上以影响窗口扩大因子
+    int nodelay;            // TCP_NODELAY：关闭Nagle，小回复立即发出
+    int cork;               // 一次读事件产生的所有回复包在TCP_CORK里，攒满整段再发
+    int notsent_lowat;      // TCP_NOTSENT_LOWAT：未发送数据低于该值才报告可写
+    int keepalive_idle;     // 空闲多少秒后开始探测，0=不开启keepalive
+    int keepalive_intvl;    // 探测间隔（秒）
+    int keepalive_cnt;      // 探测失败多少次判定连接断开
+    int http;               // 说HTTP/1.1而不是文本/二进制协议，不发欢迎消息
+    int priority;           // 监听socket和连接注册在单独的高优先级epoll集合里，每轮先于普通事件处理
+};
+
+static const struct socket_profile socket_profiles[] = {
+    // 默认：连接建立后立即发送欢迎消息，不改任何socket选项
+    { .name = "default" },
+    // 短连接：客户端先发命令，accept时数据已就绪，欢迎消息随第一条回复一起发出
+    { .name = "short", .defer_accept_secs = 5, .fastopen_qlen = 256,
+      .coalesce_welcome = 1, .nodelay = 1 },
+    // 交互型（ping/echo）：小包立即发送，发送队列保持很短，较快发现死连接
+    { .name = "chatty", .nodelay = 1, .notsent_lowat = 16 * 1024,
+      .keepalive_idle = 30, .keepalive_intvl = 5, .keepalive_cnt = 3 },
+    // 大块传输（large）：大缓冲区，CORK合并分段，EPOLLOUT只在内核真正缺数据时触发
+    { .name = "bulk", .sndbuf = 4 * 1024 * 1024, .rcvbuf = 1024 * 1024,
+      .cork = 1, .notsent_lowat = 256 * 1024,
+      .keepalive_idle = 60, .keepalive_intvl = 10, .keepalive_cnt = 6 },
+    // HTTP/1.1（wrk等通用压测工具）：keep-alive加流水线，回复按读事件合并发送
+    { .name = "http", .http = 1, .nodelay = 1 },
+    // 管理/健康检查端口：事件先于普通连接处理，负载再高stats和ping也不用排队
+    { .name = "admin", .priority = 1, .nodelay = 1 },
+};
+
+// 监听端口
+struct listener {
+    int fd;
+    int port;
+    const struct socket_profile *profile;
+};
+
+// 文件缓存项：缓存打开的fd和文件大小，避免每次get都open/fstat
+struct file_entry {
+    char name[MAX_FILE_NAME + 1];
+    int fd;
+    off_t size;
+    dev_t dev;              // 以下用于判断文件是否被替换
+    ino_t ino;
+    struct timespec mtime;
+    time_t checked;         // 上次校验时间
+    int refs;               // 正在发送该文件的数据块数
+    int cached;             // 仍在缓存中；被淘汰后等refs归零再关闭
+    struct file_entry *hash_next;
+    struct file_entry *lru_prev;  // LRU链表，表头是最近使用的
+    struct file_entry *lru_next;
+};
+
+// 发送队列对外部内存的引用：写不完时数据块直接指向这块内存，不拷贝
+struct out_ref {
+    void (*retain)(void *ctx);
+    void (*release)(void *ctx);
+    void *ctx;
+};
+
+// 待发送数据块（发送队列按链表串起来）
+// file不为NULL时数据在文件里，用sendfile发送，sent即文件偏移
+// 否则数据在base处：指向自身的data，或者是持有引用的外部内存
+struct out_chunk {
+    struct out_chunk *next;
+    size_t cap;             // data的容量；0表示只有头部，释放时放回池里复用
+    size_t len;             // 数据总长度
+    size_t sent;            // 已发送字节数
+    struct file_entry *file;
+    const char *base;
+    void (*release)(void *ctx);   // 外部内存的引用，释放数据块时调用
+    void *release_ctx;
+    // MSG_ZEROCOPY：内核仍引用这块内存，收到全部完成通知前不能释放
+    uint32_t zc_first;      // 本块第一次零拷贝发送的通知序号
+    uint32_t zc_last;       // 本块最后一次零拷贝发送的通知序号
+    uint32_t zc_outstanding;// 尚未收到完成通知的零拷贝发送次数
+    char data[];
+};
+
+// 一次TCP状态采样：内核里的拥塞控制状态和队列长度
+// write成功只说明数据进了本地发送缓冲区，这里能看到还有多少没被对端确认
+struct tcp_sample {
+    time_t at;              // 采样时间，0表示还没采样过
+    uint32_t rtt_us;        // 平滑RTT
+    uint32_t rttvar_us;
+    uint32_t snd_cwnd;      // 拥塞窗口（段数）
+    uint32_t total_retrans; // 累计重传段数
+    int outq;               // SIOCOUTQ：发送缓冲区中未被确认的字节（含未发送）
+    int inq;                // SIOCINQ：接收缓冲区中还没读的字节
+};
+
+// 2的幂分桶的直方图，第i个桶统计[2^(i-1), 2^i)
+struct histogram {
+    unsigned long long counts[HIST_BUCKETS];
+};
+
+// 每个客户端连接的状态，按fd索引
+struct connection {
+    int fd;
+    const struct socket_profile *profile;
+    int welcome_pending;    // 欢迎消息尚未发送（等待与第一条回复合并）
+    int shut_wr;            // 退出排空：回复已全部交给内核并shutdown(SHUT_WR)，等对端关闭
+    int protocol;           // enum conn_protocol，由第一个字节决定
+    char *in_buf;           // 接收缓冲区，保存未凑成完整请求的数据
+    size_t in_len;
+    size_t in_cap;
+    int epollout;           // 当前是否已注册EPOLLOUT
+    int corked;             // 当前是否处于TCP_CORK状态
+    struct out_chunk *out_head;   // 发送队列
+    struct out_chunk *out_tail;
+    size_t out_pending;     // 发送队列中尚未发送的字节数
+    int zerocopy;           // 已开启SO_ZEROCOPY；内核报告实际发生了拷贝后关闭
+    uint32_t zc_next_seq;   // 下一次零拷贝发送的通知序号（内核按socket从0递增）
+    struct out_chunk *zc_head;    // 已发送完但等待零拷贝完成通知的数据块
+    struct out_chunk *zc_tail;
+    // 代理模式：客户端和后端各有一个connection，互为peer
+    int peer_fd;            // 对端fd，-1表示不是代理连接
+    int pipe_fds[2];        // 从本连接读出、发往对端的数据暂存在这个管道里
+    size_t pipe_bytes;      // 管道中尚未发往对端的字节数
+    int read_eof;           // 本连接已读到EOF
+    int peer_shut;          // 已对对端执行shutdown(SHUT_WR)
+    int connecting;         // 后端连接尚未建立
+    // 发布/订阅
+    struct subscription *subs;    // 本连接订阅的频道
+    int sub_count;
+    int sub_cap;
+    int sub_policy;         // enum sub_policy，发送队列积压时的处理方式
+    unsigned long long sub_dropped; // 因积压丢弃的消息数
+    struct offload_job *jobs;     // 在工作线程池中未完成的任务
+    struct tcp_sample sample;     // 最近一次TCP状态采样
+    int slow_samples;       // 连续积压的采样次数
+    int slow_consumer;      // 已标记为慢消费者
+    uint64_t capture_id;    // 录制文件里的连接编号，0表示不录制
+    size_t http_scanned;    // HTTP：当前请求已检查过的字节数（请求头没收全时）
+    int http_close;         // enum http_close_state
+    // 协程处理函数（upload/stream这类多步命令），运行期间暂停解析后续命令
+    struct coro *co;
+    int co_wait;            // enum co_wait
+    int (*co_handler)(struct connection *conn, void *arg);
+    void *co_arg;
+    int co_result;          // 处理函数的返回值，-1表示关闭连接
+    uint32_t peer_addr;     // 客户端IPv4地址和端口（网络字节序），写进审计日志
+    uint16_t peer_port;
+    // 持久化确认（durable on）：变更命令的回复等它的日志记录fdatasync之后才发出
+    int durable;
+    uint64_t journal_wait;  // 等待落盘的日志序号，0表示没有在等；期间发送队列只进不出
+    struct connection *journal_next; // 等待落盘的连接链表
+    // 关闭后还在等零拷贝完成通知（见zc_linger_start）
+    time_t zc_linger_deadline;
+    struct connection *zc_linger_next;
+};
+
+// 连接上的协程在等什么
+enum co_wait {
+    CO_READY = 0,           // 已创建，等process_input移除命令行后开始执行
+    CO_WAIT_READ,           // co_read遇到EAGAIN，等EPOLLIN
+    CO_WAIT_WRITE,          // co_write遇到EAGAIN，等EPOLLOUT
+    CO_CANCELLED,           // 连接正在关闭，co_read/co_write返回-1
+};
+
+// HTTP连接的关闭过程：回复发完后shutdown(SHUT_WR)，等客户端关闭
+enum http_close_state {
+    HTTP_OPEN = 0,
+    HTTP_CLOSE_AFTER_REPLY,     // Connection: close或请求出错，之后的请求不再处理
+    HTTP_SHUT,                  // 已经shutdown(SHUT_WR)
+};
+
+// 订阅者发送队列积压超过SUB_MAX_PENDING时的处理方式
+enum sub_policy {
+    SUB_POLICY_DROP = 0,    // 丢弃新消息，直到积压消化
+    SUB_POLICY_CLOSE = 1,   // 断开连接
+};
+
+// 订阅关系：频道的订阅者数组和连接的订阅数组互相记录下标，取消订阅是O(1)
+struct subscriber {
+    struct connection *conn;
+    int sub_idx;            // 在conn->subs中的下标
+};
+
+struct channel {
+    char name[MAX_CHANNEL_NAME + 1];
+    size_t name_len;
+    struct channel *hash_next;
+    struct subscriber *subs;
+    size_t count;
+    size_t cap;
+};
+
+struct subscription {
+    struct channel *channel;
+    size_t pos;             // 在channel->subs中的下标
+};
+
+// 交给工作线程池执行的命令，完成后回到事件循环发送回复
+struct offload_job {
+    struct job job;                 // 必须是第一个成员
+    struct connection *conn;        // 连接关闭时置NULL，任务同时被取消
+    struct offload_job *conn_next;  // 同一连接上未完成的任务
+    int binary;                     // 二进制请求，req有效
+    struct bin_header req;
+    struct out_chunk *chunk;        // large：工作线程生成的数据
+};
+
+// 发布的消息只保存一份，各订阅者的发送队列按引用持有
+struct shared_buf {
+    unsigned int refs;
+    size_t len;
+    char data[];
+};
+
+// 服务器统计（stats命令输出）
+struct server_stats {
+    unsigned long long connections_accepted;
+    unsigned long long connections_active;
+    unsigned long long zerocopy_sends;      // 以MSG_ZEROCOPY发出的send调用
+    unsigned long long zerocopy_hits;       // 完成通知：确实零拷贝
+    unsigned long long zerocopy_misses;     // 完成通知：内核仍然拷贝了（如回环、网卡不支持）
+    unsigned long long zerocopy_fallbacks;  // ENOBUFS等原因退回普通拷贝发送
+    int zerocopy_lingering;                 // 已关闭、fd留着等零拷贝完成通知的连接数
+    unsigned long long file_cache_hits;
+    unsigned long long file_cache_misses;
+    unsigned long long sendfile_bytes;
+    unsigned long long proxy_sessions;
+    unsigned long long proxy_bytes;         // 经splice转发的字节数（两个方向合计）
+    unsigned long long published;
+    unsigned long long deliveries;          // 消息进入订阅者发送队列（或直接发出）的次数
+    unsigned long long sub_dropped;         // 因订阅者积压丢弃的消息数
+    unsigned long long sub_closed;          // 因积压被断开的订阅者数
+    unsigned long long jobs_submitted;      // 提交给工作线程池的任务
+    unsigned long long jobs_cancelled;      // 完成前连接已关闭的任务
+    unsigned long long coroutines_started;
+    unsigned long long coroutines_cancelled;// 挂起时连接被关闭的协程
+    unsigned long long drain_flushed;       // 退出时回复发完后正常关闭的连接
+    unsigned long long drain_forced;        // 排空期限到了仍未关闭、被直接关闭的连接
+    unsigned long long shm_sessions;        // 共享内存客户端总数
+    unsigned long long shm_requests;
+    unsigned long long shm_bells_sent;      // 客户端睡眠时敲的门铃
+    unsigned long long shm_bells_received;  // 服务器睡眠时被门铃唤醒
+    unsigned long long http_requests;
+    unsigned long long http_errors;         // 格式错误、过大或不支持，回复后关闭连接
+    unsigned long long journal_waits;       // 等日志落盘才发出的回复批次
+    unsigned long long requests;            // 处理的请求数（文本、二进制、HTTP、共享内存）
+    unsigned long long priority_passes;     // 取到事件的高优先级集合检查次数
+    unsigned long long priority_events;
+    unsigned long long epoll_ctl_add;       // 客户端连接实际发起的epoll_ctl
+    unsigned long long epoll_ctl_mod;
+    unsigned long long epoll_ctl_del;
+    unsigned long long epoll_ctl_skipped;   // 兴趣集没变或close会自动移除，省掉的epoll_ctl
+    unsigned long long tcp_samples;
+    unsigned long long slow_consumers_flagged; // 被标记为慢消费者的次数
+    int slow_consumers;                     // 当前标记为慢消费者的连接数
+    int pubsub_buffers;                     // 还被发送队列引用、没有释放的共享消息
+    struct histogram rtt_hist;              // 所有采样的RTT（微秒）
+    struct histogram outq_hist;             // 所有采样的内核未确认字节数
+    struct histogram retrans_hist;          // 两次采样之间的新增重传段数
+};
+
+// 共享内存客户端：请求/回复队列在memfd里，门铃是eventfd
+struct shm_session {
+    int ctl_fd;             // Unix socket：只用来发现客户端退出
+    int server_bell;        // 客户端敲：服务器睡眠时有新请求
+    int client_bell;        // 服务器敲：客户端睡眠时有新回复
+    struct shm_channel *ch;
+};
 
 // 全局变量
 static int epoll_fd = -1;
-static int listen_fd = -1;
-static volatile int running = 1;
+static int prio_epoll_fd = -1;         // 高优先级连接的epoll集合，本身注册在epoll_fd里；没有admin端口时为-1
+static int running = 1;
+static int signal_fd = -1;              // SIGINT/SIGTERM经signalfd进入事件循环
+static int draining = 0;               // 收到退出信号，不再接受新连接，等待现有连接发完回复
+static struct timespec drain_deadline;
+static int drain_timeout = DEFAULT_DRAIN_TIMEOUT;  // -g指定，0表示收到信号立即退出
+static char **server_argv = NULL;      // 热升级时用同样的参数启动新进程
+static int upgrade_fd = -1;            // 热升级：老进程与新进程之间的Unix socket
+static pid_t upgrade_pid = -1;         // 正在启动的新进程
+static int inherited_fds[MAX_LISTENERS];   // 新进程：从老进程收到的监听socket及其端口
+static int inherited_ports[MAX_LISTENERS];
+static int inherited_count = 0;
+static int sample_timer_fd = -1;       // 周期采样TCP状态的timerfd
+static int sample_cursor = 0;          // 轮流采样：下一次从这个fd开始
+static struct listener listeners[MAX_LISTENERS];
+static int listener_count = 0;
+static struct connection **connections = NULL;
+static int connections_size = 0;
+static uint32_t *interest = NULL;      // 每个fd当前在epoll里注册的事件，0表示未注册（按fd索引）
+static int interest_size = 0;
+static int epollout_always = 0;        // -E：客户端连接常驻EPOLLOUT，可写等待不再需要epoll_ctl
+static size_t zerocopy_threshold = 0;  // >0时数据块不小于该值走MSG_ZEROCOPY（-Z开启）
+static int files_dir_fd = -1;          // file命令的文件目录（-d指定）
+static struct file_entry *file_buckets[FILE_CACHE_BUCKETS];
+static struct file_entry *file_lru_head = NULL;
+static struct file_entry *file_lru_tail = NULL;
+static int file_cache_count = 0;
+static struct sockaddr_storage backend_addr;  // 代理模式的后端地址（-B指定）
+static socklen_t backend_addr_len = 0;        // 0表示未开启代理模式
+static struct server_stats stats;
+static struct kv_store *kv = NULL;
+static struct channel *channel_buckets[CHANNEL_BUCKETS];
+static int channel_count = 0;
+static struct out_chunk *out_chunk_pool = NULL;  // 空数据块池，扇出时不必每个订阅者malloc一次
+static int out_chunk_pool_count = 0;
+// 连接上的回复都经过这里写出；handler_bench换成写内存的实现，测量时不经过内核
+static ssize_t (*conn_writev)(int fd, const struct iovec *iov, int iovcnt) = writev;
+static struct worker_pool *workers = NULL;      // -w 0时为NULL，慢命令在事件循环里直接执行
+static int worker_threads = DEFAULT_WORKER_THREADS;
+static const char *capture_path = NULL;         // -c指定：录制收到的请求流，供replay重放
+static struct capture *capture = NULL;
+static const char *journal_path = NULL;         // -j指定：变更和管理命令的审计日志
+static int journal_interval_ms = JOURNAL_DEFAULT_INTERVAL_MS;
+static struct journal *journal = NULL;
+static struct connection *journal_waiters = NULL; // 回复在等日志落盘的连接
+static struct connection *zc_lingering = NULL;   // 已关闭但内核可能还在发送零拷贝数据块的连接
+static const char *shm_path = NULL;             // -S指定：共享内存客户端连接的Unix socket路径
+static int shm_listen_fd = -1;
+static int shm_path_owned = 0;                  // 热升级交给新进程后，退出时不删除socket文件
+static struct shm_session shm_sessions[SHM_MAX_SESSIONS];
+static int shm_session_count = 0;
+static uint64_t shm_poll_until = 0;             // 轮询模式截止时间（单调时钟微秒）
+static int shm_spin_enabled = 0;                // 多CPU时才轮询
+
+// 事件循环分阶段计时（-p或profile on开启）：时间按互斥的阶段累计，
+// 嵌套的阶段（如read里的process）结束时切回外层，外层不重复计入
+enum prof_phase {
+    PROF_WAIT = 0,          // 阻塞在epoll_wait
+    PROF_ACCEPT,
+    PROF_READ,              // 读socket（不含处理请求）
+    PROF_PROCESS,           // 解析、执行请求并尝试立即发出回复
+    PROF_WRITE,             // EPOLLOUT：继续发送队列
+    PROF_PROXY,
+    PROF_OTHER,             // 事件分发、定时器、信号、工作线程完成回调
+    PROF_PHASES,
+};
+
+enum prof_syscall {
+    SYS_EPOLL_WAIT = 0,
+    SYS_EPOLL_CTL,
+    SYS_ACCEPT,
+    SYS_READ,
+    SYS_WRITE,              // write/writev/send/sendfile
+    SYS_SETSOCKOPT,
+    SYS_SPLICE,
+    SYS_OTHER,
+    SYS_KINDS,
+};
+
+struct loop_profile {
+    uint64_t ticks[PROF_PHASES];
+    unsigned long long entries[PROF_PHASES];
+    unsigned long long syscalls[SYS_KINDS];  // 只统计事件循环热路径上的系统调用
+    unsigned long long requests;
+    unsigned long long wakeups;
+    unsigned long long events;
+    unsigned long long saturated;            // epoll_wait返回了MAX_EVENTS个事件（可能还有没取到的）
+    struct histogram events_hist;            // 每次唤醒返回的事件数
+    uint64_t started;
+    int phase;                               // 当前阶段
+    uint64_t mark;                           // 进入当前阶段的时刻
+};
+
+static int profiling = 0;
+static struct loop_profile prof;
+static double prof_ticks_per_us = 0;     // 时钟校准结果
+
+// x86上用rdtsc（约20个周期，不进内核），其他平台退回clock_gettime
+static inline uint64_t prof_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// 进入阶段，返回原来的阶段，结束时用prof_leave切回；关闭时只有一次判断
+static inline int prof_enter(int phase) {
+    if (!profiling) {
+        return PROF_OTHER;  // 中途开启时，外层的prof_leave切回PROF_OTHER
+    }
+    uint64_t now = prof_clock();
+    int prev = prof.phase;
+    prof.ticks[prev] += now - prof.mark;
+    prof.entries[phase]++;
+    prof.phase = phase;
+    prof.mark = now;
+    return prev;
+}
+
+static inline void prof_leave(int prev) {
+    if (!profiling) {
+        return;
+    }
+    uint64_t now = prof_clock();
+    prof.ticks[prof.phase] += now - prof.mark;
+    prof.phase = prev;
+    prof.mark = now;
+}
+
+static inline void prof_syscall(int kind) {
+    if (profiling) {
+        prof.syscalls[kind]++;
+    }
+}
+
+static inline void prof_request(void) {
+    stats.requests++;
+    if (profiling) {
+        prof.requests++;
+    }
+}
 
 // 函数声明
-int create_and_bind(int port);
+const struct socket_profile* find_socket_profile(const char *name);
+int add_listener(int port, const struct socket_profile *profile);
+struct listener* listener_get(int fd);
+int create_and_bind(int port, const struct socket_profile *profile);
 int make_socket_non_blocking(int fd);
-void handle_new_connection(int listen_fd, int epoll_fd);
+void apply_socket_profile(int fd, const struct socket_profile *profile);
+struct connection* connection_create(int fd, const struct socket_profile *profile);
+struct connection* connection_get(int fd);
+void connection_destroy(int fd);
+int interest_set(int fd, uint32_t events);
+void interest_forget(int fd);
+void connection_set_epollout(struct connection *conn, int enable);
+void connection_set_cork(struct connection *conn, int enable);
+struct out_chunk* out_chunk_alloc(size_t len);
+void out_chunk_free(struct out_chunk *chunk);
+int connection_sendv(struct connection *conn, const struct iovec *iov, int iovcnt);
+int connection_sendv_ref(struct connection *conn, const struct iovec *iov, int iovcnt,
+                         const struct out_ref *refs);
+void connection_queue_chunk(struct connection *conn, struct out_chunk *chunk);
+int connection_send_chunk(struct connection *conn, struct out_chunk *chunk);
+int connection_flush(struct connection *conn);
+int handle_zerocopy_completions(struct connection *conn);
+void zc_linger_start(struct connection *conn);
+int zc_linger_event(int fd);
+void zc_linger_expire(int force);
+int send_large_data(struct connection *conn, const struct bin_header *req);
+int connection_spawn(struct connection *conn, int (*handler)(struct connection *conn, void *arg),
+                     void *arg);
+int connection_co_step(struct connection *conn);
+void connection_co_resume(struct connection *conn);
+ssize_t co_read(struct connection *conn, void *buf, size_t len);
+int co_write(struct connection *conn, const void *buf, size_t len);
+int handle_co_text(struct connection *conn, char *line);
+struct file_entry* file_cache_get(const char *name);
+void file_cache_put(struct file_entry *entry);
+int send_file(struct connection *conn, const char *name, const struct bin_header *req);
+int send_error_reply(struct connection *conn, const struct bin_header *req, const char *msg);
+int send_binary_reply(struct connection *conn, const struct bin_header *req, uint16_t status,
+                      uint32_t length, const void *payload, size_t payload_len);
+int process_input(struct connection *conn);
+char* connection_input_space(struct connection *conn, size_t *space);
+int connection_input_commit(struct connection *conn, size_t n);
+int connection_feed(struct connection *conn, const char *data, size_t len);
+int process_http_input(struct connection *conn);
+void http_shutdown_if_done(struct connection *conn);
+int handle_text_command(struct connection *conn, char *line);
+int handle_binary_request(struct connection *conn, const struct bin_header *req, const char *payload);
+int handle_kv_text(struct connection *conn, char *line);
+int handle_kv_binary(struct connection *conn, const struct bin_header *req, const char *payload);
+int send_kv_values(struct connection *conn, const struct bin_header *req, int multi,
+                   const char **keys, const size_t *key_lens, int count);
+int handle_pubsub_text(struct connection *conn, char *line);
+int journal_command(struct connection *conn, uint8_t op, const void *data, size_t len);
+void journal_release(uint64_t synced);
+void journal_abort(void);
+int handle_durable(struct connection *conn, const struct bin_header *req, int enable);
+int handle_pubsub_binary(struct connection *conn, const struct bin_header *req, const char *payload);
+int pubsub_subscribe(struct connection *conn, const char *name, size_t len);
+int pubsub_unsubscribe(struct connection *conn, const char *name, size_t len);
+void pubsub_unsubscribe_all(struct connection *conn);
+int pubsub_publish(struct connection *publisher, const char *name, size_t name_len,
+                   const char *msg, size_t msg_len);
+int resolve_backend(const char *spec);
+int proxy_attach(struct connection *client);
+void handle_proxy_event(struct connection *conn, uint32_t events);
+void proxy_close(struct connection *conn);
+void handle_new_connection(struct listener *l, int epoll_fd);
+void dispatch_event(int fd, uint32_t events_mask);
+void dispatch_priority(void);
 void handle_client_message(int client_fd, int epoll_fd);
+void handle_client_write(int client_fd, int epoll_fd);
 void handle_client_disconnect(int client_fd, int epoll_fd);
 void process_message(const char* request, char* response, int response_size);
-void signal_handler(int sig);
+int create_signalfd(void);
+void handle_signal_event(void);
+void drain_start(void);
+int drain_poll(void);
+int drain_wait_ms(void);
+int connection_discard_input(struct connection *conn);
+void close_all_connections(void);
+int create_sample_timer(void);
+void tcp_sample_tick(void);
+void tcp_sample_connection(struct connection *conn);
+int send_conns_listing(struct connection *conn, const struct bin_header *req);
+void profile_start(void);
+void profile_wakeup(int nfds);
+int handle_profile_text(struct connection *conn, char *line);
+void profile_dump(FILE *out);
+int shm_listen(const char *path);
+void shm_accept(void);
+int shm_session_find(int fd);
+void shm_session_event(int idx, int fd);
+void shm_session_close(int idx);
+int shm_poll(void);
+void shm_spin(void);
+int shm_wait_ms(int timeout);
+void upgrade_start(void);
+void handle_upgrade_event(void);
+int upgrade_receive_listeners(void);
+int upgrade_take_listener(int port);
+void upgrade_notify_ready(void);
 void cleanup_and_exit();
+void usage(const char *prog);
 
+// handler_bench直接包含本文件，自己提供main
+#ifndef EPOLL_SERVER_NO_MAIN
 int main(int argc, char *argv[]) {
     int port = DEFAULT_PORT;
+    const struct socket_profile *main_profile = &socket_profiles[0];
+    // 额外监听端口（-l），等主端口确定后再创建
+    int extra_ports[MAX_LISTENERS];
+    const struct socket_profile *extra_profiles[MAX_LISTENERS];
+    int extra_count = 0;
+    size_t kv_memory_mb = KV_DEFAULT_MEMORY_MB;
+    int opt;
+    
+    server_argv = argv;
+    
+    // 解析命令行参数: [-P profile] [-l port:profile]... [port]
+    while ((opt = getopt(argc, argv, "P:l:Z:d:B:m:w:g:pc:j:J:S:Eh")) != -1) {
+        switch (opt) {
+        case 'P':
+            main_profile = find_socket_profile(optarg);
+            if (!main_profile) {
+                fprintf(stderr, "Unknown socket profile: %s\n", optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l': {
+            char *sep = strchr(optarg, ':');
+            if (extra_count >= MAX_LISTENERS - 1) {
+                fprintf(stderr, "Too many listeners (max %d)\n", MAX_LISTENERS);
+                exit(EXIT_FAILURE);
+            }
+            extra_ports[extra_count] = atoi(optarg);
+            extra_profiles[extra_count] = sep ? find_socket_profile(sep + 1) : &socket_profiles[0];
+            if (extra_ports[extra_count] <= 0 || extra_ports[extra_count] > 65535 ||
+                !extra_profiles[extra_count]) {
+                fprintf(stderr, "Invalid listener: %s\n", optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            extra_count++;
+            break;
+        }
+        case 'Z':
+            zerocopy_threshold = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            files_dir_fd = open(optarg, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (files_dir_fd == -1) {
+                perror(optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'B':
+            if (resolve_backend(optarg) == -1) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            kv_memory_mb = strtoul(optarg, NULL, 10);
+            if (kv_memory_mb == 0) {
+                fprintf(stderr, "Invalid memory limit: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'w':
+            worker_threads = atoi(optarg);
+            if (worker_threads < 0) {
+                fprintf(stderr, "Invalid worker thread count: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            profiling = 1;
+            break;
+        case 'c':
+            capture_path = optarg;
+            break;
+        case 'j':
+            journal_path = optarg;
+            break;
+        case 'J':
+            journal_interval_ms = atoi(optarg);
+            if (journal_interval_ms <= 0) {
+                fprintf(stderr, "Invalid journal interval: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            shm_path = optarg;
+            break;
+        case 'E':
+            epollout_always = 1;
+            break;
+        case 'g':
+            drain_timeout = atoi(optarg);
+            if (drain_timeout < 0) {
+                fprintf(stderr, "Invalid drain timeout: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
     
-    // 解析命令行参数
-    if (argc > 1) {
-        port = atoi(argv[1]);
+    if (optind < argc) {
+        port = atoi(argv[optind]);
         if (port <= 0 || port > 65535) {
             fprintf(stderr, "Invalid port number: %d\n", port);
             exit(EXIT_FAILURE);
         }
     }
     
-    // 设置信号处理
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    // 设置信号处理：SIGINT/SIGTERM屏蔽后由signalfd在事件循环里读取
+    // 必须在创建工作线程之前屏蔽，线程继承屏蔽字，信号才不会投递到工作线程上
     signal(SIGPIPE, SIG_IGN); // 忽略SIGPIPE
-    
-    printf("Starting epoll server on port %d...\n", port);
-    
-    // 1. 创建和绑定监听socket
-    listen_fd = create_and_bind(port);
-    if (listen_fd == -1) {
+    signal_fd = create_signalfd();
+    if (signal_fd == -1) {
         exit(EXIT_FAILURE);
     }
     
-    // 2. 设置为非阻塞
-    if (make_socket_non_blocking(listen_fd) == -1) {
-        close(listen_fd);
+    // 由老进程热升级启动时，先接收它的监听socket，add_listener直接复用
+    if (upgrade_receive_listeners() == -1) {
         exit(EXIT_FAILURE);
     }
     
-    // 3. 开始监听
-    if (listen(listen_fd, LISTEN_BACKLOG) == -1) {
-        perror("listen");
-        close(listen_fd);
+    printf("Starting epoll server on port %d (profile: %s)...\n", port, main_profile->name);
+    
+    if (capture_path) {
+        capture = capture_open(capture_path);
+        if (!capture) {
+            exit(EXIT_FAILURE);
+        }
+        printf("Capturing inbound traffic to %s\n", capture_path);
+    }
+    
+    if (journal_path) {
+        journal = journal_open(journal_path, journal_interval_ms);
+        if (!journal) {
+            exit(EXIT_FAILURE);
+        }
+        printf("Journaling commands to %s (group commit every %d ms)\n", journal_path, journal_interval_ms);
+    }
+    
+    kv = kv_create(kv_memory_mb * 1024 * 1024);
+    if (!kv) {
+        perror("kv_create");
         exit(EXIT_FAILURE);
     }
     
-    // 4. 创建epoll实例
+    // 1. 创建epoll实例
     epoll_fd = epoll_create1(EPOLL_CLOEXEC);
     if (epoll_fd == -1) {
         perror("epoll_create1");
-        close(listen_fd);
         exit(EXIT_FAILURE);
     }
     
-    // 5. 将监听socket注册到epoll
-    struct epoll_event event;
-    event.data.fd = listen_fd;
-    event.events = EPOLLIN | EPOLLET; // 边沿触发
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1) {
-        perror("epoll_ctl: listen_fd");
+    struct epoll_event signal_event;
+    signal_event.events = EPOLLIN;
+    signal_event.data.fd = signal_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &signal_event) == -1) {
+        perror("epoll_ctl ADD signalfd");
+        cleanup_and_exit();
+    }
+    
+    sample_timer_fd = create_sample_timer();
+    if (sample_timer_fd == -1) {
+        cleanup_and_exit();
+    }
+    signal_event.data.fd = sample_timer_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sample_timer_fd, &signal_event) == -1) {
+        perror("epoll_ctl ADD timerfd");
+        cleanup_and_exit();
+    }
+    
+    // 工作线程池的完成通知eventfd和socket一起由epoll监听
+    if (worker_threads > 0) {
+        workers = worker_pool_create(worker_threads);
+        if (!workers) {
+            cleanup_and_exit();
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = worker_pool_event_fd(workers);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event) == -1) {
+            perror("epoll_ctl ADD eventfd");
+            cleanup_and_exit();
+        }
+    }
+    
+    // 审计日志写线程的落盘通知
+    if (journal) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = journal_event_fd(journal);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event) == -1) {
+            perror("epoll_ctl ADD journal eventfd");
+            cleanup_and_exit();
+        }
+    }
+    
+    // 2. 创建、绑定、监听并注册所有监听socket
+    if (add_listener(port, main_profile) == -1) {
         cleanup_and_exit();
     }
+    for (int i = 0; i < extra_count; i++) {
+        if (add_listener(extra_ports[i], extra_profiles[i]) == -1) {
+            cleanup_and_exit();
+        }
+    }
+    
+    if (shm_path) {
+        shm_listen_fd = shm_listen(shm_path);
+        if (shm_listen_fd == -1) {
+            cleanup_and_exit();
+        }
+    }
     
-    printf("Server listening on 0.0.0.0:%d\n", port);
+    for (int i = 0; i < listener_count; i++) {
+        printf("Server listening on 0.0.0.0:%d (profile: %s)\n",
+               listeners[i].port, listeners[i].profile->name);
+    }
+    if (shm_path) {
+        printf("Shared-memory clients on %s\n", shm_path);
+    }
+    upgrade_notify_ready();
     printf("Press Ctrl+C to stop the server\n");
+    if (profiling) {
+        profile_start();
+    }
     
     // 6. 主事件循环
     struct epoll_event events[MAX_EVENTS];
     
     while (running) {
         // "number of fds"（就绪文件描述符数量）
-        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000); // 1秒超时
+        // 1秒超时；排空期间不超过剩余期限；共享内存客户端活跃时不睡眠
+        int timeout = draining ? drain_wait_ms() : 1000;
+        if (shm_session_count > 0) {
+            timeout = shm_wait_ms(timeout);
+        }
+        prof_enter(PROF_WAIT);
+        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        prof_enter(PROF_OTHER);
+        profile_wakeup(nfds);
         
         if (nfds == -1) {
             if (errno == EINTR) {
@@ -104,67 +920,273 @@ int main(int argc, char *argv[]) {
             break;
         }
         
-        // 处理所有就绪的事件
+        // 处理所有就绪的事件：高优先级集合先处理，普通事件每处理PRIORITY_CHECK_EVENTS个再看一次，
+        // 管理/健康检查连接不用排在一整批普通事件后面
         for (int i = 0; i < nfds; i++) {
-            int fd = events[i].data.fd;
-            uint32_t events_mask = events[i].events;
-            
-            // 打印事件详情（调试用）
-            printf("Event on fd %d: ", fd);
-            if (events_mask & EPOLLIN) printf("EPOLLIN ");
-            if (events_mask & EPOLLOUT) printf("EPOLLOUT ");
-            if (events_mask & EPOLLRDHUP) printf("EPOLLRDHUP ");
-            if (events_mask & EPOLLPRI) printf("EPOLLPRI ");
-            if (events_mask & EPOLLERR) printf("EPOLLERR ");
-            if (events_mask & EPOLLHUP) printf("EPOLLHUP ");
-            // 注意：EPOLLET 是触发模式标志，不会出现在返回的事件中
-            printf("\n");
-            
-            if (fd == listen_fd) {
-                // 监听套接字事件
-                if (events_mask & EPOLLIN) {
-                    // 新连接到达
-                    handle_new_connection(listen_fd, epoll_fd);
-                } else if (events_mask & EPOLLERR) {
-                    // 监听套接字错误
-                    printf("Error on listen socket fd %d\n", fd);
-                    perror("listen socket error");
-                    // 在实际应用中，可能需要重新创建监听套接字
-                } else if (events_mask & EPOLLHUP) {
-                    // 监听套接字挂起（极少见）
-                    printf("Listen socket fd %d hung up\n", fd);
-                }
-            } else {
-                // 客户端连接事件
-                if (events_mask & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
-                    // 连接错误、挂起或对端关闭写操作
-                    printf("Connection error/close detected on fd %d\n", fd);
-                    handle_client_disconnect(fd, epoll_fd);
-                } else if (events_mask & EPOLLIN) {
-                    // 有数据可读
-                    handle_client_message(fd, epoll_fd);
-                } else if (events_mask & EPOLLOUT) {
-                    // 可写事件（处理大量数据写入或从EAGAIN恢复）
-                    printf("Socket fd %d ready for writing (recovered from EAGAIN)\n", fd);
-                    // 在实际应用中，这里会：
-                    // 1. 从保存的缓冲区继续发送数据
-                    // 2. 发送完成后切换回EPOLLIN模式
-                    // 3. 释放发送缓冲区内存
-                } else if (events_mask & EPOLLPRI) {
-                    // 紧急数据
-                    printf("Priority data available on fd %d\n", fd);
-                }
+            if (prio_epoll_fd != -1 && i % PRIORITY_CHECK_EVENTS == 0) {
+                dispatch_priority();
             }
+            dispatch_event(events[i].data.fd, events[i].events);
+        }
+        
+        // 共享内存客户端活跃：处理完其他事件后连续轮询一小段时间
+        if (shm_session_count > 0) {
+            shm_spin();
+        }
+        
+        // 排空：发完回复的连接半关闭，全部关闭或到期限后退出
+        if (draining && drain_poll() == 0) {
+            break;
         }
     }
     
     cleanup_and_exit();
     return 0;
 }
+#endif
+
+// 分发一个就绪事件；priority集合的就绪事件走同一条路径
+void dispatch_event(int fd, uint32_t events_mask) {
+    if (fd == prio_epoll_fd) {
+        // 高优先级集合有事件：由dispatch_priority在本轮普通事件之前和中间处理
+        return;
+    }
+    
+    // 打印事件详情（调试用）
+    printf("Event on fd %d: ", fd);
+    if (events_mask & EPOLLIN) printf("EPOLLIN ");
+    if (events_mask & EPOLLOUT) printf("EPOLLOUT ");
+    if (events_mask & EPOLLRDHUP) printf("EPOLLRDHUP ");
+    if (events_mask & EPOLLPRI) printf("EPOLLPRI ");
+    if (events_mask & EPOLLERR) printf("EPOLLERR ");
+    if (events_mask & EPOLLHUP) printf("EPOLLHUP ");
+    // 注意：EPOLLET 是触发模式标志，不会出现在返回的事件中
+    printf("\n");
+    
+    if (fd == signal_fd) {
+        handle_signal_event();
+        return;
+    }
+    
+    if (fd == upgrade_fd) {
+        handle_upgrade_event();
+        return;
+    }
+    
+    if (fd == sample_timer_fd) {
+        tcp_sample_tick();
+        if (zc_lingering) {
+            zc_linger_expire(0);
+        }
+        if (capture) {
+            // 录制的数据每秒至少写出一次
+            capture_flush(capture);
+        }
+        return;
+    }
+    
+    if (journal && fd == journal_event_fd(journal)) {
+        // 一批日志落盘了，放行在等它的回复；同步失败时断开其余还在等的连接
+        journal_release(journal_synced(journal));
+        if (journal_failed(journal) && journal_waiters) {
+            fprintf(stderr, "journal: fdatasync failed, closing connections waiting for durable acks\n");
+            journal_abort();
+        }
+        return;
+    }
+    
+    if (workers && fd == worker_pool_event_fd(workers)) {
+        // 工作线程完成了任务，回到事件循环发送回复
+        worker_pool_complete(workers);
+        return;
+    }
+    
+    if (fd == shm_listen_fd) {
+        shm_accept();
+        return;
+    }
+    
+    if (shm_session_count > 0) {
+        int idx = shm_session_find(fd);
+        if (idx != -1) {
+            shm_session_event(idx, fd);
+            return;
+        }
+    }
+    
+    struct listener *l = listener_get(fd);
+    if (l) {
+        // 监听套接字事件
+        if (events_mask & EPOLLIN) {
+            // 新连接到达
+            int prev = prof_enter(PROF_ACCEPT);
+            handle_new_connection(l, epoll_fd);
+            prof_leave(prev);
+        } else if (events_mask & EPOLLERR) {
+            // 监听套接字错误
+            printf("Error on listen socket fd %d\n", fd);
+            perror("listen socket error");
+            // 在实际应用中，可能需要重新创建监听套接字
+        } else if (events_mask & EPOLLHUP) {
+            // 监听套接字挂起（极少见）
+            printf("Listen socket fd %d hung up\n", fd);
+        }
+    } else {
+        // 客户端连接事件
+        struct connection *conn = connection_get(fd);
+        if (!conn && zc_lingering && zc_linger_event(fd)) {
+            return;
+        }
+        if (conn && conn->peer_fd != -1) {
+            // 代理连接：两个方向的数据搬运
+            int prev = prof_enter(PROF_PROXY);
+            handle_proxy_event(conn, events_mask);
+            prof_leave(prev);
+            return;
+        }
+        
+        if ((events_mask & EPOLLERR) && conn && conn->zc_next_seq > 0 &&
+            handle_zerocopy_completions(conn) == 0) {
+            // 错误队列里是零拷贝完成通知，不是连接错误
+            events_mask &= ~EPOLLERR;
+        }
+        
+        if (events_mask & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+            // 连接错误、挂起或对端关闭写操作
+            printf("Connection error/close detected on fd %d\n", fd);
+            handle_client_disconnect(fd, epoll_fd);
+        } else {
+            if (events_mask & EPOLLIN) {
+                // 有数据可读
+                int prev = prof_enter(PROF_READ);
+                handle_client_message(fd, epoll_fd);
+                prof_leave(prev);
+            }
+            if ((events_mask & EPOLLOUT) && connection_get(fd)) {
+                // 可写事件（处理大量数据写入或从EAGAIN恢复）
+                int prev = prof_enter(PROF_WRITE);
+                handle_client_write(fd, epoll_fd);
+                prof_leave(prev);
+            }
+            if (events_mask & EPOLLPRI) {
+                // 紧急数据
+                printf("Priority data available on fd %d\n", fd);
+            }
+        }
+    }
+}
+
+// 不等待地取出高优先级集合里的就绪事件并处理
+void dispatch_priority(void) {
+    struct epoll_event events[MAX_PRIORITY_EVENTS];
+    int nfds;
+    do {
+        nfds = epoll_wait(prio_epoll_fd, events, MAX_PRIORITY_EVENTS, 0);
+        if (nfds <= 0) {
+            return;
+        }
+        stats.priority_passes++;
+        stats.priority_events += nfds;
+        for (int i = 0; i < nfds; i++) {
+            dispatch_event(events[i].data.fd, events[i].events);
+        }
+    } while (nfds == MAX_PRIORITY_EVENTS);
+}
+
+// 按名称查找socket配置档案
+const struct socket_profile* find_socket_profile(const char *name) {
+    for (size_t i = 0; i < sizeof(socket_profiles) / sizeof(socket_profiles[0]); i++) {
+        if (strcmp(socket_profiles[i].name, name) == 0) {
+            return &socket_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+// 创建高优先级epoll集合，把它注册进主集合（水平触发）：里面有事件时主循环的epoll_wait也会醒
+static int priority_set_create(void) {
+    prio_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (prio_epoll_fd == -1) {
+        perror("epoll_create1 priority");
+        return -1;
+    }
+    struct epoll_event event;
+    event.data.fd = prio_epoll_fd;
+    event.events = EPOLLIN;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, prio_epoll_fd, &event) == -1) {
+        perror("epoll_ctl ADD priority set");
+        close(prio_epoll_fd);
+        prio_epoll_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// 创建监听socket并注册到epoll
+int add_listener(int port, const struct socket_profile *profile) {
+    if (listener_count >= MAX_LISTENERS) {
+        fprintf(stderr, "Too many listeners (max %d)\n", MAX_LISTENERS);
+        return -1;
+    }
+    
+    // 热升级继承来的socket已经绑定并在监听，backlog里的连接不会丢失；
+    // 监听socket上的档案选项沿用老进程设置的
+    int fd = upgrade_take_listener(port);
+    if (fd == -1) {
+        fd = create_and_bind(port, profile);
+    }
+    if (fd == -1) {
+        return -1;
+    }
+    
+    // 设置为非阻塞
+    if (make_socket_non_blocking(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    
+    // 开始监听
+    if (listen(fd, LISTEN_BACKLOG) == -1) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    
+    // 将监听socket注册到epoll；高优先级端口注册到单独的集合，accept也不排在普通事件后面
+    if (profile->priority && prio_epoll_fd == -1 && priority_set_create() == -1) {
+        close(fd);
+        return -1;
+    }
+    struct epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLET; // 边沿触发
+    if (epoll_ctl(profile->priority ? prio_epoll_fd : epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl: listen_fd");
+        close(fd);
+        return -1;
+    }
+    
+    struct listener *l = &listeners[listener_count++];
+    l->fd = fd;
+    l->port = port;
+    l->profile = profile;
+    return 0;
+}
+
+// 判断fd是否为监听socket（监听端口很少，线性查找即可）
+struct listener* listener_get(int fd) {
+    for (int i = 0; i < listener_count; i++) {
+        if (listeners[i].fd == fd) {
+            return &listeners[i];
+        }
+    }
+    return NULL;
+}
 
 // 创建并绑定socket
-int create_and_bind(int port) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+int create_and_bind(int port, const struct socket_profile *profile) {
+    // CLOEXEC：热升级exec新进程时监听socket经SCM_RIGHTS传递，不靠继承
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (fd == -1) {
         perror("socket");
         return -1;
@@ -178,6 +1200,14 @@ int create_and_bind(int port) {
         return -1;
     }
     
+    // 接收窗口扩大因子在握手时确定，接收缓冲区必须在listen之前设置才有效
+    if (profile->rcvbuf > 0) {
+        int rcvbuf = profile->rcvbuf;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1) {
+            perror("setsockopt SO_RCVBUF");
+        }
+    }
+    
     // 绑定地址
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
@@ -191,6 +1221,22 @@ int create_and_bind(int port) {
         return -1;
     }
     
+    // 短连接优化：只在客户端数据到达后才让accept就绪，省掉一次空唤醒
+    if (profile->defer_accept_secs > 0) {
+        int secs = profile->defer_accept_secs;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs)) == -1) {
+            perror("setsockopt TCP_DEFER_ACCEPT");
+        }
+    }
+    
+    // TCP Fast Open：SYN携带数据，省掉一个往返（需要 net.ipv4.tcp_fastopen 开启服务端位）
+    if (profile->fastopen_qlen > 0) {
+        int qlen = profile->fastopen_qlen;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) == -1) {
+            perror("setsockopt TCP_FASTOPEN");
+        }
+    }
+    
     return fd;
 }
 
@@ -211,20 +1257,82 @@ int make_socket_non_blocking(int fd) {
     return 0;
 }
 
+// accept后按配置档案设置客户端socket选项
+// 选项设置失败不影响连接本身，只打印错误
+void apply_socket_profile(int fd, const struct socket_profile *profile) {
+    int value;
+    
+    if (profile->sndbuf > 0) {
+        value = profile->sndbuf;
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value)) == -1) {
+            perror("setsockopt SO_SNDBUF");
+        }
+    }
+    if (profile->rcvbuf > 0) {
+        value = profile->rcvbuf;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value)) == -1) {
+            perror("setsockopt SO_RCVBUF");
+        }
+    }
+    if (profile->nodelay) {
+        value = 1;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) == -1) {
+            perror("setsockopt TCP_NODELAY");
+        }
+    }
+    if (profile->notsent_lowat > 0) {
+        // 未发送数据低于水位才报告EPOLLOUT，避免发送缓冲区里堆积大量未发出的数据
+        value = profile->notsent_lowat;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &value, sizeof(value)) == -1) {
+            perror("setsockopt TCP_NOTSENT_LOWAT");
+        }
+    }
+    if (profile->keepalive_idle > 0) {
+        value = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value)) == -1) {
+            perror("setsockopt SO_KEEPALIVE");
+        }
+        value = profile->keepalive_idle;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &value, sizeof(value)) == -1) {
+            perror("setsockopt TCP_KEEPIDLE");
+        }
+        if (profile->keepalive_intvl > 0) {
+            value = profile->keepalive_intvl;
+            if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &value, sizeof(value)) == -1) {
+                perror("setsockopt TCP_KEEPINTVL");
+            }
+        }
+        if (profile->keepalive_cnt > 0) {
+            value = profile->keepalive_cnt;
+            if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &value, sizeof(value)) == -1) {
+                perror("setsockopt TCP_KEEPCNT");
+            }
+        }
+    }
+}
+
 // 处理新连接
-void handle_new_connection(int listen_fd, int epoll_fd) {
+void handle_new_connection(struct listener *l, int epoll_fd) {
     struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
     
     // 循环接受所有等待的连接（边沿触发模式）
     while (1) {
-        int client_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &client_len);
+        // accept4直接返回非阻塞socket，省掉两次fcntl
+        prof_syscall(SYS_ACCEPT);
+        int client_fd = accept4(l->fd, (struct sockaddr*)&client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
         
         if (client_fd == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 // 没有更多连接了
                 break;
             }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                // 被信号打断，或者排队的连接在accept前已被对端重置：
+                // 边沿触发下break会把剩下排队的连接留到下一个新连接到来才处理
+                continue;
+            }
             perror("accept");
             break;
         }
@@ -235,76 +1343,182 @@ void handle_new_connection(int listen_fd, int epoll_fd) {
         printf("New connection from %s:%d (fd=%d)\n", 
                client_ip, ntohs(client_addr.sin_port), client_fd);
         
-        // 设置客户端socket为非阻塞
-        if (make_socket_non_blocking(client_fd) == -1) {
+        stats.connections_accepted++;
+        apply_socket_profile(client_fd, l->profile);
+        
+        struct connection *conn = connection_create(client_fd, l->profile);
+        if (!conn) {
             close(client_fd);
             continue;
         }
+        conn->peer_addr = client_addr.sin_addr.s_addr;
+        conn->peer_port = client_addr.sin_port;
         
-        // 将新的客户端fd注册到epoll
-        struct epoll_event event;
-        event.data.fd = client_fd;
-        event.events = EPOLLIN | EPOLLRDHUP | EPOLLET; // 边沿触发，监听可读事件和对端关闭
-        
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
-            perror("epoll_ctl: client_fd");
-            close(client_fd);
+        if (backend_addr_len > 0) {
+            // 代理模式：不发欢迎消息，字节原样转发给后端
+            if (proxy_attach(conn) == -1) {
+                connection_destroy(client_fd);
+                close(client_fd);
+            }
             continue;
         }
         
-        // 发送欢迎消息
-        const char* welcome_msg = "Welcome to Carlos's Echo Server!\n";
-        write(client_fd, welcome_msg, strlen(welcome_msg));
+        if (capture) {
+            conn->capture_id = capture_conn_open(capture, l->port);
+        }
+        
+        if (zerocopy_threshold > 0) {
+            int one = 1;
+            if (setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+                conn->zerocopy = 1;
+            } else {
+                perror("setsockopt SO_ZEROCOPY");
+            }
+        }
+        
+        if (conn->profile->http) {
+            conn->protocol = PROTO_HTTP;
+        } else if (conn->profile->coalesce_welcome) {
+            // 欢迎消息延后，与第一条回复合并成一次写入
+            conn->welcome_pending = 1;
+        } else {
+            // 发送欢迎消息（短写时剩余部分进发送队列）
+            struct iovec welcome = { .iov_base = (void*)WELCOME_MSG, .iov_len = strlen(WELCOME_MSG) };
+            if (connection_sendv(conn, &welcome, 1) == -1) {
+                handle_client_disconnect(client_fd, epoll_fd);
+                continue;
+            }
+        }
+        
+        // TCP_DEFER_ACCEPT下accept返回时请求通常已在接收缓冲区，直接读取，不必再等一轮epoll_wait；
+        // 读完再注册：先注册的话边沿触发会为已读走的数据再报一次可读，多一次读到EAGAIN的空读
+        if (conn->profile->defer_accept_secs > 0) {
+            handle_client_message(client_fd, epoll_fd);
+            if (!connection_get(client_fd)) {
+                continue;
+            }
+        }
+        
+        // 将新的客户端fd注册到epoll：边沿触发，监听可读事件和对端关闭（-E时连同可写事件）
+        // 欢迎消息或第一批回复短写时connection_set_epollout已经注册过，事件相同时不再发起系统调用
+        uint32_t events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        if (conn->epollout || epollout_always) {
+            events |= EPOLLOUT;
+        }
+        if (interest_set(client_fd, events) == -1) {
+            handle_client_disconnect(client_fd, epoll_fd);
+        }
+    }
+}
+
+// 接收缓冲区至少留出BUFFER_SIZE空间，返回可写入的位置；内存不足返回NULL
+char* connection_input_space(struct connection *conn, size_t *space) {
+    if (conn->in_cap - conn->in_len < BUFFER_SIZE) {
+        size_t new_cap = conn->in_cap ? conn->in_cap * 2 : BUFFER_SIZE;
+        char *buf = realloc(conn->in_buf, new_cap);
+        if (!buf) {
+            perror("realloc in_buf");
+            return NULL;
+        }
+        conn->in_buf = buf;
+        conn->in_cap = new_cap;
+    }
+    *space = conn->in_cap - conn->in_len;
+    return conn->in_buf + conn->in_len;
+}
+
+// 新写入接收缓冲区的n字节（录制后）交给process_input处理
+// 返回值同process_input
+int connection_input_commit(struct connection *conn, size_t n) {
+    if (conn->capture_id && capture) {
+        capture_conn_data(capture, conn->capture_id, conn->in_buf + conn->in_len, n);
     }
+    conn->in_len += n;
+    int prev = prof_enter(PROF_PROCESS);
+    int result = process_input(conn);
+    prof_leave(prev);
+    return result;
+}
+
+// 不经过socket，把内存里的数据当作从连接上读到的输入处理（handler_bench用）
+// 返回值: 0=正常, -1=需要关闭连接
+int connection_feed(struct connection *conn, const char *data, size_t len) {
+    while (len > 0) {
+        size_t space;
+        char *dst = connection_input_space(conn, &space);
+        if (!dst) {
+            return -1;
+        }
+        size_t n = len < space ? len : space;
+        memcpy(dst, data, n);
+        if (connection_input_commit(conn, n) == -1) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
 }
 
 // 处理客户端消息
 void handle_client_message(int client_fd, int epoll_fd) {
-    char buffer[BUFFER_SIZE];
     ssize_t bytes_read;
+    struct connection *conn = connection_get(client_fd);
+    
+    if (!conn) {
+        return;
+    }
+    
+    if (conn->co) {
+        // 协程在等可读时恢复它，由它自己读socket；否则数据先留在内核里，协程结束后再读
+        if (conn->co_wait == CO_WAIT_READ) {
+            connection_co_resume(conn);
+        }
+        return;
+    }
+    
+    if (conn->protocol == PROTO_TEXT && conn->jobs) {
+        // 文本命令在工作线程执行期间不处理后续命令，也就不再读：数据留在内核里，由offload_resume再读
+        return;
+    }
+    
+    if (draining) {
+        // 正在退出，不再处理新请求
+        if (connection_discard_input(conn) == -1) {
+            handle_client_disconnect(client_fd, epoll_fd);
+        }
+        return;
+    }
+    
+    // 本次读事件产生的所有回复先攒在CORK里，结束时一次性推出
+    if (conn->profile->cork) {
+        connection_set_cork(conn, 1);
+    }
     
     // 循环读取所有可用数据（边沿触发模式）
     while (1) {
-        bytes_read = read(client_fd, buffer, BUFFER_SIZE - 1);
+        size_t space;
+        char *dst = connection_input_space(conn, &space);
+        if (!dst) {
+            handle_client_disconnect(client_fd, epoll_fd);
+            return;
+        }
+        
+        prof_syscall(SYS_READ);
+        bytes_read = read(client_fd, dst, space);
         
         if (bytes_read > 0) {
-            // 收到数据
-            buffer[bytes_read] = '\0';
-            
-            // 移除末尾的换行符
-            if (buffer[bytes_read - 1] == '\n') {
-                buffer[bytes_read - 1] = '\0';
-                bytes_read--;
+            // 收到数据，切分出完整的请求逐个处理（一次读可能包含多条流水线请求）
+            if (connection_input_commit(conn, bytes_read) == -1) {
+                handle_client_disconnect(client_fd, epoll_fd);
+                return;
             }
-            
-            printf("Received from fd %d: %s\n", client_fd, buffer);
-            
-            // 处理消息并生成回复
-            char response[BUFFER_SIZE];
-            process_message(buffer, response, BUFFER_SIZE);
-            
-            // 发送回复到内核发送缓冲区
-            ssize_t response_len = strlen(response);
-            ssize_t bytes_sent = write(client_fd, response, response_len);
-            
-            if (bytes_sent == -1) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    perror("write");
-                    handle_client_disconnect(client_fd, epoll_fd);
-                    return;
+            if (conn->co || (conn->protocol == PROTO_TEXT && conn->jobs)) {
+                // 命令启动的协程挂起了，之后的数据由协程读取；文本命令交给了工作线程，等它完成再读
+                if (conn->corked) {
+                    connection_set_cork(conn, 0);
                 }
-                // EAGAIN: 本地发送缓冲区满，需要等待
-                // 在高性能服务器中，这里需要：
-                // 1. 保存未发送的数据
-                // 2. 注册 EPOLLOUT 事件
-                // 3. 等待套接字可写
-            } else if (bytes_sent != response_len) {
-                // 部分数据进入发送缓冲区，剩余数据需要后续处理
-                // 在高性能服务器中，这里需要：
-                // 1. 保存剩余的 (response_len - bytes_sent) 字节
-                // 2. 注册 EPOLLOUT 事件继续发送
-                printf("Warning: partial write (%zd/%zd bytes)\n", bytes_sent, response_len);
-                // 注意：即使部分写入成功，也不代表客户端已收到任何数据
+                break;
             }
             
         } else if (bytes_read == 0) {
@@ -317,7 +1531,12 @@ void handle_client_message(int client_fd, int epoll_fd) {
             // bytes_read == -1
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 // 没有更多数据了
+                if (conn->corked) {
+                    connection_set_cork(conn, 0);
+                }
                 break;
+            } else if (errno == EINTR) {
+                continue;
             } else {
                 // 读取错误
                 perror("read");
@@ -328,71 +1547,3620 @@ void handle_client_message(int client_fd, int epoll_fd) {
     }
 }
 
-// 处理客户端断开连接
-void handle_client_disconnect(int client_fd, int epoll_fd) {
-    printf("Closing connection fd %d\n", client_fd);
+// 从接收缓冲区切分并处理所有完整的请求，不完整的部分留到下次读取
+// 返回值: 0=正常, -1=协议错误或发送失败，需要关闭连接
+int process_input(struct connection *conn) {
+    int result = 0;
+    int again;
     
-    // 从epoll中移除
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL) == -1) {
-        perror("epoll_ctl DEL");
+    if (conn->protocol == PROTO_HTTP) {
+        return process_http_input(conn);
+    }
+    if (conn->protocol == PROTO_UNKNOWN) {
+        conn->protocol = (unsigned char)conn->in_buf[0] == BIN_MAGIC ? PROTO_BINARY : PROTO_TEXT;
+        if (conn->protocol == PROTO_BINARY) {
+            // 二进制客户端不需要欢迎消息
+            conn->welcome_pending = 0;
+        }
     }
     
-    // 关闭socket
-    close(client_fd);
+    do {
+        size_t pos = 0;
+        // 文本协议：一次扫描找出一批换行位置，逐条处理，用完再从上次扫描结束处继续
+        uint32_t lines[SCAN_BATCH];
+        size_t line_count = 0, line_next = 0;
+        size_t line_base = 0;       // lines中的位置相对于此偏移
+        size_t scan_end = 0;        // [0, scan_end)已经扫描过
+        // 文本协议没有request_id，回复必须按请求顺序：有命令在工作线程执行时暂停处理后续命令
+        while (pos < conn->in_len && result == 0 && !conn->co &&
+               !(conn->protocol == PROTO_TEXT && conn->jobs)) {
+            char *start = conn->in_buf + pos;
+            size_t avail = conn->in_len - pos;
+            
+            if (conn->protocol == PROTO_BINARY) {
+                if (avail < BIN_HEADER_SIZE) {
+                    break;
+                }
+                struct bin_header req;
+                uint16_t status;
+                uint32_t request_id, length;
+                memcpy(&status, start + 2, 2);
+                memcpy(&request_id, start + 4, 4);
+                memcpy(&length, start + 8, 4);
+                req.magic = start[0];
+                req.opcode = start[1];
+                req.status = ntohs(status);
+                req.request_id = ntohl(request_id);
+                req.length = ntohl(length);
+                
+                if (req.magic != BIN_MAGIC || req.length > MAX_BIN_PAYLOAD) {
+                    fprintf(stderr, "Bad binary frame on fd %d\n", conn->fd);
+                    return -1;
+                }
+                if (avail < BIN_HEADER_SIZE + req.length) {
+                    break;
+                }
+                result = handle_binary_request(conn, &req, start + BIN_HEADER_SIZE);
+                pos += BIN_HEADER_SIZE + req.length;
+            } else {
+                if (line_next == line_count && scan_end < conn->in_len) {
+                    line_base = scan_end > pos ? scan_end : pos;
+                    line_count = scan_byte(conn->in_buf + line_base, conn->in_len - line_base, '\n',
+                                           lines, SCAN_BATCH, &scan_end);
+                    scan_end += line_base;
+                    line_next = 0;
+                }
+                char *newline = line_next < line_count ? conn->in_buf + line_base + lines[line_next++] : NULL;
+                if (newline) {
+                    *newline = '\0';
+                    // 兼容telnet的\r\n
+                    if (newline > start && newline[-1] == '\r') {
+                        newline[-1] = '\0';
+                    }
+                    result = handle_text_command(conn, start);
+                    pos += newline - start + 1;
+                } else if (avail >= BUFFER_SIZE - 1) {
+                    // 超长且没有换行：和以前一样按一条消息处理
+                    char line[BUFFER_SIZE];
+                    memcpy(line, start, BUFFER_SIZE - 1);
+                    line[BUFFER_SIZE - 1] = '\0';
+                    result = handle_text_command(conn, line);
+                    pos += BUFFER_SIZE - 1;
+                } else {
+                    break;
+                }
+            }
+        }
+        
+        // 未处理完的数据移到缓冲区开头
+        if (pos > 0) {
+            memmove(conn->in_buf, conn->in_buf + pos, conn->in_len - pos);
+            conn->in_len -= pos;
+        }
+        
+        // 命令启动了协程：命令行已从缓冲区移除，协程用co_read读到的是紧跟其后的数据
+        // 协程没有挂起就结束时继续处理剩下的命令
+        again = 0;
+        if (result == 0 && conn->co && conn->co_wait == CO_READY) {
+            result = connection_co_step(conn);
+            again = result == 0 && !conn->co && conn->in_len > 0;
+        }
+    } while (again);
+    return result;
 }
 
-// 处理消息并生成回复
-void process_message(const char* request, char* response, int response_size) {
-    if (strlen(request) == 0) {
-        snprintf(response, response_size, "Empty message received\n");
-        return;
+// HTTP回复的状态行和固定响应头预先拼好，每个回复只需要再拼Date、Content-Length和正文
+#define HTTP_HEAD(status) \
+    { "HTTP/1.1 " status "\r\nServer: epoll_server\r\nContent-Type: text/plain\r\n", \
+      sizeof("HTTP/1.1 " status "\r\nServer: epoll_server\r\nContent-Type: text/plain\r\n") - 1 }
+
+static const struct {
+    const char *text;
+    size_t len;
+} http_heads[] = {
+    HTTP_HEAD("200 OK"),
+    HTTP_HEAD("400 Bad Request"),
+    HTTP_HEAD("404 Not Found"),
+    HTTP_HEAD("405 Method Not Allowed"),
+    HTTP_HEAD("413 Content Too Large"),
+    HTTP_HEAD("431 Request Header Fields Too Large"),
+    HTTP_HEAD("501 Not Implemented"),
+};
+
+enum http_status {
+    HTTP_200, HTTP_400, HTTP_404, HTTP_405, HTTP_413, HTTP_431, HTTP_501,
+};
+
+#define HTTP_OUT_BATCH (16 * 1024)                  // 一次读事件的回复攒在这里一起发出
+#define HTTP_MAX_RESPONSE (BUFFER_SIZE + 256)       // 单个回复的上限：正文加响应头
+
+// 拼一个完整的回复到out（空间至少HTTP_MAX_RESPONSE），返回长度
+static size_t http_format_response(char *out, enum http_status status, const char *body, size_t body_len,
+                                   int keep_alive, int head_only) {
+    size_t len = 0, date_len;
+    const char *date = http_date_header(&date_len);
+    
+    memcpy(out, http_heads[status].text, http_heads[status].len);
+    len += http_heads[status].len;
+    memcpy(out + len, date, date_len);
+    len += date_len;
+    len += sprintf(out + len, "Content-Length: %zu\r\n%s\r\n", body_len,
+                   keep_alive ? "" : "Connection: close\r\n");
+    if (!head_only) {
+        memcpy(out + len, body, body_len);
+        len += body_len;
     }
+    return len;
+}
+
+// 把HTTP请求映射到文本命令：/ping、/time、/echo?msg=
+static size_t http_handle_request(const struct http_request *req, char *out) {
+    char command[BUFFER_SIZE];
+    char response[BUFFER_SIZE];
+    int head_only = req->method_len == 4 && memcmp(req->method, "HEAD", 4) == 0;
     
-    // 简单的命令处理
-    if (strcmp(request, "ping") == 0) {
-        snprintf(response, response_size, "pong\n");
-    } else if (strcmp(request, "time") == 0) {
-        time_t now = time(NULL);
-        struct tm *tm_info = localtime(&now);
-        snprintf(response, response_size, "Current time: %04d-%02d-%02d %02d:%02d:%02d\n",
-                tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
-                tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
-    } else if (strcmp(request, "quit") == 0 || strcmp(request, "exit") == 0) {
-        snprintf(response, response_size, "Goodbye!\n");
-    } else if (strncmp(request, "echo ", 5) == 0) {
-        snprintf(response, response_size, "%s\n", request + 5);
-    } else if (strcmp(request, "help") == 0) {
-        snprintf(response, response_size, 
-                "Available commands:\n"
-                "  ping     - responds with pong\n"
-                "  time     - shows current time\n"
-                "  echo <msg> - echoes your message\n"
-                "  help     - shows this help\n"
-                "  quit/exit - disconnect\n");
+    stats.http_requests++;
+    prof_request();
+    if (!head_only && !(req->method_len == 3 && memcmp(req->method, "GET", 3) == 0)) {
+        return http_format_response(out, HTTP_405, "Only GET and HEAD are supported\n", 32,
+                                    req->keep_alive, 0);
+    }
+    if (req->path_len == 5 && memcmp(req->path, "/ping", 5) == 0) {
+        process_message("ping", response, sizeof(response));
+    } else if (req->path_len == 5 && memcmp(req->path, "/time", 5) == 0) {
+        process_message("time", response, sizeof(response));
+    } else if (req->path_len == 5 && memcmp(req->path, "/echo", 5) == 0) {
+        memcpy(command, "echo ", 5);
+        int len = http_query_param(req, "msg", command + 5, sizeof(command) - 6);
+        if (len == -1) {
+            return http_format_response(out, HTTP_400, "Missing msg parameter\n", 22, req->keep_alive,
+                                        head_only);
+        }
+        command[5 + len] = '\0';
+        process_message(command, response, sizeof(response));
     } else {
-        // 默认回声
-        snprintf(response, response_size, "Echo: %s\n", request);
+        return http_format_response(out, HTTP_404, "Not found\n", 10, req->keep_alive, head_only);
+    }
+    return http_format_response(out, HTTP_200, response, strlen(response), req->keep_alive, head_only);
+}
+
+// HTTP连接：切分出所有完整的请求逐个处理（流水线），回复攒在一起一次发出
+// 请求不逐条打印日志：压测时每秒几十万行输出本身就是瓶颈
+// 返回值: 0=正常, -1=发送失败，需要关闭连接
+int process_http_input(struct connection *conn) {
+    char out[HTTP_OUT_BATCH];
+    size_t out_len = 0;
+    size_t pos = 0;
+    
+    if (conn->http_close != HTTP_OPEN) {
+        // 已决定关闭：之后收到的数据直接丢弃
+        conn->in_len = 0;
+        return 0;
+    }
+    while (pos < conn->in_len && conn->http_close == HTTP_OPEN) {
+        struct http_request req;
+        int n = http_parse_request(conn->in_buf + pos, conn->in_len - pos, &conn->http_scanned, &req);
+        if (n == HTTP_INCOMPLETE) {
+            break;
+        }
+        if (out_len > HTTP_OUT_BATCH - HTTP_MAX_RESPONSE) {
+            struct iovec iov = { out, out_len };
+            if (connection_sendv(conn, &iov, 1) == -1) {
+                return -1;
+            }
+            out_len = 0;
+        }
+        conn->http_scanned = 0;
+        if (n < 0) {
+            // 请求无法解析，不知道下一个请求从哪里开始：回复错误后关闭连接
+            // 按enum http_parse_result的顺序（HTTP_BAD=-1起）
+            static const char *bodies[] = { "Bad request\n", "Request header too large\n",
+                                            "Request body too large\n", "Not implemented\n" };
+            static const enum http_status codes[] = { HTTP_400, HTTP_431, HTTP_413, HTTP_501 };
+            int idx = -n - 1;
+            out_len += http_format_response(out + out_len, codes[idx], bodies[idx], strlen(bodies[idx]), 0, 0);
+            stats.http_errors++;
+            conn->http_close = HTTP_CLOSE_AFTER_REPLY;
+            pos = conn->in_len;
+            break;
+        }
+        out_len += http_handle_request(&req, out + out_len);
+        if (!req.keep_alive) {
+            conn->http_close = HTTP_CLOSE_AFTER_REPLY;
+        }
+        pos += n;
+    }
+    
+    if (pos > 0) {
+        memmove(conn->in_buf, conn->in_buf + pos, conn->in_len - pos);
+        conn->in_len -= pos;
+    }
+    if (out_len > 0) {
+        struct iovec iov = { out, out_len };
+        if (connection_sendv(conn, &iov, 1) == -1) {
+            return -1;
+        }
     }
+    http_shutdown_if_done(conn);
+    return 0;
 }
 
-// 信号处理函数
-void signal_handler(int sig) {
-    printf("\nReceived signal %d, shutting down gracefully...\n", sig);
-    running = 0;
+// 需要关闭的HTTP连接在回复全部交给内核后半关闭，客户端读完回复后关闭连接
+void http_shutdown_if_done(struct connection *conn) {
+    if (conn->http_close != HTTP_CLOSE_AFTER_REPLY || conn->out_head) {
+        return;
+    }
+    if (shutdown(conn->fd, SHUT_WR) == -1) {
+        perror("shutdown");
+    }
+    conn->http_close = HTTP_SHUT;
 }
 
-// 清理资源并退出
-void cleanup_and_exit() {
-    printf("Cleaning up resources...\n");
+// 把一条变更或管理命令写进审计日志（没有开启时什么都不做），由各命令在参数校验通过、执行之前调用，
+// 格式不对、键超长这类会被拒绝的请求不进日志，也不会让持久化连接为它等一次fsync
+// 要求持久化确认的连接记下序号：从这条命令的回复起，发送队列只进不出，直到这条记录落盘
+// 返回值: 0=已记录或不需要记录, -1=日志缓冲区满或已失败且连接要求持久化确认，命令不应执行
+int journal_command(struct connection *conn, uint8_t op, const void *data, size_t len) {
+    if (!journal) {
+        return 0;
+    }
+    uint64_t seq = journal_append(journal, op, conn->peer_addr, conn->peer_port, data, len);
+    if (seq == 0) {
+        return conn->durable ? -1 : 0;
+    }
+    if (conn->durable) {
+        if (!conn->journal_wait) {
+            conn->journal_next = journal_waiters;
+            journal_waiters = conn;
+            stats.journal_waits++;
+        }
+        conn->journal_wait = seq;
+    }
+    return 0;
+}
+
+// 从等待链表摘下在等序号不大于synced的连接，fd存进ready；返回个数
+static int *journal_ready = NULL;
+static int journal_ready_cap = 0;
+
+static int journal_take_waiters(uint64_t synced) {
+    int count = 0;
+    struct connection **p = &journal_waiters;
+    while (*p) {
+        struct connection *conn = *p;
+        if (conn->journal_wait > synced) {
+            p = &conn->journal_next;
+            continue;
+        }
+        if (count == journal_ready_cap) {
+            int new_cap = journal_ready_cap ? journal_ready_cap * 2 : 64;
+            int *grown = realloc(journal_ready, new_cap * sizeof(*journal_ready));
+            if (!grown) {
+                // 留到下一次落盘通知
+                perror("realloc journal ready");
+                break;
+            }
+            journal_ready = grown;
+            journal_ready_cap = new_cap;
+        }
+        *p = conn->journal_next;
+        conn->journal_wait = 0;
+        journal_ready[count++] = conn->fd;
+    }
+    return count;
+}
+
+// 序号不大于synced的记录已落盘：放行在等它们的连接，像收到EPOLLOUT一样发出排队的回复
+// 发送可能触发关闭其他连接（订阅者积压），所以先摘下所有就绪的fd再逐个按fd查找
+void journal_release(uint64_t synced) {
+    int count = journal_take_waiters(synced);
+    for (int i = 0; i < count; i++) {
+        struct connection *conn = connection_get(journal_ready[i]);
+        if (conn && !conn->journal_wait) {
+            handle_client_write(journal_ready[i], epoll_fd);
+        }
+    }
+}
+
+// 日志fdatasync失败：还在等的记录永远不会确认落盘，断开这些连接，而不是发出没有保证的回复
+void journal_abort(void) {
+    int count = journal_take_waiters(UINT64_MAX);
+    for (int i = 0; i < count; i++) {
+        handle_client_disconnect(journal_ready[i], epoll_fd);
+    }
+}
+
+// durable on|off（二进制为BIN_OP_DURABLE）
+int handle_durable(struct connection *conn, const struct bin_header *req, int enable) {
+    if (!journal) {
+        return send_error_reply(conn, req, req ? "Journal not enabled" : "ERROR journal not enabled (-j)");
+    }
+    conn->durable = enable;
+    if (req) {
+        return send_binary_reply(conn, req, BIN_STATUS_OK, 0, NULL, 0);
+    }
+    return send_error_reply(conn, NULL, "OK");
+}
+
+typedef int (*text_handler)(struct connection *conn, char *line);
+
+static int text_durable(struct connection *conn, char *line) {
+    return handle_durable(conn, NULL, line[9] == 'n');
+}
+
+static int text_conns(struct connection *conn, char *line) {
+    (void)line;
+    return send_conns_listing(conn, NULL);
+}
+
+static int text_large(struct connection *conn, char *line) {
+    (void)line;
+    return send_large_data(conn, NULL);
+}
+
+static int text_file(struct connection *conn, char *line) {
+    return send_file(conn, line + 5, NULL);
+}
+
+// 由专门的处理函数回复的命令；返回NULL的命令由process_message生成一行文本回复
+static text_handler text_command_handler(const char *line) {
+    if (strcmp(line, "profile") == 0 || strncmp(line, "profile ", 8) == 0) {
+        return handle_profile_text;
+    }
+    if (strcmp(line, "durable on") == 0 || strcmp(line, "durable off") == 0) {
+        return text_durable;
+    }
+    if (strcmp(line, "conns") == 0) {
+        return text_conns;
+    }
+    if (strcmp(line, "large") == 0) {
+        return text_large;
+    }
+    if (strncmp(line, "file ", 5) == 0) {
+        return text_file;
+    }
+    if (strncmp(line, "upload ", 7) == 0 || strncmp(line, "stream ", 7) == 0) {
+        return handle_co_text;
+    }
+    if (strncmp(line, "set ", 4) == 0 || strncmp(line, "get ", 4) == 0 ||
+        strncmp(line, "del ", 4) == 0 || strncmp(line, "mget ", 5) == 0) {
+        return handle_kv_text;
+    }
+    if (strncmp(line, "subscribe ", 10) == 0 || strncmp(line, "unsubscribe ", 12) == 0 ||
+        strncmp(line, "publish ", 8) == 0) {
+        return handle_pubsub_text;
+    }
+    return NULL;
+}
+
+// 处理一条文本命令
+// 返回值: 0=正常, -1=发送失败
+int handle_text_command(struct connection *conn, char *line) {
+    printf("Received from fd %d: %s\n", conn->fd, line);
+    prof_request();
     
-    if (epoll_fd != -1) {
-        close(epoll_fd);
+    // 处理消息并生成回复
+    char response[BUFFER_SIZE];
+    struct iovec iov[2];
+    int iovcnt = 0;
+    
+    if (conn->welcome_pending) {
+        // 欢迎消息和第一条回复一次writev发出
+        iov[iovcnt].iov_base = (void*)WELCOME_MSG;
+        iov[iovcnt].iov_len = strlen(WELCOME_MSG);
+        iovcnt++;
+        conn->welcome_pending = 0;
+    }
+    
+    text_handler handler = text_command_handler(line);
+    if (handler) {
+        // 这些命令自己发送回复（大块数据直接进发送队列），先把欢迎消息单独送出
+        if (iovcnt > 0 && connection_sendv(conn, iov, iovcnt) == -1) {
+            return -1;
+        }
+        return handler(conn, line);
     }
     
-    if (listen_fd != -1) {
-        close(listen_fd);
+    process_message(line, response, BUFFER_SIZE);
+    iov[iovcnt].iov_base = response;
+    iov[iovcnt].iov_len = strlen(response);
+    iovcnt++;
+    
+    // 发送回复到内核发送缓冲区，写不完的部分进入发送队列，等待EPOLLOUT继续发送
+    // 注意：即使写入成功，也不代表客户端已收到任何数据
+    return connection_sendv(conn, iov, iovcnt) == -1 ? -1 : 0;
+}
+
+// 处理一个二进制请求，命令与文本协议一一对应
+// 返回值: 0=正常, -1=发送失败
+int handle_binary_request(struct connection *conn, const struct bin_header *req, const char *payload) {
+    char response[BUFFER_SIZE];
+    
+    prof_request();
+    
+    switch (req->opcode) {
+    case BIN_OP_PING:
+    case BIN_OP_QUIT:
+        return send_binary_reply(conn, req, BIN_STATUS_OK, 0, NULL, 0);
+    case BIN_OP_TIME: {
+        uint64_t now = (uint64_t)time(NULL);
+        unsigned char be[8];
+        for (int i = 7; i >= 0; i--) {
+            be[i] = now & 0xff;
+            now >>= 8;
+        }
+        return send_binary_reply(conn, req, BIN_STATUS_OK, sizeof(be), be, sizeof(be));
+    }
+    case BIN_OP_ECHO:
+        return send_binary_reply(conn, req, BIN_STATUS_OK, req->length, payload, req->length);
+    case BIN_OP_HELP:
+    case BIN_OP_STATS:
+        process_message(req->opcode == BIN_OP_HELP ? "help" : "stats", response, BUFFER_SIZE);
+        return send_binary_reply(conn, req, BIN_STATUS_OK, strlen(response),
+                                 response, strlen(response));
+    case BIN_OP_LARGE:
+        return send_large_data(conn, req);
+    case BIN_OP_CONNS:
+        return send_conns_listing(conn, req);
+    case BIN_OP_SET:
+    case BIN_OP_DEL:
+    case BIN_OP_GET:
+    case BIN_OP_MGET:
+        return handle_kv_binary(conn, req, payload);
+    case BIN_OP_PUBLISH:
+    case BIN_OP_SUBSCRIBE:
+    case BIN_OP_UNSUBSCRIBE:
+        return handle_pubsub_binary(conn, req, payload);
+    case BIN_OP_DURABLE:
+        if (req->length != 1) {
+            return send_error_reply(conn, req, "Payload must be 1 byte");
+        }
+        return handle_durable(conn, req, payload[0] != 0);
+    case BIN_OP_FILE: {
+        char name[MAX_FILE_NAME + 1];
+        if (req->length == 0 || req->length > MAX_FILE_NAME || memchr(payload, '\0', req->length)) {
+            return send_error_reply(conn, req, "Invalid file name");
+        }
+        memcpy(name, payload, req->length);
+        name[req->length] = '\0';
+        return send_file(conn, name, req);
+    }
+    default:
+        return send_binary_reply(conn, req, BIN_STATUS_UNKNOWN_OP, 0, NULL, 0);
+    }
+}
+
+// 按请求生成回复帧头（网络字节序）
+static void bin_header_encode(unsigned char *header, const struct bin_header *req, uint16_t status,
+                              uint32_t length) {
+    uint16_t net_status = htons(status);
+    uint32_t net_id = htonl(req->request_id);
+    uint32_t net_length = htonl(length);
+    
+    header[0] = BIN_MAGIC;
+    header[1] = req->opcode;
+    memcpy(header + 2, &net_status, 2);
+    memcpy(header + 4, &net_id, 4);
+    memcpy(header + 8, &net_length, 4);
+}
+
+// 发送二进制回复：帧头 + payload一次writev发出
+// length是帧头里声明的payload长度，可以大于payload_len（剩余部分随后以数据块发送）
+int send_binary_reply(struct connection *conn, const struct bin_header *req, uint16_t status,
+                      uint32_t length, const void *payload, size_t payload_len) {
+    unsigned char header[BIN_HEADER_SIZE];
+    bin_header_encode(header, req, status, length);
+    
+    struct iovec iov[2];
+    int iovcnt = 1;
+    iov[0].iov_base = header;
+    iov[0].iov_len = BIN_HEADER_SIZE;
+    if (payload_len > 0) {
+        iov[1].iov_base = (void*)payload;
+        iov[1].iov_len = payload_len;
+        iovcnt++;
+    }
+    return connection_sendv(conn, iov, iovcnt) == -1 ? -1 : 0;
+}
+
+// 命令失败时的回复：文本协议发送一行错误信息，二进制协议以FAILED状态返回错误信息
+int send_error_reply(struct connection *conn, const struct bin_header *req, const char *msg) {
+    if (req) {
+        return send_binary_reply(conn, req, BIN_STATUS_FAILED, strlen(msg), msg, strlen(msg));
+    }
+    
+    struct iovec iov[2];
+    iov[0].iov_base = (void*)msg;
+    iov[0].iov_len = strlen(msg);
+    iov[1].iov_base = "\n";
+    iov[1].iov_len = 1;
+    return connection_sendv(conn, iov, 2) == -1 ? -1 : 0;
+}
+
+// 文本键值命令: set <key> <value> / get <key> / del <key> / mget <key>...
+int handle_kv_text(struct connection *conn, char *line) {
+    char *args = strchr(line, ' ') + 1;
+    
+    if (line[0] == 's') {
+        char *value = strchr(args, ' ');
+        if (!value || value == args) {
+            return send_error_reply(conn, NULL, "Usage: set <key> <value>");
+        }
+        if (value - args > KV_MAX_KEY_LEN) {
+            return send_error_reply(conn, NULL, "ERROR key too long or out of memory");
+        }
+        if (journal_command(conn, JOURNAL_OP_TEXT, line, strlen(line)) == -1) {
+            return send_error_reply(conn, NULL, "ERROR journal unavailable");
+        }
+        if (kv_set(kv, args, value - args, value + 1, strlen(value + 1)) == -1) {
+            return send_error_reply(conn, NULL, "ERROR key too long or out of memory");
+        }
+        return send_error_reply(conn, NULL, "OK");
+    }
+    if (line[0] == 'd') {
+        size_t key_len = strlen(args);
+        if (key_len == 0 || key_len > KV_MAX_KEY_LEN) {
+            return send_error_reply(conn, NULL, "NOT_FOUND");
+        }
+        if (journal_command(conn, JOURNAL_OP_TEXT, line, strlen(line)) == -1) {
+            return send_error_reply(conn, NULL, "ERROR journal unavailable");
+        }
+        return send_error_reply(conn, NULL, kv_del(kv, args, key_len) ? "OK" : "NOT_FOUND");
     }
     
+    // get和mget：一次扫描找出所有空格，两个空格之间非空的部分是键
+    const char *keys[MGET_MAX_KEYS];
+    size_t key_lens[MGET_MAX_KEYS];
+    uint32_t spaces[SCAN_BATCH];
+    int count = 0;
+    size_t len = strlen(args), scanned;
+    size_t nspaces = scan_byte(args, len, ' ', spaces, SCAN_BATCH, &scanned);
+    if (scanned < len) {
+        return send_error_reply(conn, NULL, "ERROR too many keys");
+    }
+    size_t start = 0;
+    for (size_t i = 0; i <= nspaces; i++) {
+        size_t end = i < nspaces ? spaces[i] : len;
+        if (end == start) {
+            start = end + 1;
+            continue;
+        }
+        if (count == MGET_MAX_KEYS) {
+            return send_error_reply(conn, NULL, "ERROR too many keys");
+        }
+        keys[count] = args + start;
+        key_lens[count] = end - start;
+        count++;
+        start = end + 1;
+    }
+    if (count == 0 || (line[0] == 'g' && count > 1)) {
+        return send_error_reply(conn, NULL, line[0] == 'g' ? "Usage: get <key>" : "Usage: mget <key>...");
+    }
+    return send_kv_values(conn, NULL, line[0] == 'm', keys, key_lens, count);
+}
+
+// 二进制键值命令，payload格式见enum bin_opcode
+int handle_kv_binary(struct connection *conn, const struct bin_header *req, const char *payload) {
+    const unsigned char *p = (const unsigned char*)payload;
+    
+    switch (req->opcode) {
+    case BIN_OP_SET: {
+        size_t key_len = req->length >= 2 ? (size_t)(p[0] << 8 | p[1]) : 0;
+        if (key_len == 0 || 2 + key_len > req->length) {
+            return send_error_reply(conn, req, "Invalid set payload");
+        }
+        if (key_len > KV_MAX_KEY_LEN) {
+            return send_error_reply(conn, req, "Key too long or out of memory");
+        }
+        if (journal_command(conn, req->opcode, payload, req->length) == -1) {
+            return send_error_reply(conn, req, "Journal unavailable");
+        }
+        if (kv_set(kv, payload + 2, key_len, payload + 2 + key_len, req->length - 2 - key_len) == -1) {
+            return send_error_reply(conn, req, "Key too long or out of memory");
+        }
+        return send_binary_reply(conn, req, BIN_STATUS_OK, 0, NULL, 0);
+    }
+    case BIN_OP_DEL:
+        if (req->length == 0 || req->length > KV_MAX_KEY_LEN) {
+            return send_binary_reply(conn, req, BIN_STATUS_NOT_FOUND, 0, NULL, 0);
+        }
+        if (journal_command(conn, req->opcode, payload, req->length) == -1) {
+            return send_error_reply(conn, req, "Journal unavailable");
+        }
+        return send_binary_reply(conn, req,
+                                 kv_del(kv, payload, req->length) ? BIN_STATUS_OK : BIN_STATUS_NOT_FOUND,
+                                 0, NULL, 0);
+    case BIN_OP_GET: {
+        const char *key = payload;
+        size_t key_len = req->length;
+        return send_kv_values(conn, req, 0, &key, &key_len, 1);
+    }
+    default: {
+        const char *keys[MGET_MAX_KEYS];
+        size_t key_lens[MGET_MAX_KEYS];
+        int count = 0;
+        size_t offset = 0;
+        while (offset < req->length) {
+            if (count == MGET_MAX_KEYS || offset + 2 > req->length) {
+                return send_error_reply(conn, req, "Invalid mget payload");
+            }
+            key_lens[count] = p[offset] << 8 | p[offset + 1];
+            keys[count] = payload + offset + 2;
+            offset += 2 + key_lens[count];
+            if (offset > req->length) {
+                return send_error_reply(conn, req, "Invalid mget payload");
+            }
+            count++;
+        }
+        return send_kv_values(conn, req, 1, keys, key_lens, count);
+    }
+    }
+}
+
+// 回复get/mget：值直接引用存储里的内存，写不完时发送队列持有条目的引用，不拷贝
+// 文本协议每个键一行，不存在为"(nil)"；二进制get不存在时返回NOT_FOUND，
+// mget的payload为每个键 4字节值长 + 值，不存在的键值长为0xFFFFFFFF
+int send_kv_values(struct connection *conn, const struct bin_header *req, int multi,
+                   const char **keys, const size_t *key_lens, int count) {
+    struct iovec iov[2 * MGET_MAX_KEYS + 1];
+    struct out_ref refs[2 * MGET_MAX_KEYS + 1];
+    unsigned char header[BIN_HEADER_SIZE];
+    uint32_t lengths[MGET_MAX_KEYS];
+    uint64_t payload_len = 0;
+    int iovcnt = 0;
+    
+    memset(refs, 0, sizeof(refs));
+    if (req) {
+        iov[iovcnt].iov_base = header;
+        iov[iovcnt].iov_len = BIN_HEADER_SIZE;
+        iovcnt++;
+    }
+    
+    // 查找之间存储不会被修改，返回的条目在整个回复发出或入队前都有效
+    for (int i = 0; i < count; i++) {
+        struct kv_item *item = kv_get(kv, keys[i], key_lens[i]);
+        size_t len = 0;
+        const char *value = item ? kv_item_value(item, &len) : NULL;
+        
+        if (req && !multi) {
+            if (!item) {
+                return send_binary_reply(conn, req, BIN_STATUS_NOT_FOUND, 0, NULL, 0);
+            }
+        } else if (req) {
+            lengths[i] = htonl(item ? (uint32_t)len : UINT32_MAX);
+            iov[iovcnt].iov_base = &lengths[i];
+            iov[iovcnt].iov_len = 4;
+            iovcnt++;
+            payload_len += 4;
+        }
+        
+        if (item) {
+            iov[iovcnt].iov_base = (void*)value;
+            iov[iovcnt].iov_len = len;
+            refs[iovcnt].retain = kv_item_retain;
+            refs[iovcnt].release = kv_item_release;
+            refs[iovcnt].ctx = item;
+            iovcnt++;
+            payload_len += len;
+        }
+        if (!req) {
+            iov[iovcnt].iov_base = item ? "\n" : "(nil)\n";
+            iov[iovcnt].iov_len = item ? 1 : 6;
+            iovcnt++;
+        }
+    }
+    
+    if (req) {
+        if (payload_len > UINT32_MAX) {
+            return send_error_reply(conn, req, "Reply too large for binary protocol");
+        }
+        bin_header_encode(header, req, BIN_STATUS_OK, payload_len);
+    }
+    return connection_sendv_ref(conn, iov, iovcnt, refs) == -1 ? -1 : 0;
+}
+
+// 处理可写事件：继续发送队列中的数据
+void handle_client_write(int client_fd, int epoll_fd) {
+    struct connection *conn = connection_get(client_fd);
+    if (!conn) {
+        return;
+    }
+    
+    if (conn->co && conn->co_wait == CO_WAIT_WRITE && !conn->out_head) {
+        // 协程自己写socket，EPOLLOUT保持注册，省得每轮EAGAIN都epoll_ctl两次
+        connection_co_resume(conn);
+        return;
+    }
+    
+    int result = connection_flush(conn);
+    if (result == -1) {
+        printf("Write error for fd %d\n", client_fd);
+        handle_client_disconnect(client_fd, epoll_fd);
+        return;
+    }
+    if (result == 0 && conn->co && conn->co_wait == CO_WAIT_WRITE) {
+        // co_write在等排在前面的回复发完；发送队列清空后EPOLLOUT已经关掉，不恢复就再也等不到事件
+        connection_co_resume(conn);
+        return;
+    }
+    http_shutdown_if_done(conn);
+}
+
+// 处理客户端断开连接
+void handle_client_disconnect(int client_fd, int epoll_fd) {
+    printf("Closing connection fd %d\n", client_fd);
+    struct connection *conn = connection_get(client_fd);
+    int linger = conn && conn->zc_head;
+    
+    // 从epoll中移除（通常不需要系统调用，close时内核自动移除）；兴趣集记录的是全局epoll_fd上的注册
+    // 还要等零拷贝完成通知的连接只保留边沿触发的注册：EPOLLERR/EPOLLHUP总会上报，不再关心读写
+    (void)epoll_fd;
+    if (linger) {
+        interest_set(client_fd, EPOLLET);
+    } else {
+        interest_forget(client_fd);
+    }
+    
+    connection_destroy(client_fd);
+    if (linger) {
+        // 零拷贝发送还没完成：fd留着等完成通知，由zc_linger_event/zc_linger_expire关闭
+        return;
+    }
+    
+    // 关闭socket
+    prof_syscall(SYS_OTHER);
+    close(client_fd);
+}
+
+// 为新连接分配状态（连接表按fd直接索引，按需扩容）
+struct connection* connection_create(int fd, const struct socket_profile *profile) {
+    if (fd >= connections_size) {
+        int new_size = connections_size ? connections_size : 1024;
+        while (new_size <= fd) {
+            new_size *= 2;
+        }
+        struct connection **table = realloc(connections, new_size * sizeof(*table));
+        if (!table) {
+            perror("realloc connections");
+            return NULL;
+        }
+        memset(table + connections_size, 0, (new_size - connections_size) * sizeof(*table));
+        connections = table;
+        connections_size = new_size;
+    }
+    
+    struct connection *conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        perror("calloc connection");
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->profile = profile;
+    conn->peer_fd = -1;
+    conn->pipe_fds[0] = conn->pipe_fds[1] = -1;
+    connections[fd] = conn;
+    stats.connections_active++;
+    return conn;
+}
+
+// 查找连接状态
+struct connection* connection_get(int fd) {
+    if (fd < 0 || fd >= connections_size) {
+        return NULL;
+    }
+    return connections[fd];
+}
+
+// 释放连接状态（包括未发送完的数据）
+void connection_destroy(int fd) {
+    struct connection *conn = connection_get(fd);
+    if (conn) {
+        if (conn->co) {
+            // 挂起的协程：标记取消后恢复一次，co_read/co_write返回-1，处理函数清理后退出
+            if (conn->co_wait != CO_READY) {
+                stats.coroutines_cancelled++;
+            }
+            conn->co_wait = CO_CANCELLED;
+            connection_co_step(conn);
+        }
+        while (conn->out_head) {
+            struct out_chunk *next = conn->out_head->next;
+            out_chunk_free(conn->out_head);
+            conn->out_head = next;
+        }
+        if (conn->pipe_fds[0] != -1) {
+            close(conn->pipe_fds[0]);
+            close(conn->pipe_fds[1]);
+        }
+        pubsub_unsubscribe_all(conn);
+        if (conn->journal_wait) {
+            struct connection **p = &journal_waiters;
+            while (*p != conn) {
+                p = &(*p)->journal_next;
+            }
+            *p = conn->journal_next;
+        }
+        if (conn->slow_consumer) {
+            stats.slow_consumers--;
+        }
+        if (conn->capture_id && capture) {
+            capture_conn_close(capture, conn->capture_id);
+        }
+        while (conn->jobs) {
+            // 还在工作线程池里的任务：取消，完成回调时只释放资源
+            struct offload_job *job = conn->jobs;
+            conn->jobs = job->conn_next;
+            job->conn = NULL;
+            worker_job_cancel(&job->job);
+            stats.jobs_cancelled++;
+        }
+        connections[fd] = NULL;
+        free(conn->in_buf);
+        conn->in_buf = NULL;
+        stats.connections_active--;
+        if (conn->zc_head) {
+            // 内核可能还引用着已发出的零拷贝数据块，现在释放的话页被复用，对端会收到错的字节
+            zc_linger_start(conn);
+        } else {
+            free(conn);
+        }
+    }
+}
+
+// fd所在的epoll集合：高优先级档案的连接在prio_epoll_fd里（代理的后端连接沿用客户端的档案）
+static int interest_epoll_fd(int fd) {
+    struct connection *conn = connection_get(fd);
+    return conn && conn->profile->priority ? prio_epoll_fd : epoll_fd;
+}
+
+// 把fd在epoll里的兴趣集设为events：未注册时ADD，和已注册的相同时不发起系统调用
+// 客户端连接的注册都经过这里（要求connection已创建）；监听socket、signalfd等只在启动时注册一次，直接调用epoll_ctl
+int interest_set(int fd, uint32_t events) {
+    if (fd >= interest_size) {
+        int new_size = interest_size ? interest_size : 1024;
+        while (new_size <= fd) {
+            new_size *= 2;
+        }
+        uint32_t *new_interest = realloc(interest, new_size * sizeof(*new_interest));
+        if (!new_interest) {
+            perror("realloc interest");
+            return -1;
+        }
+        memset(new_interest + interest_size, 0, (new_size - interest_size) * sizeof(*new_interest));
+        interest = new_interest;
+        interest_size = new_size;
+    }
+    if (interest[fd] == events) {
+        stats.epoll_ctl_skipped++;
+        return 0;
+    }
+    
+    struct epoll_event event;
+    event.data.fd = fd;
+    event.events = events;
+    int op = interest[fd] ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    prof_syscall(SYS_EPOLL_CTL);
+    if (epoll_ctl(interest_epoll_fd(fd), op, fd, &event) == -1) {
+        perror(op == EPOLL_CTL_ADD ? "epoll_ctl ADD" : "epoll_ctl MOD");
+        return -1;
+    }
+    if (op == EPOLL_CTL_ADD) {
+        stats.epoll_ctl_add++;
+    } else {
+        stats.epoll_ctl_mod++;
+    }
+    interest[fd] = events;
+    return 0;
+}
+
+// interest_forget的实现，由调用方给出fd注册在哪个epoll上（connection已经销毁、查不到优先级时直接调用）
+static void interest_forget_in(int set, int fd) {
+    if (fd < 0 || fd >= interest_size || !interest[fd]) {
+        return;
+    }
+    if (upgrade_fd != -1) {
+        prof_syscall(SYS_EPOLL_CTL);
+        if (epoll_ctl(set, EPOLL_CTL_DEL, fd, NULL) == -1) {
+            perror("epoll_ctl DEL");
+        }
+        stats.epoll_ctl_del++;
+    } else {
+        stats.epoll_ctl_skipped++;
+    }
+    interest[fd] = 0;
+}
+
+// 在close(fd)之前调用，清掉兴趣集记录（fd号会被新连接复用）
+// epoll跟踪的是打开的文件而不是fd号，最后一个引用关闭时内核自动移除，平时不需要EPOLL_CTL_DEL；
+// 热升级fork出的子进程exec之前还持有所有fd的副本，这期间close不会移除，才显式DEL
+void interest_forget(int fd) {
+    interest_forget_in(interest_epoll_fd(fd), fd);
+}
+
+// 按需添加/移除EPOLLOUT（已经是目标状态时不发起系统调用）
+// -E时EPOLLOUT常驻，这里只记录状态；没有待发数据时多出来的可写事件由handle_client_write空转处理
+void connection_set_epollout(struct connection *conn, int enable) {
+    if (conn->epollout == enable) {
+        return;
+    }
+    
+    uint32_t events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    if (enable || epollout_always) {
+        events |= EPOLLOUT;
+    }
+    if (interest_set(conn->fd, events) == -1) {
+        return;
+    }
+    conn->epollout = enable;
+}
+
+// 打开/关闭TCP_CORK，关闭时内核立即发出攒下的数据
+void connection_set_cork(struct connection *conn, int enable) {
+    prof_syscall(SYS_SETSOCKOPT);
+    if (setsockopt(conn->fd, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable)) == -1) {
+        perror("setsockopt TCP_CORK");
+        return;
+    }
+    conn->corked = enable;
+}
+
+// 分配待发送数据块（len为0时优先从池里取）
+struct out_chunk* out_chunk_alloc(size_t len) {
+    struct out_chunk *chunk;
+    if (len == 0 && out_chunk_pool) {
+        chunk = out_chunk_pool;
+        out_chunk_pool = chunk->next;
+        out_chunk_pool_count--;
+    } else {
+        chunk = malloc(sizeof(*chunk) + len);
+        if (!chunk) {
+            perror("malloc out_chunk");
+            return NULL;
+        }
+    }
+    chunk->next = NULL;
+    chunk->cap = len;
+    chunk->len = len;
+    chunk->sent = 0;
+    chunk->file = NULL;
+    chunk->base = chunk->data;
+    chunk->release = NULL;
+    chunk->release_ctx = NULL;
+    chunk->zc_first = 0;
+    chunk->zc_last = 0;
+    chunk->zc_outstanding = 0;
+    return chunk;
+}
+
+// 释放数据块（同时释放对文件缓存项或外部内存的引用）
+void out_chunk_free(struct out_chunk *chunk) {
+    if (chunk->file) {
+        file_cache_put(chunk->file);
+    }
+    if (chunk->release) {
+        chunk->release(chunk->release_ctx);
+    }
+    if (chunk->cap == 0 && out_chunk_pool_count < OUT_CHUNK_POOL_SIZE) {
+        chunk->next = out_chunk_pool;
+        out_chunk_pool = chunk;
+        out_chunk_pool_count++;
+        return;
+    }
+    free(chunk);
+}
+
+// 发送一组数据：发送队列为空时直接writev，写不完的部分拷贝进发送队列
+// 返回值: 0=全部发出, 1=有数据排队等待EPOLLOUT, -1=错误
+int connection_sendv(struct connection *conn, const struct iovec *iov, int iovcnt) {
+    return connection_sendv_ref(conn, iov, iovcnt, NULL);
+}
+
+// 同connection_sendv；refs[i].release不为NULL时iov[i]是带引用计数的外部内存，
+// 写不完的部分直接引用而不拷贝（refs可以为NULL）
+int connection_sendv_ref(struct connection *conn, const struct iovec *iov, int iovcnt,
+                         const struct out_ref *refs) {
+    size_t total = 0;
+    size_t skip = 0;
+    int buffer_full = 0;    // 直接writev已经写满发送缓冲区，剩余部分等EPOLLOUT
+    
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    
+    if (!conn->out_head && !conn->journal_wait) {
+        prof_syscall(SYS_WRITE);
+        ssize_t bytes_sent = conn_writev(conn->fd, iov, iovcnt);
+        if (bytes_sent == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("writev");
+                return -1;
+            }
+            // EAGAIN: 本地发送缓冲区满，全部进入发送队列（EINTR时由下面的connection_flush重试）
+            buffer_full = errno != EINTR;
+            bytes_sent = 0;
+        } else {
+            buffer_full = (size_t)bytes_sent < total;
+        }
+        if ((size_t)bytes_sent == total) {
+            return 0;
+        }
+        skip = bytes_sent;
+    }
+    
+    // 保存剩余数据：外部内存各自挂成一个数据块，其余相邻的iov合并拷贝成一个数据块
+    int i = 0;
+    while (i < iovcnt) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            i++;
+            continue;
+        }
+        
+        struct out_chunk *chunk;
+        if (refs && refs[i].release) {
+            chunk = out_chunk_alloc(0);
+            if (!chunk) {
+                return -1;
+            }
+            refs[i].retain(refs[i].ctx);
+            chunk->base = (const char*)iov[i].iov_base + skip;
+            chunk->len = iov[i].iov_len - skip;
+            chunk->release = refs[i].release;
+            chunk->release_ctx = refs[i].ctx;
+            skip = 0;
+            i++;
+        } else {
+            int end = i;
+            size_t len = 0;
+            while (end < iovcnt && !(refs && refs[end].release)) {
+                len += iov[end].iov_len;
+                end++;
+            }
+            chunk = out_chunk_alloc(len - skip);
+            if (!chunk) {
+                return -1;
+            }
+            size_t offset = 0;
+            for (; i < end; i++) {
+                memcpy(chunk->data + offset, (const char*)iov[i].iov_base + skip, iov[i].iov_len - skip);
+                offset += iov[i].iov_len - skip;
+                skip = 0;
+            }
+        }
+        connection_queue_chunk(conn, chunk);
+    }
+    
+    if (buffer_full) {
+        // 短写或EAGAIN说明发送缓冲区已满，立即再写只会得到EAGAIN
+        connection_set_epollout(conn, 1);
+        return 1;
+    }
+    return connection_flush(conn);
+}
+
+// 将数据块挂到发送队列末尾（接管chunk的所有权）
+void connection_queue_chunk(struct connection *conn, struct out_chunk *chunk) {
+    if (conn->out_tail) {
+        conn->out_tail->next = chunk;
+    } else {
+        conn->out_head = chunk;
+    }
+    conn->out_tail = chunk;
+    conn->out_pending += chunk->len - chunk->sent;
+}
+
+// 将数据块挂到发送队列末尾并尝试发送（接管chunk的所有权）
+// 返回值: 0=全部发出, 1=有数据排队等待EPOLLOUT, -1=错误
+int connection_send_chunk(struct connection *conn, struct out_chunk *chunk) {
+    connection_queue_chunk(conn, chunk);
+    return connection_flush(conn);
+}
+
+// 数据块剩余部分是否走MSG_ZEROCOPY（小数据块的页固定和通知开销比拷贝更贵）
+static int chunk_use_zerocopy(const struct connection *conn, const struct out_chunk *c) {
+    return conn->zerocopy && !c->file && c->len - c->sent >= zerocopy_threshold;
+}
+
+// 继续发送队列中的数据，每次最多合并MAX_WRITE_IOV个数据块
+// 大数据块在开启零拷贝时单独用send(MSG_ZEROCOPY)发送，文件数据块用sendfile发送
+// 返回值: 0=完成, 1=还有数据, -1=错误
+int connection_flush(struct connection *conn) {
+    if (conn->journal_wait) {
+        // 在等日志落盘：回复留在队列里，由journal_release放行（不需要EPOLLOUT）
+        return 1;
+    }
+    while (conn->out_head) {
+        ssize_t bytes_sent;
+        struct out_chunk *head = conn->out_head;
+        
+        if (head->file) {
+            // 数据从页缓存直接进socket，不经过用户空间
+            off_t offset = head->sent;
+            prof_syscall(SYS_WRITE);
+            bytes_sent = sendfile(conn->fd, head->file->fd, &offset, head->len - head->sent);
+            if (bytes_sent == 0) {
+                // 发送过程中文件被截断
+                fprintf(stderr, "sendfile: %s truncated at %zu bytes\n",
+                        head->file->name, head->sent);
+                return -1;
+            }
+            if (bytes_sent > 0) {
+                stats.sendfile_bytes += bytes_sent;
+            }
+        } else if (chunk_use_zerocopy(conn, head)) {
+            prof_syscall(SYS_WRITE);
+            bytes_sent = send(conn->fd, head->base + head->sent, head->len - head->sent,
+                              MSG_ZEROCOPY);
+            if (bytes_sent >= 0) {
+                // 每次成功的零拷贝发送占用一个通知序号
+                if (head->zc_outstanding == 0) {
+                    head->zc_first = conn->zc_next_seq;
+                }
+                head->zc_last = conn->zc_next_seq++;
+                head->zc_outstanding++;
+                stats.zerocopy_sends++;
+            } else if (errno == ENOBUFS) {
+                // 超出optmem限制，这次退回普通拷贝发送
+                stats.zerocopy_fallbacks++;
+                prof_syscall(SYS_WRITE);
+                bytes_sent = write(conn->fd, head->base + head->sent, head->len - head->sent);
+            }
+        } else {
+            struct iovec iov[MAX_WRITE_IOV];
+            int iovcnt = 0;
+            for (struct out_chunk *c = head; c && iovcnt < MAX_WRITE_IOV; c = c->next) {
+                if (iovcnt > 0 && (c->file || chunk_use_zerocopy(conn, c))) {
+                    break;
+                }
+                iov[iovcnt].iov_base = (void*)(c->base + c->sent);
+                iov[iovcnt].iov_len = c->len - c->sent;
+                iovcnt++;
+            }
+            prof_syscall(SYS_WRITE);
+            bytes_sent = conn_writev(conn->fd, iov, iovcnt);
+        }
+        
+        if (bytes_sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // 发送缓冲区满，等待下一次EPOLLOUT
+                connection_set_epollout(conn, 1);
+                return 1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("continue write");
+            return -1;
+        }
+        
+        // 释放已经完整发出的数据块
+        conn->out_pending -= bytes_sent;
+        size_t remaining = bytes_sent;
+        while (remaining > 0) {
+            struct out_chunk *c = conn->out_head;
+            size_t left = c->len - c->sent;
+            if (remaining < left) {
+                c->sent += remaining;
+                break;
+            }
+            remaining -= left;
+            conn->out_head = c->next;
+            if (c->zc_outstanding > 0) {
+                // 内核还引用着这块内存，移到等待完成通知的队列
+                c->next = NULL;
+                if (conn->zc_tail) {
+                    conn->zc_tail->next = c;
+                } else {
+                    conn->zc_head = c;
+                }
+                conn->zc_tail = c;
+            } else {
+                out_chunk_free(c);
+            }
+        }
+        if (!conn->out_head) {
+            conn->out_tail = NULL;
+        }
+    }
+    
+    // 发送完成后切换回只监听EPOLLIN
+    connection_set_epollout(conn, 0);
+    return 0;
+}
+
+// 收到通知序号[lo, hi]后，扣减数据块中落在该区间的零拷贝发送次数
+static void chunk_complete_zerocopy(struct out_chunk *c, uint32_t lo, uint32_t hi) {
+    if (c->zc_outstanding == 0 || hi < c->zc_first || lo > c->zc_last) {
+        return;
+    }
+    uint32_t from = lo > c->zc_first ? lo : c->zc_first;
+    uint32_t to = hi < c->zc_last ? hi : c->zc_last;
+    uint32_t done = to - from + 1;
+    c->zc_outstanding -= done < c->zc_outstanding ? done : c->zc_outstanding;
+}
+
+// 处理EPOLLERR：从错误队列读取MSG_ZEROCOPY完成通知，释放内核不再引用的数据块
+// 返回值: 0=只有完成通知, -1=socket上有真正的错误
+int handle_zerocopy_completions(struct connection *conn) {
+    
+    while (1) {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        
+        prof_syscall(SYS_OTHER);
+        if (recvmsg(conn->fd, &msg, MSG_ERRQUEUE) == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("recvmsg MSG_ERRQUEUE");
+            }
+            break;
+        }
+        
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err *serr = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            
+            uint32_t lo = serr->ee_info;
+            uint32_t hi = serr->ee_data;
+            unsigned long long count = (unsigned long long)(hi - lo) + 1;
+            
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // 内核实际做了拷贝：零拷贝只剩额外开销，之后这个连接改回普通发送
+                stats.zerocopy_misses += count;
+                conn->zerocopy = 0;
+            } else {
+                stats.zerocopy_hits += count;
+            }
+            
+            // 发送队列头部的数据块可能只发了一部分，也要扣减
+            if (conn->out_head) {
+                chunk_complete_zerocopy(conn->out_head, lo, hi);
+            }
+            struct out_chunk *prev = NULL;
+            struct out_chunk *c = conn->zc_head;
+            while (c) {
+                struct out_chunk *next = c->next;
+                chunk_complete_zerocopy(c, lo, hi);
+                if (c->zc_outstanding == 0) {
+                    if (prev) {
+                        prev->next = next;
+                    } else {
+                        conn->zc_head = next;
+                    }
+                    if (conn->zc_tail == c) {
+                        conn->zc_tail = prev;
+                    }
+                    // 和发完的普通数据块一样释放：放掉kv值、共享消息的引用，只有头部的块回到池里
+                    out_chunk_free(c);
+                } else {
+                    prev = c;
+                }
+                c = next;
+            }
+        }
+    }
+    
+    // 通知可能已在之前的事件里读完，以SO_ERROR判断连接本身是否出错
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// 连接关闭时还有零拷贝数据块在等完成通知：close不会等内核发完，数据块一释放页就可能被新的kv值、
+// 消息复用，对端收到错的字节。所以fd保持打开（fd号不会被新连接复用），SHUT_WR让对端照常在数据之后收到FIN，
+// 数据块留在这里，completions到齐后再释放并close；兴趣集仍在epoll里，EPOLLERR照样报告
+void zc_linger_start(struct connection *conn) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!conn->shut_wr && shutdown(conn->fd, SHUT_WR) == -1 && errno != ENOTCONN) {
+        perror("shutdown lingering zerocopy");
+    }
+    conn->zc_linger_deadline = now.tv_sec + ZC_LINGER_SECONDS;
+    conn->zc_linger_next = zc_lingering;
+    zc_lingering = conn;
+    stats.zerocopy_lingering++;
+}
+
+// 释放等完成通知的连接；abort时先设SO_LINGER为0，close发RST，内核丢掉还没发出的数据、放开对页的引用
+static void zc_linger_close(struct connection *conn, int abort) {
+    if (abort) {
+        struct linger lin = { 1, 0 };
+        if (setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin)) == -1) {
+            perror("setsockopt SO_LINGER");
+        }
+    }
+    interest_forget_in(conn->profile->priority ? prio_epoll_fd : epoll_fd, conn->fd);
+    prof_syscall(SYS_OTHER);
+    close(conn->fd);
+    while (conn->zc_head) {
+        struct out_chunk *next = conn->zc_head->next;
+        out_chunk_free(conn->zc_head);
+        conn->zc_head = next;
+    }
+    stats.zerocopy_lingering--;
+    free(conn);
+}
+
+// 已关闭连接的fd上的事件：读完成通知，全部到齐后释放；返回0表示fd不是在等通知的连接
+int zc_linger_event(int fd) {
+    for (struct connection **p = &zc_lingering; *p; p = &(*p)->zc_linger_next) {
+        struct connection *conn = *p;
+        if (conn->fd != fd) {
+            continue;
+        }
+        // 对端重置等真正的错误也不提前释放：内核丢弃发送队列时同样会发完成通知
+        handle_zerocopy_completions(conn);
+        if (!conn->zc_head) {
+            *p = conn->zc_linger_next;
+            zc_linger_close(conn, 0);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// 等完成通知超时（对端一直不收）或进程退出（force）：RST关闭后释放
+void zc_linger_expire(int force) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct connection **p = &zc_lingering;
+    while (*p) {
+        struct connection *conn = *p;
+        if (force || now.tv_sec >= conn->zc_linger_deadline) {
+            *p = conn->zc_linger_next;
+            zc_linger_close(conn, 1);
+        } else {
+            p = &conn->zc_linger_next;
+        }
+    }
+}
+
+static void co_entry(void *arg) {
+    struct connection *conn = arg;
+    conn->co_result = conn->co_handler(conn, conn->co_arg);
+}
+
+// 在连接上创建协程执行handler(conn, arg)，由process_input在移除当前命令后启动
+// handler返回0继续处理后续命令，-1关闭连接；其中用co_read/co_write读写，不要直接read/write
+// 返回值: 0=成功, -1=无法创建协程
+int connection_spawn(struct connection *conn, int (*handler)(struct connection *conn, void *arg),
+                     void *arg) {
+    struct coro *co = coro_create(co_entry, conn);
+    if (!co) {
+        return -1;
+    }
+    conn->co = co;
+    conn->co_wait = CO_READY;
+    conn->co_handler = handler;
+    conn->co_arg = arg;
+    conn->co_result = 0;
+    stats.coroutines_started++;
+    return 0;
+}
+
+// 运行协程直到它挂起或结束
+// 返回值: 0=挂起或正常结束, -1=处理函数要求关闭连接
+int connection_co_step(struct connection *conn) {
+    if (coro_resume(conn->co) == 1) {
+        return 0;
+    }
+    conn->co = NULL;
+    conn->co_wait = CO_READY;
+    return conn->co_result;
+}
+
+// 就绪事件到达时恢复连接上挂起的协程；协程结束后处理期间缓冲的命令
+void connection_co_resume(struct connection *conn) {
+    int fd = conn->fd;
+    int result = connection_co_step(conn);
+    
+    if (result == 0 && !conn->co && conn->in_len > 0) {
+        result = process_input(conn);
+    }
+    if (result == -1) {
+        handle_client_disconnect(fd, epoll_fd);
+    } else if (!conn->co) {
+        // 协程运行期间到达的数据可能还在内核里，边沿触发不会再通知，这里读一遍
+        handle_client_message(fd, epoll_fd);
+    }
+}
+
+// 挂起当前协程直到连接就绪；连接被关闭时返回-1
+static int co_wait_for(struct connection *conn, int what) {
+    if (conn->co_wait == CO_CANCELLED) {
+        return -1;
+    }
+    conn->co_wait = what;
+    coro_yield();
+    return conn->co_wait == CO_CANCELLED ? -1 : 0;
+}
+
+// 在协程里读取：先取接收缓冲区里已有的数据，没有时读socket，EAGAIN时挂起等EPOLLIN
+// 返回值: >0=读到的字节数, 0=对端关闭, -1=错误或连接正在关闭
+ssize_t co_read(struct connection *conn, void *buf, size_t len) {
+    if (coro_current() != conn->co) {
+        fprintf(stderr, "co_read outside the connection's coroutine (fd %d)\n", conn->fd);
+        return -1;
+    }
+    
+    while (conn->co_wait != CO_CANCELLED) {
+        if (conn->in_len > 0) {
+            size_t n = conn->in_len < len ? conn->in_len : len;
+            memcpy(buf, conn->in_buf, n);
+            memmove(conn->in_buf, conn->in_buf + n, conn->in_len - n);
+            conn->in_len -= n;
+            return n;
+        }
+        
+        prof_syscall(SYS_READ);
+        ssize_t bytes_read = read(conn->fd, buf, len);
+        if (bytes_read > 0 && conn->capture_id && capture) {
+            capture_conn_data(capture, conn->capture_id, buf, bytes_read);
+        }
+        if (bytes_read >= 0) {
+            return bytes_read;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (co_wait_for(conn, CO_WAIT_READ) == -1) {
+                return -1;
+            }
+        } else if (errno != EINTR) {
+            perror("co_read");
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// 在协程里写出全部数据：先发完发送队列里排着的回复，EAGAIN时挂起等EPOLLOUT
+// 返回值: 0=全部写入内核, -1=错误或连接正在关闭
+int co_write(struct connection *conn, const void *buf, size_t len) {
+    const char *p = buf;
+    
+    if (coro_current() != conn->co) {
+        fprintf(stderr, "co_write outside the connection's coroutine (fd %d)\n", conn->fd);
+        return -1;
+    }
+    
+    while (len > 0) {
+        if (conn->co_wait == CO_CANCELLED) {
+            return -1;
+        }
+        if (conn->out_head) {
+            int result = connection_flush(conn);
+            if (result == -1) {
+                return -1;
+            }
+            if (result == 1) {
+                if (co_wait_for(conn, CO_WAIT_WRITE) == -1) {
+                    return -1;
+                }
+                continue;
+            }
+        }
+        
+        prof_syscall(SYS_WRITE);
+        ssize_t bytes_sent = write(conn->fd, p, len);
+        if (bytes_sent >= 0) {
+            p += bytes_sent;
+            len -= bytes_sent;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            connection_set_epollout(conn, 1);
+            if (co_wait_for(conn, CO_WAIT_WRITE) == -1) {
+                return -1;
+            }
+        } else if (errno != EINTR) {
+            perror("co_write");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// upload <n>：读取命令行之后的n个字节，回复 "OK <n> <FNV-1a 64位哈希>"
+// 数据边到边算，不在内存里攒整个上传
+static int upload_handler(struct connection *conn, void *arg) {
+    unsigned long long remaining = (uintptr_t)arg;
+    unsigned long long total = remaining;
+    uint64_t hash = 14695981039346656037ULL;
+    char buf[CO_READ_CHUNK];
+    
+    while (remaining > 0) {
+        ssize_t n = co_read(conn, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+        if (n <= 0) {
+            return -1;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            hash = (hash ^ (unsigned char)buf[i]) * 1099511628211ULL;
+        }
+        remaining -= n;
+    }
+    
+    int len = snprintf(buf, sizeof(buf), "OK %llu %016llx\n", total, (unsigned long long)hash);
+    return co_write(conn, buf, len);
+}
+
+// stream <n>：发送n个字节的生成数据，对端读得慢时协程挂起，内存占用不随n增长
+static int stream_handler(struct connection *conn, void *arg) {
+    // 数据内容固定，所有协程共用一份，不放在协程栈上
+    static char pattern[CO_STREAM_CHUNK];
+    unsigned long long remaining = (uintptr_t)arg;
+    
+    if (pattern[0] == '\0') {
+        for (size_t i = 0; i < sizeof(pattern); i++) {
+            pattern[i] = 'A' + (i % 26);
+        }
+    }
+    while (remaining > 0) {
+        size_t n = remaining < sizeof(pattern) ? remaining : sizeof(pattern);
+        if (co_write(conn, pattern, n) == -1) {
+            return -1;
+        }
+        remaining -= n;
+    }
+    return 0;
+}
+
+// 协程命令: upload <n> / stream <n>（只有文本协议）
+int handle_co_text(struct connection *conn, char *line) {
+    char *args = line + 7;
+    char *end;
+    
+    if (*args < '0' || *args > '9') {
+        return send_error_reply(conn, NULL, "Usage: upload|stream <bytes>");
+    }
+    unsigned long long n = strtoull(args, &end, 10);
+    if (*end != '\0' || n > UINTPTR_MAX) {
+        return send_error_reply(conn, NULL, "Usage: upload|stream <bytes>");
+    }
+    
+    int (*handler)(struct connection*, void*) = line[0] == 'u' ? upload_handler : stream_handler;
+    if (connection_spawn(conn, handler, (void*)(uintptr_t)n) == -1) {
+        return send_error_reply(conn, NULL, "Out of coroutines");
+    }
+    return 0;
+}
+
+// 提交任务并挂到连接上，连接关闭时据此取消
+static void offload_submit(struct connection *conn, struct offload_job *job) {
+    job->conn = conn;
+    job->conn_next = conn->jobs;
+    conn->jobs = job;
+    stats.jobs_submitted++;
+    worker_pool_submit(workers, &job->job);
+}
+
+// 任务完成后从连接上摘下，返回连接；连接已关闭返回NULL
+static struct connection* offload_detach(struct offload_job *job) {
+    struct connection *conn = job->conn;
+    if (!conn) {
+        return NULL;
+    }
+    struct offload_job **pp = &conn->jobs;
+    while (*pp != job) {
+        pp = &(*pp)->conn_next;
+    }
+    *pp = job->conn_next;
+    return conn;
+}
+
+// 任务回复发出后：出错则关闭连接，文本连接继续处理暂停期间缓冲的命令，再读暂停期间留在内核里的数据
+static void offload_resume(struct connection *conn, int result) {
+    if (result == 0 && conn->protocol == PROTO_TEXT && !conn->jobs && conn->in_len > 0) {
+        result = process_input(conn);
+    }
+    if (result == -1) {
+        handle_client_disconnect(conn->fd, epoll_fd);
+    } else if (conn->protocol == PROTO_TEXT && !conn->jobs && !conn->co) {
+        // 任务执行期间到达的数据还在内核里，边沿触发不会再通知，这里读一遍
+        handle_client_message(conn->fd, epoll_fd);
+    }
+}
+
+// 生成10MB数据（在工作线程执行，只能用malloc，不能碰事件循环的状态）
+static struct out_chunk* large_data_generate(void) {
+    struct out_chunk *chunk = out_chunk_alloc(LARGE_DATA_SIZE);
+    if (!chunk) {
+        return NULL;
+    }
+    for (int i = 0; i < LARGE_DATA_SIZE; i++) {
+        chunk->data[i] = 'A' + (i % 26);
+    }
+    return chunk;
+}
+
+// 发送生成好的数据（接管chunk）
+static int large_data_reply(struct connection *conn, const struct bin_header *req, struct out_chunk *chunk) {
+    if (!chunk) {
+        return send_error_reply(conn, req, "Memory allocation failed");
+    }
+    if (req && send_binary_reply(conn, req, BIN_STATUS_OK, LARGE_DATA_SIZE, NULL, 0) == -1) {
+        out_chunk_free(chunk);
+        return -1;
+    }
+    
+    printf("Sending %d bytes to fd %d\n", LARGE_DATA_SIZE, conn->fd);
+    return connection_send_chunk(conn, chunk) == -1 ? -1 : 0;
+}
+
+static void large_job_run(struct job *job) {
+    ((struct offload_job*)job)->chunk = large_data_generate();
+}
+
+static void large_job_complete(struct job *job) {
+    struct offload_job *oj = (struct offload_job*)job;
+    struct connection *conn = offload_detach(oj);
+    
+    if (conn && !worker_job_cancelled(job)) {
+        offload_resume(conn, large_data_reply(conn, oj->binary ? &oj->req : NULL, oj->chunk));
+    } else if (oj->chunk) {
+        out_chunk_free(oj->chunk);
+    }
+    free(oj);
+}
+
+// large命令：生成10MB数据放入发送队列，发送缓冲区满后由EPOLLOUT驱动继续发送
+// 生成数据交给工作线程，不阻塞其他连接；req不为NULL时是二进制请求，数据前先发帧头
+int send_large_data(struct connection *conn, const struct bin_header *req) {
+    if (!workers) {
+        return large_data_reply(conn, req, large_data_generate());
+    }
+    
+    struct offload_job *job = calloc(1, sizeof(*job));
+    if (!job) {
+        perror("calloc offload_job");
+        return send_error_reply(conn, req, "Memory allocation failed");
+    }
+    job->job.run = large_job_run;
+    job->job.complete = large_job_complete;
+    if (req) {
+        job->binary = 1;
+        job->req = *req;
+    }
+    offload_submit(conn, job);
+    return 0;
+}
+
+// 文件名哈希（FNV-1a）
+static unsigned int file_name_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char*)name; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h % FILE_CACHE_BUCKETS;
+}
+
+static void file_lru_unlink(struct file_entry *e) {
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        file_lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        file_lru_tail = e->lru_prev;
+    }
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void file_lru_push_front(struct file_entry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = file_lru_head;
+    if (file_lru_head) {
+        file_lru_head->lru_prev = e;
+    } else {
+        file_lru_tail = e;
+    }
+    file_lru_head = e;
+}
+
+// 从缓存中移除；仍有数据块在发送该文件时延迟到最后一个引用释放再关闭
+static void file_cache_evict(struct file_entry *e) {
+    struct file_entry **pp = &file_buckets[file_name_hash(e->name)];
+    while (*pp != e) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = e->hash_next;
+    file_lru_unlink(e);
+    file_cache_count--;
+    e->cached = 0;
+    
+    if (e->refs == 0) {
+        close(e->fd);
+        free(e);
+    }
+}
+
+// 文件在磁盘上是否已被替换或修改（大小、inode、mtime）
+static int file_entry_stale(const struct file_entry *e, const struct stat *st) {
+    return st->st_dev != e->dev || st->st_ino != e->ino || st->st_size != e->size ||
+           st->st_mtim.tv_sec != e->mtime.tv_sec || st->st_mtim.tv_nsec != e->mtime.tv_nsec;
+}
+
+// 查找或打开文件，返回的缓存项引用计数加一，用完调用file_cache_put
+// 失败返回NULL并设置errno
+struct file_entry* file_cache_get(const char *name) {
+    unsigned int bucket = file_name_hash(name);
+    time_t now = time(NULL);
+    struct stat st;
+    
+    for (struct file_entry *e = file_buckets[bucket]; e; e = e->hash_next) {
+        if (strcmp(e->name, name) != 0) {
+            continue;
+        }
+        if (now - e->checked >= FILE_CACHE_TTL) {
+            // 定期校验：文件被替换或修改后重新打开
+            if (fstatat(files_dir_fd, name, &st, 0) == -1 || file_entry_stale(e, &st)) {
+                file_cache_evict(e);
+                break;
+            }
+            e->checked = now;
+        }
+        file_lru_unlink(e);
+        file_lru_push_front(e);
+        e->refs++;
+        stats.file_cache_hits++;
+        return e;
+    }
+    
+    stats.file_cache_misses++;
+    int fd = openat(files_dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    struct file_entry *e = calloc(1, sizeof(*e));
+    if (!e) {
+        close(fd);
+        return NULL;
+    }
+    strcpy(e->name, name);
+    e->fd = fd;
+    e->size = st.st_size;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->mtime = st.st_mtim;
+    e->checked = now;
+    e->refs = 1;
+    e->cached = 1;
+    e->hash_next = file_buckets[bucket];
+    file_buckets[bucket] = e;
+    file_lru_push_front(e);
+    file_cache_count++;
+    
+    // 超出容量时淘汰最久未使用的文件
+    if (file_cache_count > FILE_CACHE_SIZE) {
+        file_cache_evict(file_lru_tail);
+    }
+    return e;
+}
+
+// 释放缓存项引用
+void file_cache_put(struct file_entry *entry) {
+    entry->refs--;
+    if (entry->refs == 0 && !entry->cached) {
+        close(entry->fd);
+        free(entry);
+    }
+}
+
+// file命令：回复 "OK <size>\n"（二进制协议为帧头）后用sendfile发送文件内容
+int send_file(struct connection *conn, const char *name, const struct bin_header *req) {
+    char reason[64];
+    int result;
+    
+    if (files_dir_fd == -1) {
+        return send_error_reply(conn, req, "File serving disabled");
+    }
+    if (name[0] == '\0' || strlen(name) > MAX_FILE_NAME || strchr(name, '/') ||
+        strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        // 只允许目录下的文件名，防止路径穿越
+        return send_error_reply(conn, req, "Invalid file name");
+    }
+    
+    struct file_entry *file = file_cache_get(name);
+    if (!file) {
+        snprintf(reason, sizeof(reason), "Cannot open file: %s", strerror(errno));
+        return send_error_reply(conn, req, reason);
+    }
+    
+    if (req && (uint64_t)file->size > UINT32_MAX) {
+        // 二进制帧的长度字段只有32位
+        file_cache_put(file);
+        return send_error_reply(conn, req, "File too large for binary protocol");
+    }
+    
+    if (req) {
+        result = send_binary_reply(conn, req, BIN_STATUS_OK, file->size, NULL, 0);
+    } else {
+        char header[64];
+        snprintf(header, sizeof(header), "OK %lld\n", (long long)file->size);
+        struct iovec iov = { header, strlen(header) };
+        result = connection_sendv(conn, &iov, 1);
+    }
+    if (result == -1 || file->size == 0) {
+        file_cache_put(file);
+        return result == -1 ? -1 : 0;
+    }
+    
+    struct out_chunk *chunk = out_chunk_alloc(0);
+    if (!chunk) {
+        file_cache_put(file);
+        return -1;
+    }
+    chunk->file = file;
+    chunk->len = file->size;
+    printf("Sending file %s (%lld bytes) to fd %d\n", name, (long long)file->size, conn->fd);
+    return connection_send_chunk(conn, chunk) == -1 ? -1 : 0;
+}
+
+// 文本发布/订阅命令: subscribe <channel> [drop|close] / unsubscribe <channel> / publish <channel> <msg>
+int handle_pubsub_text(struct connection *conn, char *line) {
+    char *name = strchr(line, ' ') + 1;
+    char *rest = strchr(name, ' ');
+    size_t name_len = rest ? (size_t)(rest - name) : strlen(name);
+    char reply[32];
+    
+    if (name_len == 0 || name_len > MAX_CHANNEL_NAME) {
+        return send_error_reply(conn, NULL, "Invalid channel name");
+    }
+    
+    if (line[0] == 'p') {
+        if (!rest) {
+            return send_error_reply(conn, NULL, "Usage: publish <channel> <msg>");
+        }
+        if (journal_command(conn, JOURNAL_OP_TEXT, line, strlen(line)) == -1) {
+            return send_error_reply(conn, NULL, "ERROR journal unavailable");
+        }
+        int n = pubsub_publish(conn, name, name_len, rest + 1, strlen(rest + 1));
+        if (n == -1) {
+            return -1;
+        }
+        snprintf(reply, sizeof(reply), "OK %d", n);
+        return send_error_reply(conn, NULL, reply);
+    }
+    if (line[0] == 'u') {
+        return send_error_reply(conn, NULL, pubsub_unsubscribe(conn, name, name_len) ? "OK" : "NOT_FOUND");
+    }
+    
+    if (rest) {
+        if (strcmp(rest + 1, "drop") == 0) {
+            conn->sub_policy = SUB_POLICY_DROP;
+        } else if (strcmp(rest + 1, "close") == 0) {
+            conn->sub_policy = SUB_POLICY_CLOSE;
+        } else {
+            return send_error_reply(conn, NULL, "Usage: subscribe <channel> [drop|close]");
+        }
+    }
+    if (pubsub_subscribe(conn, name, name_len) == -1) {
+        return send_error_reply(conn, NULL, "ERROR out of memory");
+    }
+    return send_error_reply(conn, NULL, "OK");
+}
+
+// 二进制发布/订阅命令，payload格式见enum bin_opcode
+int handle_pubsub_binary(struct connection *conn, const struct bin_header *req, const char *payload) {
+    const unsigned char *p = (const unsigned char*)payload;
+    
+    if (req->opcode == BIN_OP_PUBLISH) {
+        size_t name_len = req->length >= 2 ? (size_t)(p[0] << 8 | p[1]) : 0;
+        if (name_len == 0 || name_len > MAX_CHANNEL_NAME || 2 + name_len > req->length) {
+            return send_error_reply(conn, req, "Invalid publish payload");
+        }
+        if (journal_command(conn, req->opcode, payload, req->length) == -1) {
+            return send_error_reply(conn, req, "Journal unavailable");
+        }
+        int n = pubsub_publish(conn, payload + 2, name_len, payload + 2 + name_len,
+                               req->length - 2 - name_len);
+        if (n == -1) {
+            return -1;
+        }
+        uint32_t net_n = htonl(n);
+        return send_binary_reply(conn, req, BIN_STATUS_OK, 4, &net_n, 4);
+    }
+    
+    if (req->opcode == BIN_OP_UNSUBSCRIBE) {
+        if (req->length == 0 || req->length > MAX_CHANNEL_NAME) {
+            return send_error_reply(conn, req, "Invalid channel name");
+        }
+        return send_binary_reply(conn, req, pubsub_unsubscribe(conn, payload, req->length) ?
+                                 BIN_STATUS_OK : BIN_STATUS_NOT_FOUND, 0, NULL, 0);
+    }
+    
+    if (req->length < 2 || req->length - 1 > MAX_CHANNEL_NAME || p[0] > SUB_POLICY_CLOSE) {
+        return send_error_reply(conn, req, "Invalid subscribe payload");
+    }
+    conn->sub_policy = p[0];
+    if (pubsub_subscribe(conn, payload + 1, req->length - 1) == -1) {
+        return send_error_reply(conn, req, "Out of memory");
+    }
+    return send_binary_reply(conn, req, BIN_STATUS_OK, 0, NULL, 0);
+}
+
+static unsigned int channel_hash(const char *name, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h % CHANNEL_BUCKETS;
+}
+
+// 查找频道，create为真时不存在就创建
+static struct channel* channel_find(const char *name, size_t len, int create) {
+    unsigned int bucket = channel_hash(name, len);
+    for (struct channel *ch = channel_buckets[bucket]; ch; ch = ch->hash_next) {
+        if (ch->name_len == len && memcmp(ch->name, name, len) == 0) {
+            return ch;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    
+    struct channel *ch = calloc(1, sizeof(*ch));
+    if (!ch) {
+        perror("calloc channel");
+        return NULL;
+    }
+    memcpy(ch->name, name, len);
+    ch->name_len = len;
+    ch->hash_next = channel_buckets[bucket];
+    channel_buckets[bucket] = ch;
+    channel_count++;
+    return ch;
+}
+
+// 最后一个订阅者离开时删除频道
+static void channel_free(struct channel *ch) {
+    struct channel **pp = &channel_buckets[channel_hash(ch->name, ch->name_len)];
+    while (*pp != ch) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = ch->hash_next;
+    free(ch->subs);
+    free(ch);
+    channel_count--;
+}
+
+// 删除conn的第idx个订阅：两边都用末尾元素填补空位，并修正被移动元素在对方记录的下标
+static void subscription_remove(struct connection *conn, int idx) {
+    struct subscription sub = conn->subs[idx];
+    struct channel *ch = sub.channel;
+    
+    ch->subs[sub.pos] = ch->subs[--ch->count];
+    if (sub.pos < ch->count) {
+        struct subscriber *moved = &ch->subs[sub.pos];
+        moved->conn->subs[moved->sub_idx].pos = sub.pos;
+    }
+    
+    conn->subs[idx] = conn->subs[--conn->sub_count];
+    if (idx < conn->sub_count) {
+        struct subscription *moved = &conn->subs[idx];
+        moved->channel->subs[moved->pos].sub_idx = idx;
+    }
+    
+    if (ch->count == 0) {
+        channel_free(ch);
+    }
+}
+
+// 订阅频道（已订阅时什么也不做）
+// 返回值: 0=成功, -1=内存不足
+int pubsub_subscribe(struct connection *conn, const char *name, size_t len) {
+    for (int i = 0; i < conn->sub_count; i++) {
+        struct channel *ch = conn->subs[i].channel;
+        if (ch->name_len == len && memcmp(ch->name, name, len) == 0) {
+            return 0;
+        }
+    }
+    
+    struct channel *ch = channel_find(name, len, 1);
+    if (!ch) {
+        return -1;
+    }
+    if (ch->count == ch->cap) {
+        size_t cap = ch->cap ? ch->cap * 2 : 16;
+        struct subscriber *subs = realloc(ch->subs, cap * sizeof(*subs));
+        if (!subs) {
+            perror("realloc channel subscribers");
+            goto fail;
+        }
+        ch->subs = subs;
+        ch->cap = cap;
+    }
+    if (conn->sub_count == conn->sub_cap) {
+        int cap = conn->sub_cap ? conn->sub_cap * 2 : 4;
+        struct subscription *subs = realloc(conn->subs, cap * sizeof(*subs));
+        if (!subs) {
+            perror("realloc subscriptions");
+            goto fail;
+        }
+        conn->subs = subs;
+        conn->sub_cap = cap;
+    }
+    
+    ch->subs[ch->count].conn = conn;
+    ch->subs[ch->count].sub_idx = conn->sub_count;
+    conn->subs[conn->sub_count].channel = ch;
+    conn->subs[conn->sub_count].pos = ch->count;
+    ch->count++;
+    conn->sub_count++;
+    return 0;
+    
+fail:
+    if (ch->count == 0) {
+        channel_free(ch);
+    }
+    return -1;
+}
+
+// 取消订阅，返回1已取消，0未订阅
+int pubsub_unsubscribe(struct connection *conn, const char *name, size_t len) {
+    for (int i = 0; i < conn->sub_count; i++) {
+        struct channel *ch = conn->subs[i].channel;
+        if (ch->name_len == len && memcmp(ch->name, name, len) == 0) {
+            subscription_remove(conn, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 连接关闭时取消所有订阅
+void pubsub_unsubscribe_all(struct connection *conn) {
+    while (conn->sub_count > 0) {
+        subscription_remove(conn, conn->sub_count - 1);
+    }
+    free(conn->subs);
+    conn->subs = NULL;
+    conn->sub_cap = 0;
+}
+
+static void shared_buf_retain(void *ctx) {
+    ((struct shared_buf*)ctx)->refs++;
+}
+
+static void shared_buf_release(void *ctx) {
+    struct shared_buf *buf = ctx;
+    if (--buf->refs == 0) {
+        stats.pubsub_buffers--;
+        free(buf);
+    }
+}
+
+// 生成推送给订阅者的消息：文本为 "message <channel> <msg>\n"，二进制为MESSAGE帧
+static struct shared_buf* pubsub_message_create(int binary, const char *name, size_t name_len,
+                                                const char *msg, size_t msg_len) {
+    size_t len = binary ? BIN_HEADER_SIZE + 2 + name_len + msg_len : 8 + name_len + 1 + msg_len + 1;
+    struct shared_buf *buf = malloc(sizeof(*buf) + len);
+    if (!buf) {
+        perror("malloc shared_buf");
+        return NULL;
+    }
+    stats.pubsub_buffers++;
+    buf->refs = 1;
+    buf->len = len;
+    
+    char *p = buf->data;
+    if (binary) {
+        struct bin_header push = { .opcode = BIN_OP_MESSAGE, .request_id = 0 };
+        bin_header_encode((unsigned char*)p, &push, BIN_STATUS_OK, len - BIN_HEADER_SIZE);
+        p += BIN_HEADER_SIZE;
+        *p++ = name_len >> 8;
+        *p++ = name_len & 0xff;
+        memcpy(p, name, name_len);
+        memcpy(p + name_len, msg, msg_len);
+    } else {
+        memcpy(p, "message ", 8);
+        memcpy(p + 8, name, name_len);
+        p[8 + name_len] = ' ';
+        memcpy(p + 9 + name_len, msg, msg_len);
+        p[len - 1] = '\n';
+    }
+    return buf;
+}
+
+// 发布消息：消息按协议各生成一份，所有订阅者的发送队列引用同一块内存
+// 直接写不完的订阅者只多一个从池里取的数据块头，由各自的EPOLLOUT继续发送
+// 返回值: 收到消息的订阅者数, -1=发布者自己的连接出错
+int pubsub_publish(struct connection *publisher, const char *name, size_t name_len,
+                   const char *msg, size_t msg_len) {
+    static int *victims = NULL;   // 出错或按策略要断开的订阅者，遍历完再断开
+    static size_t victims_cap = 0;
+    size_t victim_count = 0;
+    struct shared_buf *bufs[2] = { NULL, NULL };  // 文本、二进制
+    int delivered = 0;
+    int self_failed = 0;
+    
+    stats.published++;
+    struct channel *ch = channel_find(name, name_len, 0);
+    if (!ch) {
+        return 0;
+    }
+    
+    for (size_t i = 0; i < ch->count; i++) {
+        struct connection *sub = ch->subs[i].conn;
+        int binary = sub->protocol == PROTO_BINARY;
+        int failed = 0;
+        
+        if (sub->out_pending >= SUB_MAX_PENDING) {
+            if (sub->sub_policy == SUB_POLICY_DROP) {
+                sub->sub_dropped++;
+                stats.sub_dropped++;
+                continue;
+            }
+            stats.sub_closed++;
+            failed = 1;
+        } else {
+            if (!bufs[binary]) {
+                bufs[binary] = pubsub_message_create(binary, name, name_len, msg, msg_len);
+                if (!bufs[binary]) {
+                    break;
+                }
+            }
+            struct iovec iov = { bufs[binary]->data, bufs[binary]->len };
+            struct out_ref ref = { shared_buf_retain, shared_buf_release, bufs[binary] };
+            if (connection_sendv_ref(sub, &iov, 1, &ref) == -1) {
+                failed = 1;
+            } else {
+                delivered++;
+            }
+        }
+        
+        if (failed) {
+            if (sub == publisher) {
+                self_failed = 1;
+                continue;
+            }
+            if (victim_count == victims_cap) {
+                size_t cap = victims_cap ? victims_cap * 2 : 64;
+                int *p = realloc(victims, cap * sizeof(*p));
+                if (!p) {
+                    perror("realloc victims");
+                    continue;
+                }
+                victims = p;
+                victims_cap = cap;
+            }
+            victims[victim_count++] = sub->fd;
+        }
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        if (bufs[i]) {
+            shared_buf_release(bufs[i]);
+        }
+    }
+    for (size_t i = 0; i < victim_count; i++) {
+        handle_client_disconnect(victims[i], epoll_fd);
+    }
+    stats.deliveries += delivered;
+    return self_failed ? -1 : delivered;
+}
+
+// 解析后端地址 host:port
+int resolve_backend(const char *spec) {
+    char host[256];
+    const char *sep = strrchr(spec, ':');
+    if (!sep || sep == spec || (size_t)(sep - spec) >= sizeof(host)) {
+        fprintf(stderr, "Invalid backend address: %s (expected host:port)\n", spec);
+        return -1;
+    }
+    memcpy(host, spec, sep - spec);
+    host[sep - spec] = '\0';
+    
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host, sep + 1, &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "Cannot resolve backend %s: %s\n", spec, gai_strerror(rc));
+        return -1;
+    }
+    memcpy(&backend_addr, res->ai_addr, res->ai_addrlen);
+    backend_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+// 注册代理连接：两个方向都常驻EPOLLIN|EPOLLOUT（边沿触发），背压由管道满/空自然形成
+static int proxy_register(int fd) {
+    return interest_set(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+}
+
+// 为客户端连接建立到后端的连接和两个方向的管道
+int proxy_attach(struct connection *client) {
+    int backend_fd = socket(backend_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (backend_fd == -1) {
+        perror("socket backend");
+        return -1;
+    }
+    
+    int connecting = 0;
+    if (connect(backend_fd, (struct sockaddr*)&backend_addr, backend_addr_len) == -1) {
+        if (errno != EINPROGRESS) {
+            perror("connect backend");
+            close(backend_fd);
+            return -1;
+        }
+        connecting = 1;
+    }
+    
+    struct connection *backend = connection_create(backend_fd, client->profile);
+    if (!backend) {
+        close(backend_fd);
+        return -1;
+    }
+    backend->connecting = connecting;
+    
+    if (pipe2(client->pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1 ||
+        pipe2(backend->pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        perror("pipe2");
+        connection_destroy(backend_fd);
+        close(backend_fd);
+        return -1;
+    }
+    client->peer_fd = backend_fd;
+    backend->peer_fd = client->fd;
+    
+    if (proxy_register(client->fd) == -1) {
+        connection_destroy(backend_fd);
+        close(backend_fd);
+        return -1;
+    }
+    if (proxy_register(backend_fd) == -1) {
+        interest_forget(client->fd);
+        connection_destroy(backend_fd);
+        close(backend_fd);
+        return -1;
+    }
+    
+    stats.proxy_sessions++;
+    printf("Proxying fd %d <-> backend fd %d\n", client->fd, backend_fd);
+    return 0;
+}
+
+// 把src读到的数据经src的管道搬到dst：socket -> pipe -> socket，全程不进用户空间
+// 管道满时停止读src（数据留在内核接收缓冲区，TCP窗口自然收缩），
+// dst不可写时停止写，等dst的EPOLLOUT再继续
+// 返回值: 0=正常, -1=出错需要关闭这一对连接
+static int proxy_pump(struct connection *src, struct connection *dst) {
+    while (1) {
+        // 先把管道里的数据送到对端
+        while (src->pipe_bytes > 0) {
+            if (dst->connecting) {
+                return 0;
+            }
+            prof_syscall(SYS_SPLICE);
+            ssize_t n = splice(src->pipe_fds[0], NULL, dst->fd, NULL, src->pipe_bytes,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0;
+                }
+                perror("splice to peer");
+                return -1;
+            }
+            src->pipe_bytes -= n;
+            stats.proxy_bytes += n;
+        }
+        
+        if (src->read_eof) {
+            // 数据全部转发完，把半关闭传给对端
+            if (!src->peer_shut && !dst->connecting) {
+                shutdown(dst->fd, SHUT_WR);
+                src->peer_shut = 1;
+            }
+            return 0;
+        }
+        
+        prof_syscall(SYS_SPLICE);
+        ssize_t n = splice(src->fd, NULL, src->pipe_fds[1], NULL, PROXY_SPLICE_SIZE,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            src->read_eof = 1;
+        } else if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            perror("splice from socket");
+            return -1;
+        } else {
+            src->pipe_bytes += n;
+        }
+    }
+}
+
+// 处理代理连接上的事件
+void handle_proxy_event(struct connection *conn, uint32_t events) {
+    struct connection *peer = connection_get(conn->peer_fd);
+    if (!peer) {
+        return;
+    }
+    
+    if (conn->connecting) {
+        // 非阻塞connect完成（成功或失败）
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+            fprintf(stderr, "Backend connect failed: %s\n", strerror(err ? err : errno));
+            proxy_close(conn);
+            return;
+        }
+        if (!(events & EPOLLOUT)) {
+            return;
+        }
+        conn->connecting = 0;
+    }
+    
+    if (events & EPOLLERR) {
+        printf("Proxy error on fd %d\n", conn->fd);
+        proxy_close(conn);
+        return;
+    }
+    
+    // 可读：conn -> peer；可写：继续 peer -> conn
+    if (((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && proxy_pump(conn, peer) == -1) ||
+        ((events & EPOLLOUT) && proxy_pump(peer, conn) == -1)) {
+        proxy_close(conn);
+        return;
+    }
+    
+    // 两个方向都已结束
+    if (conn->peer_shut && peer->peer_shut) {
+        proxy_close(conn);
+    }
+}
+
+// 关闭代理连接对
+void proxy_close(struct connection *conn) {
+    int fds[2] = { conn->fd, conn->peer_fd };
+    printf("Closing proxy fds %d <-> %d\n", fds[0], fds[1]);
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] == -1 || !connection_get(fds[i])) {
+            continue;
+        }
+        interest_forget(fds[i]);
+        connection_destroy(fds[i]);
+        close(fds[i]);
+    }
+}
+
+// 进程常驻内存（KB），读/proc/self/statm；读不到返回0
+static long process_rss_kb(void) {
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    long size;
+    if (fscanf(f, "%ld %ld", &size, &pages) != 2) {
+        pages = 0;
+    }
+    fclose(f);
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// 所有连接发送队列里尚未发出的字节数（用户态，不含内核发送缓冲区）
+static unsigned long long total_out_pending(void) {
+    unsigned long long total = 0;
+    for (int fd = 0; fd < connections_size; fd++) {
+        if (connections[fd]) {
+            total += connections[fd]->out_pending;
+        }
+    }
+    return total;
+}
+
+// 处理消息并生成回复
+void process_message(const char* request, char* response, int response_size) {
+    if (strlen(request) == 0) {
+        snprintf(response, response_size, "Empty message received\n");
+        return;
+    }
+    
+    // 简单的命令处理
+    if (strcmp(request, "ping") == 0) {
+        snprintf(response, response_size, "pong\n");
+    } else if (strcmp(request, "time") == 0) {
+        time_t now = time(NULL);
+        struct tm *tm_info = localtime(&now);
+        snprintf(response, response_size, "Current time: %04d-%02d-%02d %02d:%02d:%02d\n",
+                tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
+                tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
+    } else if (strcmp(request, "quit") == 0 || strcmp(request, "exit") == 0) {
+        snprintf(response, response_size, "Goodbye!\n");
+    } else if (strncmp(request, "echo ", 5) == 0) {
+        snprintf(response, response_size, "%s\n", request + 5);
+    } else if (strcmp(request, "stats") == 0) {
+        struct kv_stats kvs;
+        struct coro_stats cos;
+        struct capture_stats caps = { 0 };
+        struct journal_stats js = { 0 };
+        kv_get_stats(kv, &kvs);
+        coro_get_stats(&cos);
+        if (capture) {
+            capture_get_stats(capture, &caps);
+        }
+        if (journal) {
+            journal_get_stats(journal, &js);
+        }
+        snprintf(response, response_size,
+                "connections: accepted=%llu active=%llu\n"
+                "zerocopy: sends=%llu hits=%llu misses=%llu fallbacks=%llu lingering=%d\n"
+                "files: cache_hits=%llu cache_misses=%llu cached=%d sendfile_bytes=%llu\n"
+                "proxy: sessions=%llu bytes=%llu\n"
+                "kv: items=%zu retained=%zu mem_used=%zu mem_limit=%zu table=%zu%s hits=%llu misses=%llu evictions=%llu\n"
+                "pubsub: channels=%d published=%llu deliveries=%llu dropped=%llu slow_closed=%llu buffers=%d\n"
+                "offload: threads=%d submitted=%llu cancelled=%llu\n"
+                "coroutines: active=%d started=%llu cancelled=%llu stacks=%d switches=%llu\n"
+                "tcp: samples=%llu slow_consumers=%d flagged=%llu\n"
+                "capture: %s connections=%llu records=%llu bytes=%llu file_bytes=%llu\n"
+                "shm: sessions=%d total=%llu requests=%llu bells_sent=%llu bells_received=%llu\n"
+                "http: requests=%llu errors=%llu\n"
+                "journal: %s%s interval_ms=%d records=%llu synced=%llu fsyncs=%llu max_batch=%llu avg_fsync_us=%llu dropped=%llu errors=%llu waiting=%llu\n"
+                "epoll: epollout=%s ctl_add=%llu ctl_mod=%llu ctl_del=%llu skipped=%llu requests=%llu ctl_per_request=%.3f\n"
+                "priority: %s passes=%llu events=%llu\n"
+                "memory: rss_kb=%ld out_pending=%llu chunk_pool=%d\n",
+                stats.connections_accepted, stats.connections_active,
+                stats.zerocopy_sends, stats.zerocopy_hits,
+                stats.zerocopy_misses, stats.zerocopy_fallbacks, stats.zerocopy_lingering,
+                stats.file_cache_hits, stats.file_cache_misses, file_cache_count,
+                stats.sendfile_bytes, stats.proxy_sessions, stats.proxy_bytes,
+                kvs.items, kvs.retained, kvs.mem_used, kvs.mem_limit, kvs.table_capacity,
+                kvs.rehashing ? "(rehashing)" : "", kvs.hits, kvs.misses, kvs.evictions,
+                channel_count, stats.published, stats.deliveries, stats.sub_dropped, stats.sub_closed, stats.pubsub_buffers,
+                workers ? worker_threads : 0, stats.jobs_submitted, stats.jobs_cancelled,
+                cos.active, stats.coroutines_started, stats.coroutines_cancelled, cos.stacks, cos.switches,
+                stats.tcp_samples, stats.slow_consumers, stats.slow_consumers_flagged,
+                capture ? "on" : "off", caps.connections, caps.records, caps.bytes, caps.file_bytes,
+                shm_session_count, stats.shm_sessions, stats.shm_requests, stats.shm_bells_sent,
+                stats.shm_bells_received, stats.http_requests, stats.http_errors,
+                journal ? journal_path : "off", js.failed ? " (failed)" : "", journal_interval_ms, js.records, js.synced_records, js.batches, js.max_batch,
+                js.batches ? js.sync_us / js.batches : 0, js.dropped, js.errors, stats.journal_waits,
+                epollout_always ? "always" : "on-demand", stats.epoll_ctl_add, stats.epoll_ctl_mod,
+                stats.epoll_ctl_del, stats.epoll_ctl_skipped, stats.requests,
+                stats.requests ? (double)(stats.epoll_ctl_add + stats.epoll_ctl_mod + stats.epoll_ctl_del) / stats.requests : 0.0,
+                prio_epoll_fd != -1 ? "on" : "off", stats.priority_passes, stats.priority_events,
+                process_rss_kb(), total_out_pending(), out_chunk_pool_count);
+    } else if (strcmp(request, "help") == 0) {
+        snprintf(response, response_size, 
+                "Available commands:\n"
+                "  ping     - responds with pong\n"
+                "  time     - shows current time\n"
+                "  echo <msg> - echoes your message\n"
+                "  large    - sends 10MB of data\n"
+                "  file <name> - sends a file from the served directory\n"
+                "  set <key> <value> - stores a value\n"
+                "  get <key> - returns the value or (nil)\n"
+                "  del <key> - removes a key\n"
+                "  mget <key>... - returns one line per key\n"
+                "  subscribe <channel> [drop|close] - receive messages published to channel\n"
+                "  unsubscribe <channel>\n"
+                "  publish <channel> <msg> - sends msg to every subscriber\n"
+                "  upload <n> - reads n raw bytes after the line, replies OK <n> <fnv1a64>\n"
+                "  stream <n> - sends n bytes of generated data\n"
+                "  stats    - shows server counters\n"
+                "  conns    - lists connections with RTT, cwnd and queue sizes\n"
+                "  profile [on|off|reset] - event loop time per phase and syscalls per request\n"
+                "  durable on|off - reply to set/del/publish only after the journal is synced\n"
+                "  help     - shows this help\n"
+                "  quit/exit - disconnect\n");
+    } else {
+        // 默认回声
+        snprintf(response, response_size, "Echo: %s\n", request);
+    }
+}
+
+// 创建TCP状态采样的周期定时器
+int create_sample_timer(void) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        perror("timerfd_create");
+        return -1;
+    }
+    struct itimerspec its;
+    its.it_interval.tv_sec = TCP_SAMPLE_INTERVAL_MS / 1000;
+    its.it_interval.tv_nsec = (TCP_SAMPLE_INTERVAL_MS % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(fd, 0, &its, NULL) == -1) {
+        perror("timerfd_settime");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void histogram_add(struct histogram *h, unsigned long long value) {
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+    h->counts[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1]++;
+}
+
+// 定时器到期：从上次的位置开始轮流采样，每次最多TCP_SAMPLE_BATCH个连接
+void tcp_sample_tick(void) {
+    uint64_t expirations;
+    if (read(sample_timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        perror("read timerfd");
+    }
+    
+    int sampled = 0;
+    for (int scanned = 0; scanned < connections_size && sampled < TCP_SAMPLE_BATCH; scanned++) {
+        if (sample_cursor >= connections_size) {
+            sample_cursor = 0;
+        }
+        struct connection *conn = connections[sample_cursor++];
+        if (conn && !conn->connecting) {
+            tcp_sample_connection(conn);
+            sampled++;
+        }
+    }
+}
+
+// 采样一个连接的TCP_INFO和内核队列长度，更新直方图和慢消费者标记
+// 慢消费者：用户态发送队列加内核未确认的字节连续多次超过阈值；
+// 这时再看RTT和重传：RTT正常、没有重传说明是对端读得慢，否则是网络慢
+void tcp_sample_connection(struct connection *conn) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    
+    if (getsockopt(conn->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1) {
+        return;
+    }
+    if (ioctl(conn->fd, SIOCOUTQ, &conn->sample.outq) == -1) {
+        conn->sample.outq = 0;
+    }
+    if (ioctl(conn->fd, SIOCINQ, &conn->sample.inq) == -1) {
+        conn->sample.inq = 0;
+    }
+    
+    uint32_t new_retrans = conn->sample.at ? info.tcpi_total_retrans - conn->sample.total_retrans
+                                           : info.tcpi_total_retrans;
+    conn->sample.at = time(NULL);
+    conn->sample.rtt_us = info.tcpi_rtt;
+    conn->sample.rttvar_us = info.tcpi_rttvar;
+    conn->sample.snd_cwnd = info.tcpi_snd_cwnd;
+    conn->sample.total_retrans = info.tcpi_total_retrans;
+    
+    stats.tcp_samples++;
+    histogram_add(&stats.rtt_hist, info.tcpi_rtt);
+    histogram_add(&stats.outq_hist, conn->sample.outq);
+    histogram_add(&stats.retrans_hist, new_retrans);
+    
+    if (conn->out_pending + conn->sample.outq >= SLOW_CONSUMER_BYTES) {
+        if (++conn->slow_samples >= SLOW_CONSUMER_SAMPLES && !conn->slow_consumer) {
+            conn->slow_consumer = 1;
+            stats.slow_consumers++;
+            stats.slow_consumers_flagged++;
+            printf("Slow consumer on fd %d: pending=%zu unacked=%d rtt=%uus retrans=%u\n",
+                   conn->fd, conn->out_pending, conn->sample.outq, conn->sample.rtt_us,
+                   conn->sample.total_retrans);
+        }
+    } else {
+        conn->slow_samples = 0;
+        if (conn->slow_consumer) {
+            conn->slow_consumer = 0;
+            stats.slow_consumers--;
+        }
+    }
+}
+
+// conns命令的输出长度不定，用可增长的缓冲区拼接
+struct text_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static void text_printf(struct text_buf *tb, const char *fmt, ...) {
+    va_list ap;
+    while (tb->data) {
+        va_start(ap, fmt);
+        int n = vsnprintf(tb->data + tb->len, tb->cap - tb->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return;
+        }
+        if ((size_t)n < tb->cap - tb->len) {
+            tb->len += n;
+            return;
+        }
+        char *data = realloc(tb->data, tb->cap * 2 + n);
+        if (!data) {
+            perror("realloc text_buf");
+            free(tb->data);
+            tb->data = NULL;
+            return;
+        }
+        tb->data = data;
+        tb->cap = tb->cap * 2 + n;
+    }
+}
+
+static void text_histogram(struct text_buf *tb, const char *name, const struct histogram *h) {
+    text_printf(tb, "%s:", name);
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (h->counts[i]) {
+            text_printf(tb, " <%llu:%llu", 1ULL << i, h->counts[i]);
+        }
+    }
+    text_printf(tb, "\n");
+}
+
+// conns命令：汇总直方图 + 每个连接最近一次采样
+// outq/inq是内核队列，pending是本进程发送队列；SLOW标记慢消费者
+int send_conns_listing(struct connection *conn, const struct bin_header *req) {
+    struct text_buf tb = { malloc(BUFFER_SIZE), 0, BUFFER_SIZE };
+    if (!tb.data) {
+        perror("malloc text_buf");
+        return send_error_reply(conn, req, "Memory allocation failed");
+    }
+    
+    text_printf(&tb, "connections=%llu samples=%llu slow_consumers=%d\n",
+                stats.connections_active, stats.tcp_samples, stats.slow_consumers);
+    text_histogram(&tb, "rtt_us", &stats.rtt_hist);
+    text_histogram(&tb, "unacked_bytes", &stats.outq_hist);
+    text_histogram(&tb, "retrans_per_sample", &stats.retrans_hist);
+    text_printf(&tb, "%-6s %-21s %9s %9s %6s %7s %9s %9s %9s %s\n", "fd", "peer", "rtt_us",
+                "rttvar_us", "cwnd", "retrans", "outq", "inq", "pending", "age_s");
+    
+    time_t now = time(NULL);
+    for (int fd = 0; fd < connections_size; fd++) {
+        struct connection *c = connections[fd];
+        if (!c) {
+            continue;
+        }
+        char peer[INET6_ADDRSTRLEN + 8] = "-";
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        if (getpeername(fd, (struct sockaddr*)&addr, &addr_len) == 0 && addr.ss_family == AF_INET) {
+            struct sockaddr_in *in = (struct sockaddr_in*)&addr;
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+            snprintf(peer, sizeof(peer), "%s:%d", ip, ntohs(in->sin_port));
+        }
+        if (!c->sample.at) {
+            text_printf(&tb, "%-6d %-21s %9s\n", fd, peer, "unsampled");
+            continue;
+        }
+        text_printf(&tb, "%-6d %-21s %9u %9u %6u %7u %9d %9d %9zu %lld%s%s\n", fd, peer,
+                    c->sample.rtt_us, c->sample.rttvar_us, c->sample.snd_cwnd,
+                    c->sample.total_retrans, c->sample.outq, c->sample.inq, c->out_pending,
+                    (long long)(now - c->sample.at), c->peer_fd != -1 ? " proxy" : "",
+                    c->slow_consumer ? " SLOW" : "");
+    }
+    if (!tb.data) {
+        return send_error_reply(conn, req, "Memory allocation failed");
+    }
+    
+    int result;
+    if (req) {
+        result = send_binary_reply(conn, req, BIN_STATUS_OK, tb.len, tb.data, tb.len);
+    } else {
+        struct iovec iov = { tb.data, tb.len };
+        result = connection_sendv(conn, &iov, 1) == -1 ? -1 : 0;
+    }
+    free(tb.data);
+    return result;
+}
+
+// 校准时钟频率并开始计时（rdtsc的单位是时钟周期，需要换算成微秒）
+void profile_start(void) {
+    if (prof_ticks_per_us == 0) {
+        struct timespec t0, t1, pause = { 0, 20 * 1000000L };
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t c0 = prof_clock();
+        nanosleep(&pause, NULL);
+        uint64_t c1 = prof_clock();
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double us = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+        prof_ticks_per_us = (c1 - c0) / us;
+    }
+    memset(&prof, 0, sizeof(prof));
+    prof.phase = PROF_OTHER;
+    prof.started = prof.mark = prof_clock();
+    profiling = 1;
+}
+
+// 每次epoll_wait返回：统计唤醒次数和每次取到的事件数
+void profile_wakeup(int nfds) {
+    if (!profiling) {
+        return;
+    }
+    prof.syscalls[SYS_EPOLL_WAIT]++;
+    if (nfds < 0) {
+        return;
+    }
+    prof.wakeups++;
+    prof.events += nfds;
+    if (nfds == MAX_EVENTS) {
+        prof.saturated++;
+    }
+    histogram_add(&prof.events_hist, nfds);
+}
+
+static const char *prof_phase_names[PROF_PHASES] = {
+    "epoll_wait", "accept", "read", "process", "write", "proxy", "other",
+};
+
+static const char *prof_syscall_names[SYS_KINDS] = {
+    "epoll_wait", "epoll_ctl", "accept", "read", "write", "setsockopt", "splice", "other",
+};
+
+// 输出各阶段耗时、每次唤醒的事件数分布、每个请求的系统调用数
+static void profile_report(struct text_buf *tb) {
+    if (prof.started == 0) {
+        text_printf(tb, "profiling is off (start with -p or profile on)\n");
+        return;
+    }
+    
+    // 把当前阶段到现在的时间也算上
+    uint64_t now = prof_clock();
+    uint64_t ticks[PROF_PHASES];
+    memcpy(ticks, prof.ticks, sizeof(ticks));
+    if (profiling) {
+        ticks[prof.phase] += now - prof.mark;
+    }
+    double total_us = 0;
+    for (int i = 0; i < PROF_PHASES; i++) {
+        total_us += ticks[i] / prof_ticks_per_us;
+    }
+    
+    text_printf(tb, "profile: %s, %.3f s measured, %.0f clock ticks/us\n",
+                profiling ? "on" : "off", total_us / 1e6, prof_ticks_per_us);
+    text_printf(tb, "%-11s %12s %7s %12s %10s\n", "phase", "ms", "%", "entries", "avg_us");
+    for (int i = 0; i < PROF_PHASES; i++) {
+        double us = ticks[i] / prof_ticks_per_us;
+        text_printf(tb, "%-11s %12.3f %6.2f%% %12llu %10.3f\n", prof_phase_names[i], us / 1e3,
+                    total_us > 0 ? us * 100 / total_us : 0.0, prof.entries[i],
+                    prof.entries[i] ? us / prof.entries[i] : 0.0);
+    }
+    
+    text_printf(tb, "wakeups=%llu events=%llu events_per_wakeup=%.2f max_events=%d saturated=%llu\n",
+                prof.wakeups, prof.events, prof.wakeups ? (double)prof.events / prof.wakeups : 0.0,
+                MAX_EVENTS, prof.saturated);
+    text_histogram(tb, "events_per_wakeup", &prof.events_hist);
+    
+    unsigned long long total_syscalls = 0;
+    for (int i = 0; i < SYS_KINDS; i++) {
+        total_syscalls += prof.syscalls[i];
+    }
+    text_printf(tb, "requests=%llu syscalls=%llu per_request=%.2f\n", prof.requests, total_syscalls,
+                prof.requests ? (double)total_syscalls / prof.requests : 0.0);
+    for (int i = 0; i < SYS_KINDS; i++) {
+        text_printf(tb, "  %-11s %12llu %8.2f/request\n", prof_syscall_names[i], prof.syscalls[i],
+                    prof.requests ? (double)prof.syscalls[i] / prof.requests : 0.0);
+    }
+}
+
+// SIGUSR1：输出到日志
+void profile_dump(FILE *out) {
+    struct text_buf tb = { malloc(BUFFER_SIZE), 0, BUFFER_SIZE };
+    if (!tb.data) {
+        perror("malloc text_buf");
+        return;
+    }
+    profile_report(&tb);
+    if (tb.data) {
+        fwrite(tb.data, 1, tb.len, out);
+        free(tb.data);
+    }
+}
+
+// profile [on|off|reset]：不带参数时输出报告
+int handle_profile_text(struct connection *conn, char *line) {
+    const char *arg = line[7] == ' ' ? line + 8 : "";
+    
+    if ((strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0 || strcmp(arg, "reset") == 0) &&
+        journal_command(conn, JOURNAL_OP_TEXT, line, strlen(line)) == -1) {
+        return send_error_reply(conn, NULL, "ERROR journal unavailable");
+    }
+    if (strcmp(arg, "on") == 0 || strcmp(arg, "reset") == 0) {
+        profile_start();
+        return send_error_reply(conn, NULL, "OK");
+    }
+    if (strcmp(arg, "off") == 0) {
+        // 停止前把当前阶段的时间结算掉，报告保留
+        prof_leave(prof.phase);
+        profiling = 0;
+        return send_error_reply(conn, NULL, "OK");
+    }
+    if (*arg) {
+        return send_error_reply(conn, NULL, "Usage: profile [on|off|reset]");
+    }
+    
+    struct text_buf tb = { malloc(BUFFER_SIZE), 0, BUFFER_SIZE };
+    if (!tb.data) {
+        perror("malloc text_buf");
+        return send_error_reply(conn, NULL, "Memory allocation failed");
+    }
+    profile_report(&tb);
+    if (!tb.data) {
+        return send_error_reply(conn, NULL, "Memory allocation failed");
+    }
+    struct iovec iov = { tb.data, tb.len };
+    int result = connection_sendv(conn, &iov, 1) == -1 ? -1 : 0;
+    free(tb.data);
+    return result;
+}
+
+// 共享内存传输的Unix socket：客户端连上后拿到memfd和门铃，之后的请求都不经过socket
+int shm_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket AF_UNIX");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    // 上次没有正常退出留下的socket文件；热升级时新进程在这里接管路径
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("bind AF_UNIX");
+        close(fd);
+        return -1;
+    }
+    shm_path_owned = 1;
+    // 单CPU时轮询只会抢走客户端的时间片，只用门铃
+    shm_spin_enabled = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    if (listen(fd, LISTEN_BACKLOG) == -1) {
+        perror("listen AF_UNIX");
+        close(fd);
+        return -1;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl ADD shm listener");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 为新客户端建立memfd和两个门铃，经SCM_RIGHTS交给客户端
+static int shm_session_open(int ctl_fd) {
+    struct shm_session *ss = &shm_sessions[shm_session_count];
+    int memfd = memfd_create("epoll_server_shm", MFD_CLOEXEC);
+    if (memfd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+    if (ftruncate(memfd, sizeof(struct shm_channel)) == -1) {
+        perror("ftruncate memfd");
+        close(memfd);
+        return -1;
+    }
+    ss->ch = mmap(NULL, sizeof(struct shm_channel), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (ss->ch == MAP_FAILED) {
+        perror("mmap memfd");
+        close(memfd);
+        return -1;
+    }
+    ss->ch->magic = SHM_MAGIC;
+    ss->ch->version = SHM_VERSION;
+    // 服务器读自己的门铃（非阻塞，由epoll通知）；客户端的门铃由客户端阻塞读取
+    ss->server_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ss->client_bell = eventfd(0, EFD_CLOEXEC);
+    ss->ctl_fd = ctl_fd;
+    if (ss->server_bell == -1 || ss->client_bell == -1) {
+        perror("eventfd");
+        goto fail;
+    }
+    
+    int fds[3] = { memfd, ss->server_bell, ss->client_bell };
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    char version = SHM_VERSION;
+    struct iovec iov = { .iov_base = &version, .iov_len = 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    if (sendmsg(ctl_fd, &msg, MSG_NOSIGNAL) == -1) {
+        perror("sendmsg shm fds");
+        goto fail;
+    }
+    close(memfd);
+    
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = ctl_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctl_fd, &event) == -1) {
+        perror("epoll_ctl ADD shm ctl");
+        memfd = -1;
+        goto fail;
+    }
+    event.events = EPOLLIN;
+    event.data.fd = ss->server_bell;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ss->server_bell, &event) == -1) {
+        perror("epoll_ctl ADD shm bell");
+        memfd = -1;
+        goto fail;
+    }
+    shm_session_count++;
+    stats.shm_sessions++;
+    return 0;
+    
+fail:
+    if (memfd != -1) {
+        close(memfd);
+    }
+    if (ss->server_bell != -1) {
+        close(ss->server_bell);
+    }
+    if (ss->client_bell != -1) {
+        close(ss->client_bell);
+    }
+    munmap(ss->ch, sizeof(struct shm_channel));
+    return -1;
+}
+
+void shm_accept(void) {
+    while (1) {
+        int fd = accept4(shm_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept AF_UNIX");
+            }
+            return;
+        }
+        if (draining || shm_session_count == SHM_MAX_SESSIONS || shm_session_open(fd) == -1) {
+            if (shm_session_count == SHM_MAX_SESSIONS) {
+                fprintf(stderr, "Too many shared-memory clients (max %d)\n", SHM_MAX_SESSIONS);
+            }
+            close(fd);
+            continue;
+        }
+        printf("Shared-memory client connected (session %d)\n", shm_session_count - 1);
+    }
+}
+
+// 会话很少，线性查找即可；门铃和控制socket都映射到同一个会话
+int shm_session_find(int fd) {
+    for (int i = 0; i < shm_session_count; i++) {
+        if (shm_sessions[i].ctl_fd == fd || shm_sessions[i].server_bell == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void shm_session_event(int idx, int fd) {
+    struct shm_session *ss = &shm_sessions[idx];
+    if (fd == ss->ctl_fd) {
+        // 客户端不会经控制socket发数据，可读就是EOF或出错
+        printf("Shared-memory client disconnected (session %d)\n", idx);
+        shm_session_close(idx);
+        return;
+    }
+    uint64_t count;
+    if (read(ss->server_bell, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("read shm bell");
+    }
+    stats.shm_bells_received++;
+    shm_poll();
+}
+
+// close会自动把fd从epoll中移除；最后一个会话移到空出来的位置
+void shm_session_close(int idx) {
+    struct shm_session *ss = &shm_sessions[idx];
+    close(ss->ctl_fd);
+    close(ss->server_bell);
+    close(ss->client_bell);
+    munmap(ss->ch, sizeof(struct shm_channel));
+    shm_sessions[idx] = shm_sessions[--shm_session_count];
+}
+
+static uint64_t shm_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 处理所有会话里已有的请求，命令分发和process_message一致；返回处理的请求数
+// 回复队列快满时先不取请求，等客户端取走回复
+int shm_poll(void) {
+    char request[SHM_MAX_MSG + 1];
+    char response[BUFFER_SIZE];
+    int handled = 0;
+    
+    for (int i = 0; i < shm_session_count; i++) {
+        struct shm_session *ss = &shm_sessions[i];
+        int pushed = 0;
+        while (shm_ring_has_room(&ss->ch->replies)) {
+            int len = shm_ring_pop(&ss->ch->requests, request, SHM_MAX_MSG);
+            if (len == -1) {
+                break;
+            }
+            request[len] = '\0';
+            prof_request();
+            process_message(request, response, sizeof(response));
+            shm_ring_push(&ss->ch->replies, response, strlen(response));
+            pushed++;
+        }
+        if (pushed > 0) {
+            handled += pushed;
+            if (shm_ring_need_wake(&ss->ch->replies)) {
+                uint64_t one = 1;
+                if (write(ss->client_bell, &one, sizeof(one)) == -1) {
+                    perror("write shm bell");
+                }
+                stats.shm_bells_sent++;
+            }
+        }
+    }
+    if (handled > 0) {
+        stats.shm_requests += handled;
+        if (shm_spin_enabled) {
+            shm_poll_until = shm_now_us() + SHM_POLL_US;
+        }
+    }
+    return handled;
+}
+
+// 轮询模式：连续轮询最多SHM_SPIN_US，期间客户端不需要敲门铃，往返不经过系统调用
+void shm_spin(void) {
+    uint64_t now = shm_now_us();
+    uint64_t until = now + SHM_SPIN_US;
+    while (now < shm_poll_until && now < until) {
+        if (shm_poll() == 0) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        now = shm_now_us();
+    }
+}
+
+// epoll_wait之前：轮询模式下不睡眠（门铃也不需要）；
+// 否则告诉客户端服务器要睡了，之后的请求要敲门铃；睡前队列里还有请求就不睡
+int shm_wait_ms(int timeout) {
+    int poll_mode = shm_now_us() < shm_poll_until;
+    int pending = 0;
+    for (int i = 0; i < shm_session_count; i++) {
+        struct shm_ring *requests = &shm_sessions[i].ch->requests;
+        if (poll_mode || pending) {
+            shm_ring_awake(requests);
+        } else if (!shm_ring_prepare_sleep(requests)) {
+            pending = 1;
+        }
+    }
+    if (pending) {
+        // 睡前发现有请求（客户端看到我们醒着，没敲门铃）：先处理掉，这一轮不睡
+        for (int i = 0; i < shm_session_count; i++) {
+            shm_ring_awake(&shm_sessions[i].ch->requests);
+        }
+        shm_poll();
+        return 0;
+    }
+    return poll_mode ? 0 : timeout;
+}
+
+// 屏蔽SIGINT/SIGTERM并创建signalfd，信号作为普通的可读事件在事件循环里处理
+// 不再需要信号处理函数（其中调用printf并不安全），epoll_wait也不用靠超时发现退出
+int create_signalfd(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);  // 输出事件循环分阶段计时
+    sigaddset(&mask, SIGUSR2);  // 热升级
+    sigaddset(&mask, SIGCHLD);  // 回收启动失败的新进程
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("sigprocmask");
+        return -1;
+    }
+    
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) {
+        perror("signalfd");
+    }
+    return fd;
+}
+
+// 读取signalfd：第一次退出信号开始排空，排空中再收到则立即退出；SIGUSR2开始热升级
+void handle_signal_event(void) {
+    struct signalfd_siginfo info;
+    
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) {
+            pid_t pid;
+            int status;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                printf("Child process %d exited (status %d)\n", (int)pid, status);
+            }
+            continue;
+        }
+        if (info.ssi_signo == SIGUSR1) {
+            profile_dump(stdout);
+            fflush(stdout);
+            continue;
+        }
+        if (info.ssi_signo == SIGUSR2) {
+            upgrade_start();
+            continue;
+        }
+        printf("\nReceived signal %u, ", info.ssi_signo);
+        if (!draining && drain_timeout > 0) {
+            printf("draining connections (up to %d s)...\n", drain_timeout);
+            drain_start();
+        } else {
+            printf("shutting down now...\n");
+            running = 0;
+        }
+    }
+}
+
+// 开始排空：关闭监听socket，不再接受新连接
+void drain_start(void) {
+    draining = 1;
+    clock_gettime(CLOCK_MONOTONIC, &drain_deadline);
+    drain_deadline.tv_sec += drain_timeout;
+    
+    // 热升级时新进程还持有同一个监听socket，close不会把它从epoll中移除，
+    // 老进程会继续被新进程接受的连接唤醒，事件还会落到已关闭、可能被复用的fd号上，所以先显式DEL
+    for (int i = 0; i < listener_count; i++) {
+        int set = listeners[i].profile->priority ? prio_epoll_fd : epoll_fd;
+        if (epoll_ctl(set, EPOLL_CTL_DEL, listeners[i].fd, NULL) == -1) {
+            perror("epoll_ctl DEL listen_fd");
+        }
+        close(listeners[i].fd);
+    }
+    listener_count = 0;
+    if (shm_listen_fd != -1) {
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, shm_listen_fd, NULL) == -1) {
+            perror("epoll_ctl DEL shm_listen_fd");
+        }
+        close(shm_listen_fd);
+        shm_listen_fd = -1;
+    }
+}
+
+// epoll_wait的超时：不超过排空期限，并且每DRAIN_POLL_MS检查一次已半关闭的连接是否被确认
+int drain_wait_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ms = (drain_deadline.tv_sec - now.tv_sec) * 1000LL +
+                   (drain_deadline.tv_nsec - now.tv_nsec) / 1000000;
+    if (ms < 0) {
+        return 0;
+    }
+    return ms < DRAIN_POLL_MS ? (int)ms : DRAIN_POLL_MS;
+}
+
+// 检查所有连接：回复全部交给内核后shutdown(SHUT_WR)，内核发完数据后发FIN，
+// 等对端确认了所有数据（SIOCOUTQ为0）或者对端关闭（EPOLLRDHUP）时再关闭；
+// 数据还在发送缓冲区时直接close，接收缓冲区里有未读数据或对端再发数据都会引起RST，
+// 对端可能丢掉还没读到的回复
+// 代理连接在两个方向的管道都为空时关闭
+// 返回值: 还在等待的连接数，期限已到时返回0
+int drain_poll(void) {
+    if (drain_wait_ms() == 0) {
+        return 0;
+    }
+    
+    for (int fd = 0; fd < connections_size; fd++) {
+        struct connection *conn = connections[fd];
+        if (!conn) {
+            continue;
+        }
+        if (conn->shut_wr) {
+            int outq = 0;
+            if (ioctl(fd, SIOCOUTQ, &outq) == -1 || outq == 0) {
+                handle_client_disconnect(fd, epoll_fd);
+            }
+            continue;
+        }
+        if (conn->peer_fd != -1) {
+            struct connection *peer = connection_get(conn->peer_fd);
+            if (conn->pipe_bytes == 0 && (!peer || peer->pipe_bytes == 0)) {
+                stats.drain_flushed++;
+                proxy_close(conn);
+            }
+            continue;
+        }
+        if (!conn->out_head && !conn->jobs && !conn->co) {
+            if (shutdown(fd, SHUT_WR) == -1) {
+                perror("shutdown");
+            }
+            conn->shut_wr = 1;
+            stats.drain_flushed++;
+        }
+    }
+    // 已关闭但内核还在发零拷贝数据的连接也等到期限，退出时会RST丢掉它们的数据
+    return stats.connections_active + stats.zerocopy_lingering;
+}
+
+// 排空期间读掉连接上的新数据，不再处理
+// 返回值: 0=数据已读完, -1=对端关闭或出错，需要关闭连接
+int connection_discard_input(struct connection *conn) {
+    char buf[BUFFER_SIZE];
+    
+    while (1) {
+        prof_syscall(SYS_READ);
+        ssize_t n = read(conn->fd, buf, sizeof(buf));
+        if (n > 0) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        return -1;
+    }
+}
+
+// 关闭所有剩下的连接（退出时，排空期限已到或者不排空）
+void close_all_connections(void) {
+    for (int fd = 0; fd < connections_size; fd++) {
+        struct connection *conn = connections[fd];
+        if (!conn) {
+            continue;
+        }
+        if (draining && !conn->shut_wr) {
+            stats.drain_forced++;
+        }
+        if (conn->peer_fd != -1) {
+            proxy_close(conn);
+        } else {
+            handle_client_disconnect(fd, epoll_fd);
+        }
+    }
+}
+
+// 热升级（SIGUSR2）：用同样的参数exec一个新进程（通常是刚部署的新版本），
+// 通过socketpair以SCM_RIGHTS把监听socket交给它；新进程开始accept后写回一个字节，
+// 老进程收到后关闭自己的那份监听socket并排空现有连接后退出
+// 监听socket始终有进程持有，不存在bind失败或连接被拒绝的窗口
+// 新老进程同时追加录制文件会让记录的时间差错乱：老进程在启动新进程前停止录制，
+// 新进程打开文件时写新的SEGMENT；升级失败时老进程重新打开，接着录制新连接
+static void capture_suspend(void) {
+    if (!capture) {
+        return;
+    }
+    capture_close(capture);
+    capture = NULL;
+    for (int fd = 0; fd < connections_size; fd++) {
+        if (connections[fd]) {
+            connections[fd]->capture_id = 0;
+        }
+    }
+}
+
+static void capture_resume(void) {
+    if (capture_path && !capture) {
+        capture = capture_open(capture_path);
+    }
+}
+
+void upgrade_start(void) {
+    if (!server_argv) {
+        // 被handler_bench包含，没有经过main
+        return;
+    }
+    if (draining || upgrade_fd != -1) {
+        printf("Upgrade ignored: %s\n", draining ? "already draining" : "upgrade in progress");
+        return;
+    }
+    
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair");
+        return;
+    }
+    
+    // 新进程的环境变量在fork之前准备好，子进程里只调用exec
+    extern char **environ;
+    size_t env_count = 0;
+    while (environ[env_count]) {
+        env_count++;
+    }
+    char **envp = malloc((env_count + 2) * sizeof(*envp));
+    char env_fd[64];
+    if (!envp) {
+        perror("malloc envp");
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < env_count; i++) {
+        if (strncmp(environ[i], UPGRADE_ENV "=", strlen(UPGRADE_ENV) + 1) != 0) {
+            envp[n++] = environ[i];
+        }
+    }
+    snprintf(env_fd, sizeof(env_fd), UPGRADE_ENV "=%d", sv[1]);
+    envp[n++] = env_fd;
+    envp[n] = NULL;
+    
+    capture_suspend();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        capture_resume();
+        free(envp);
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+    if (pid == 0) {
+        // 子进程：sv[1]跨exec保留，恢复信号屏蔽字（新进程会自己屏蔽）
+        sigset_t mask;
+        sigemptyset(&mask);
+        fcntl(sv[1], F_SETFD, 0);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        execvpe(server_argv[0], server_argv, envp);
+        perror("execvpe");
+        _exit(127);
+    }
+    free(envp);
+    close(sv[1]);
+    
+    // 端口号作为数据，监听socket作为SCM_RIGHTS附带
+    int ports[MAX_LISTENERS];
+    int fds[MAX_LISTENERS];
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    for (int i = 0; i < listener_count; i++) {
+        ports[i] = listeners[i].port;
+        fds[i] = listeners[i].fd;
+    }
+    struct iovec iov = { .iov_base = ports, .iov_len = listener_count * sizeof(int) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(listener_count * sizeof(int));
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(listener_count * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, listener_count * sizeof(int));
+    
+    // 消息很小，一定能放进socketpair的缓冲区，不会阻塞
+    if (sendmsg(sv[0], &msg, 0) == -1) {
+        perror("sendmsg listeners");
+        close(sv[0]);
+        kill(pid, SIGKILL);
+        capture_resume();
+        return;
+    }
+    
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = sv[0];
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sv[0], &event) == -1) {
+        perror("epoll_ctl ADD upgrade fd");
+        close(sv[0]);
+        kill(pid, SIGKILL);
+        capture_resume();
+        return;
+    }
+    upgrade_fd = sv[0];
+    upgrade_pid = pid;
+    printf("Upgrade: started new process %d with %d listener(s)\n", (int)pid, listener_count);
+}
+
+// 新进程的回应：就绪后老进程开始排空；新进程没就绪就退出时继续服务
+void handle_upgrade_event(void) {
+    char ready = 0;
+    ssize_t n = read(upgrade_fd, &ready, 1);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    
+    close(upgrade_fd);
+    upgrade_fd = -1;
+    if (n != 1 || ready != 'R') {
+        printf("Upgrade failed: new process %d exited before accepting, still serving\n",
+               (int)upgrade_pid);
+        upgrade_pid = -1;
+        capture_resume();
+        return;
+    }
+    
+    printf("Upgrade: new process %d is accepting, draining this one\n", (int)upgrade_pid);
+    upgrade_pid = -1;
+    // 新进程已经接管了共享内存socket的路径
+    shm_path_owned = 0;
+    if (draining) {
+        return;
+    }
+    if (drain_timeout > 0) {
+        drain_start();
+    } else {
+        running = 0;
+    }
+}
+
+// 新进程：环境变量里有老进程传来的Unix socket时，接收其中的监听socket
+// 返回值: 0=成功或不是热升级启动, -1=失败
+int upgrade_receive_listeners(void) {
+    const char *env = getenv(UPGRADE_ENV);
+    if (!env) {
+        return 0;
+    }
+    upgrade_fd = atoi(env);
+    unsetenv(UPGRADE_ENV);
+    fcntl(upgrade_fd, F_SETFD, FD_CLOEXEC);
+    
+    int ports[MAX_LISTENERS];
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = ports, .iov_len = sizeof(ports) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    
+    ssize_t n = recvmsg(upgrade_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        perror("recvmsg listeners");
+        return -1;
+    }
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+        fprintf(stderr, "Upgrade: no listening sockets received\n");
+        return -1;
+    }
+    inherited_count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(inherited_fds, CMSG_DATA(cm), inherited_count * sizeof(int));
+    for (int i = 0; i < inherited_count; i++) {
+        inherited_ports[i] = (size_t)i < n / sizeof(int) ? ports[i] : -1;
+    }
+    printf("Upgrade: inherited %d listening socket(s)\n", inherited_count);
+    return 0;
+}
+
+// 取出继承来的监听指定端口的socket，没有返回-1
+int upgrade_take_listener(int port) {
+    for (int i = 0; i < inherited_count; i++) {
+        if (inherited_ports[i] == port) {
+            int fd = inherited_fds[i];
+            inherited_fds[i] = inherited_fds[--inherited_count];
+            inherited_ports[i] = inherited_ports[inherited_count];
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// 新进程：监听socket都已注册，通知老进程开始排空；新配置里已经没有的端口随之关闭
+void upgrade_notify_ready(void) {
+    if (upgrade_fd == -1) {
+        return;
+    }
+    for (int i = 0; i < inherited_count; i++) {
+        printf("Upgrade: port %d is no longer configured, closing it\n", inherited_ports[i]);
+        close(inherited_fds[i]);
+    }
+    inherited_count = 0;
+    
+    if (write(upgrade_fd, "R", 1) != 1) {
+        perror("write upgrade ready");
+    }
+    close(upgrade_fd);
+    upgrade_fd = -1;
+}
+
+// 打印用法
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-P profile] [-l port:profile]... [-Z bytes] [-d dir] [-B host:port] [-m MB] [-w threads] [-g seconds] [-p] [-c file] [-j file] [-J ms] [-S path] [-E] [port]\n", prog);
+    fprintf(stderr, "  -P profile       socket profile of the main port (default: default)\n");
+    fprintf(stderr, "  -l port:profile  additional listener with its own profile\n");
+    fprintf(stderr, "  -Z bytes         send chunks of at least this size with MSG_ZEROCOPY\n");
+    fprintf(stderr, "  -d dir           serve files from dir with the file command\n");
+    fprintf(stderr, "  -B host:port     proxy mode: forward every connection to this backend\n");
+    fprintf(stderr, "  -m MB            memory limit of the key-value store (default: %d)\n", KV_DEFAULT_MEMORY_MB);
+    fprintf(stderr, "  -w threads       worker threads for slow commands, 0 runs them inline (default: %d)\n", DEFAULT_WORKER_THREADS);
+    fprintf(stderr, "  -p               profile event loop phases from the start (dump with SIGUSR1 or the profile command)\n");
+    fprintf(stderr, "  -c file          append inbound connections and request bytes to a capture file for replay\n");
+    fprintf(stderr, "  -j file          append mutating and admin commands to an audit journal (group-committed with fdatasync)\n");
+    fprintf(stderr, "  -J ms            journal group commit interval (default: %d)\n", JOURNAL_DEFAULT_INTERVAL_MS);
+    fprintf(stderr, "  -S path          accept shared-memory ring clients (shm_client) on this Unix socket\n");
+    fprintf(stderr, "  -E               register clients for EPOLLOUT permanently, so waiting for writability needs no epoll_ctl\n");
+    fprintf(stderr, "  -g seconds       on SIGINT/SIGTERM, wait up to this long for clients to receive pending replies (default: %d)\n", DEFAULT_DRAIN_TIMEOUT);
+    fprintf(stderr, "Profiles:");
+    for (size_t i = 0; i < sizeof(socket_profiles) / sizeof(socket_profiles[0]); i++) {
+        fprintf(stderr, " %s", socket_profiles[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+// 清理资源并退出
+void cleanup_and_exit() {
+    printf("Cleaning up resources...\n");
+    
+    // 先关闭连接（取消其中的任务和协程），再停工作线程
+    close_all_connections();
+    zc_linger_expire(1);
+    if (draining) {
+        printf("Drained %llu connections, %llu closed at the deadline\n",
+               stats.drain_flushed, stats.drain_forced);
+    }
+    
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    if (prio_epoll_fd != -1) {
+        close(prio_epoll_fd);
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+    if (sample_timer_fd != -1) {
+        close(sample_timer_fd);
+    }
+    if (upgrade_fd != -1) {
+        close(upgrade_fd);
+    }
+    capture_close(capture);
+    journal_close(journal);
+    while (shm_session_count > 0) {
+        shm_session_close(shm_session_count - 1);
+    }
+    if (shm_listen_fd != -1) {
+        close(shm_listen_fd);
+    }
+    if (shm_path && shm_path_owned) {
+        unlink(shm_path);
+    }
+    
+    for (int i = 0; i < listener_count; i++) {
+        close(listeners[i].fd);
+    }
+    
+    worker_pool_destroy(workers);
+    kv_destroy(kv);
+    
     printf("Server shutdown complete\n");
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
@@ -0,0 +1,401 @@
+// I/O故障注入（LD_PRELOAD）：按种子和概率让服务器的socket读写出现短读写、EAGAIN、EINTR、ECONNRESET
+// partial_write_test靠塞满缓冲区碰运气，这里每次都能稳定触发，用来覆盖发送队列和EPOLLOUT恢复发送的路径
+//
+// 用法: LD_PRELOAD=./fault_inject.so FAULT_SEED=1 FAULT_SHORT=0.3 FAULT_EAGAIN=0.2 ./epoll_server 8080
+//   FAULT_SEED     伪随机种子，相同的种子和相同的调用顺序得到相同的故障序列（默认1）
+//   FAULT_SHORT    read/write/writev只传输一部分（1..len-1字节）的概率
+//   FAULT_EAGAIN   write/writev不写任何数据返回EAGAIN的概率
+//   FAULT_EINTR    read/write/writev/accept返回EINTR的概率
+//   FAULT_RESET    read/write/writev返回ECONNRESET的概率（连接本身没断，由服务器决定关闭）
+//   FAULT_ABORT    accept/accept4拿到连接后立即关掉并返回ECONNABORTED的概率
+//
+// 只对accept返回的TCP连接注入；eventfd、signalfd、AF_UNIX等其他fd原样透传
+// 真的EAGAIN和短写意味着发送缓冲区满，内核腾出空间时一定会再报一次EPOLLOUT；伪造的没有这个边沿，
+// 所以同时包装epoll_ctl/epoll_wait：注入EAGAIN或短写的fd如果注册了EPOLLOUT，下一次epoll_wait补一个EPOLLOUT事件
+// read和accept不注入EAGAIN：边沿触发下内核不会在还有数据时返回EAGAIN，伪造的只会让连接卡住，
+// 测出来的不是服务器的问题
+// 退出时把各类调用和注入次数打印到标准错误
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define FAULT_MAX_FDS 65536
+#define FAULT_MAX_IOV 1024
+
+enum fault_op { OP_READ, OP_WRITE, OP_WRITEV, OP_ACCEPT, OP_COUNT };
+enum fault_kind { KIND_CALLS, KIND_SHORT, KIND_EAGAIN, KIND_EINTR, KIND_RESET, KIND_ABORT, KIND_COUNT };
+
+static const char *op_names[OP_COUNT] = { "read", "write", "writev", "accept" };
+static const char *kind_names[KIND_COUNT] = { "calls", "short", "eagain", "eintr", "reset", "abort" };
+
+static ssize_t (*real_read)(int, void*, size_t);
+static ssize_t (*real_write)(int, const void*, size_t);
+static ssize_t (*real_writev)(int, const struct iovec*, int);
+static int (*real_accept)(int, struct sockaddr*, socklen_t*);
+static int (*real_accept4)(int, struct sockaddr*, socklen_t*, int);
+static int (*real_close)(int);
+static int (*real_epoll_ctl)(int, int, int, struct epoll_event*);
+static int (*real_epoll_wait)(int, struct epoll_event*, int, int);
+
+// 概率换算成32位阈值，随机数小于阈值即注入
+static uint32_t p_short, p_eagain, p_eintr, p_reset, p_abort;
+static int fault_enabled = 0;
+static uint64_t fault_seed = 1;
+
+// 只在accept得到的TCP连接上注入
+static unsigned char tracked[FAULT_MAX_FDS];
+
+static unsigned long long counters[OP_COUNT][KIND_COUNT];
+
+// 每个fd最近一次在epoll里的注册，补EPOLLOUT事件时原样带上data
+struct watch {
+    int epfd;           // -1=没有注册
+    uint32_t events;
+    epoll_data_t data;
+};
+static struct watch watches[FAULT_MAX_FDS];
+
+// 注入了EAGAIN或短写、还欠一个EPOLLOUT边沿的fd（只在事件循环线程里访问）
+static unsigned char owed[FAULT_MAX_FDS];
+static int owed_list[FAULT_MAX_FDS];
+static int owed_count = 0;
+
+// 每个线程一份xorshift64*状态，按第一次使用的先后由种子派生；
+// 服务器的socket读写都在主线程，所以故障序列只由种子决定
+static __thread uint64_t rng_state;
+static int rng_threads = 0;
+
+static uint32_t fault_rand(void) {
+    if (rng_state == 0) {
+        uint64_t index = __atomic_fetch_add(&rng_threads, 1, __ATOMIC_RELAXED);
+        rng_state = (fault_seed + index) * 0x9E3779B97F4A7C15ULL;
+        rng_state = rng_state ? rng_state : 1;
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static void count(enum fault_op op, enum fault_kind kind) {
+    __atomic_fetch_add(&counters[op][kind], 1, __ATOMIC_RELAXED);
+}
+
+static int hit(uint32_t threshold) {
+    return threshold && fault_rand() < threshold;
+}
+
+static uint32_t env_probability(const char *name) {
+    const char *value = getenv(name);
+    if (!value) {
+        return 0;
+    }
+    double p = strtod(value, NULL);
+    if (p <= 0) {
+        return 0;
+    }
+    if (p >= 1) {
+        return UINT32_MAX;
+    }
+    return (uint32_t)(p * 4294967296.0);
+}
+
+__attribute__((constructor))
+static void fault_init(void) {
+    real_read = (ssize_t (*)(int, void*, size_t))dlsym(RTLD_NEXT, "read");
+    real_write = (ssize_t (*)(int, const void*, size_t))dlsym(RTLD_NEXT, "write");
+    real_writev = (ssize_t (*)(int, const struct iovec*, int))dlsym(RTLD_NEXT, "writev");
+    real_accept = (int (*)(int, struct sockaddr*, socklen_t*))dlsym(RTLD_NEXT, "accept");
+    real_accept4 = (int (*)(int, struct sockaddr*, socklen_t*, int))dlsym(RTLD_NEXT, "accept4");
+    real_close = (int (*)(int))dlsym(RTLD_NEXT, "close");
+    real_epoll_ctl = (int (*)(int, int, int, struct epoll_event*))dlsym(RTLD_NEXT, "epoll_ctl");
+    real_epoll_wait = (int (*)(int, struct epoll_event*, int, int))dlsym(RTLD_NEXT, "epoll_wait");
+    if (!real_read || !real_write || !real_writev || !real_accept || !real_accept4 || !real_close ||
+        !real_epoll_ctl || !real_epoll_wait) {
+        fprintf(stderr, "fault_inject: dlsym failed: %s\n", dlerror());
+        abort();
+    }
+
+    for (int fd = 0; fd < FAULT_MAX_FDS; fd++) {
+        watches[fd].epfd = -1;
+    }
+    const char *seed = getenv("FAULT_SEED");
+    if (seed) {
+        fault_seed = strtoull(seed, NULL, 0);
+    }
+    p_short = env_probability("FAULT_SHORT");
+    p_eagain = env_probability("FAULT_EAGAIN");
+    p_eintr = env_probability("FAULT_EINTR");
+    p_reset = env_probability("FAULT_RESET");
+    p_abort = env_probability("FAULT_ABORT");
+    fault_enabled = p_short || p_eagain || p_eintr || p_reset || p_abort;
+    if (fault_enabled) {
+        fprintf(stderr, "fault_inject: seed=%llu short=%s eagain=%s eintr=%s reset=%s abort=%s\n",
+                (unsigned long long)fault_seed,
+                getenv("FAULT_SHORT") ? getenv("FAULT_SHORT") : "0",
+                getenv("FAULT_EAGAIN") ? getenv("FAULT_EAGAIN") : "0",
+                getenv("FAULT_EINTR") ? getenv("FAULT_EINTR") : "0",
+                getenv("FAULT_RESET") ? getenv("FAULT_RESET") : "0",
+                getenv("FAULT_ABORT") ? getenv("FAULT_ABORT") : "0");
+    }
+}
+
+__attribute__((destructor))
+static void fault_report(void) {
+    if (!fault_enabled) {
+        return;
+    }
+    fprintf(stderr, "fault_inject: %-8s", "");
+    for (int k = 0; k < KIND_COUNT; k++) {
+        fprintf(stderr, " %10s", kind_names[k]);
+    }
+    fprintf(stderr, "\n");
+    for (int op = 0; op < OP_COUNT; op++) {
+        fprintf(stderr, "fault_inject: %-8s", op_names[op]);
+        for (int k = 0; k < KIND_COUNT; k++) {
+            fprintf(stderr, " %10llu", counters[op][k]);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+static int is_tracked(int fd) {
+    return fault_enabled && fd >= 0 && fd < FAULT_MAX_FDS && tracked[fd];
+}
+
+// 记下fd欠一个EPOLLOUT边沿
+static void owe_epollout(int fd) {
+    if (!owed[fd]) {
+        owed[fd] = 1;
+        owed_list[owed_count++] = fd;
+    }
+}
+
+// 读写共用的错误注入：返回0表示不注入，否则errno已设置
+static int inject_error(int fd, enum fault_op op, int allow_eagain) {
+    if (hit(p_eintr)) {
+        count(op, KIND_EINTR);
+        errno = EINTR;
+        return 1;
+    }
+    if (allow_eagain && owed_count < FAULT_MAX_FDS && hit(p_eagain)) {
+        count(op, KIND_EAGAIN);
+        owe_epollout(fd);
+        errno = EAGAIN;
+        return 1;
+    }
+    if (hit(p_reset)) {
+        count(op, KIND_RESET);
+        errno = ECONNRESET;
+        return 1;
+    }
+    return 0;
+}
+
+// 短读写的长度：1..len-1
+static size_t short_length(size_t len) {
+    return 1 + fault_rand() % (len - 1);
+}
+
+ssize_t read(int fd, void *buf, size_t count_) {
+    if (!is_tracked(fd)) {
+        return real_read(fd, buf, count_);
+    }
+    count(OP_READ, KIND_CALLS);
+    if (inject_error(fd, OP_READ, 0)) {
+        return -1;
+    }
+    if (count_ > 1 && hit(p_short)) {
+        count(OP_READ, KIND_SHORT);
+        count_ = short_length(count_);
+    }
+    return real_read(fd, buf, count_);
+}
+
+ssize_t write(int fd, const void *buf, size_t count_) {
+    if (!is_tracked(fd)) {
+        return real_write(fd, buf, count_);
+    }
+    count(OP_WRITE, KIND_CALLS);
+    if (inject_error(fd, OP_WRITE, 1)) {
+        return -1;
+    }
+    if (count_ > 1 && owed_count < FAULT_MAX_FDS && hit(p_short)) {
+        count(OP_WRITE, KIND_SHORT);
+        owe_epollout(fd);
+        count_ = short_length(count_);
+    }
+    return real_write(fd, buf, count_);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    if (!is_tracked(fd) || iovcnt <= 0 || iovcnt > FAULT_MAX_IOV) {
+        return real_writev(fd, iov, iovcnt);
+    }
+    count(OP_WRITEV, KIND_CALLS);
+    if (inject_error(fd, OP_WRITEV, 1)) {
+        return -1;
+    }
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total <= 1 || owed_count >= FAULT_MAX_FDS || !hit(p_short)) {
+        return real_writev(fd, iov, iovcnt);
+    }
+
+    // 截短iov：前面的完整保留，落在截断点上的那个只留一部分
+    count(OP_WRITEV, KIND_SHORT);
+    owe_epollout(fd);
+    struct iovec cut[FAULT_MAX_IOV];
+    size_t limit = short_length(total);
+    int n = 0;
+    while (limit > 0) {
+        cut[n] = iov[n];
+        if (cut[n].iov_len > limit) {
+            cut[n].iov_len = limit;
+        }
+        limit -= cut[n].iov_len;
+        n++;
+    }
+    return real_writev(fd, cut, n);
+}
+
+static int is_tcp(int fd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    return getsockname(fd, (struct sockaddr*)&addr, &len) == 0 &&
+           (addr.ss_family == AF_INET || addr.ss_family == AF_INET6);
+}
+
+// 登记新连接，或者按FAULT_ABORT把它丢掉
+static int track_accepted(int fd) {
+    if (fd >= FAULT_MAX_FDS) {
+        return fd;
+    }
+    if (hit(p_abort)) {
+        // 连接在accept之前就被对端重置的效果：这个连接不再交给服务器
+        count(OP_ACCEPT, KIND_ABORT);
+        real_close(fd);
+        errno = ECONNABORTED;
+        return -1;
+    }
+    tracked[fd] = 1;
+    return fd;
+}
+
+static int accept_common(int fd, struct sockaddr *addr, socklen_t *len, int flags, int use_accept4) {
+    if (!fault_enabled || !is_tcp(fd)) {
+        return use_accept4 ? real_accept4(fd, addr, len, flags) : real_accept(fd, addr, len);
+    }
+    count(OP_ACCEPT, KIND_CALLS);
+    if (hit(p_eintr)) {
+        count(OP_ACCEPT, KIND_EINTR);
+        errno = EINTR;
+        return -1;
+    }
+    int client = use_accept4 ? real_accept4(fd, addr, len, flags) : real_accept(fd, addr, len);
+    if (client == -1) {
+        return client;
+    }
+    return track_accepted(client);
+}
+
+int accept(int fd, struct sockaddr *addr, socklen_t *len) {
+    return accept_common(fd, addr, len, 0, 0);
+}
+
+int accept4(int fd, struct sockaddr *addr, socklen_t *len, int flags) {
+    return accept_common(fd, addr, len, flags, 1);
+}
+
+int close(int fd) {
+    if (fd >= 0 && fd < FAULT_MAX_FDS) {
+        tracked[fd] = 0;
+        owed[fd] = 0;
+        watches[fd].epfd = -1;
+    }
+    return real_close(fd);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    int result = real_epoll_ctl(epfd, op, fd, event);
+    if (result == 0 && fd >= 0 && fd < FAULT_MAX_FDS) {
+        if (op == EPOLL_CTL_DEL) {
+            watches[fd].epfd = -1;
+        } else {
+            watches[fd] = (struct watch){ epfd, event->events, event->data };
+        }
+        // ADD/MOD时内核自己按当前状态报告可写，不用再补
+        owed[fd] = 0;
+    }
+    return result;
+}
+
+// 把事件并进epoll_wait的结果：同一个fd已经在结果里就合并事件位；结果满了返回-1
+static int merge_event(struct epoll_event *events, int *nfds, int maxevents, epoll_data_t data, uint32_t ev) {
+    int j = 0;
+    while (j < *nfds && events[j].data.u64 != data.u64) {
+        j++;
+    }
+    if (j == *nfds) {
+        if (*nfds == maxevents) {
+            return -1;
+        }
+        events[j].events = 0;
+        events[j].data = data;
+        (*nfds)++;
+    }
+    events[j].events |= ev;
+    return 0;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if (owed_count == 0) {
+        return real_epoll_wait(epfd, events, maxevents, timeout);
+    }
+
+    // 有欠着的EPOLLOUT就不睡眠，把它们并进这次的结果
+    int nfds = real_epoll_wait(epfd, events, maxevents, 0);
+    if (nfds == -1) {
+        return -1;
+    }
+    int kept = 0;
+    for (int i = 0; i < owed_count; i++) {
+        int fd = owed_list[i];
+        if (!owed[fd]) {
+            continue;
+        }
+        struct watch *w = &watches[fd];
+        if (w->epfd != epfd) {
+            // 别的epoll实例上的fd留到它自己的epoll_wait；那个实例嵌套注册在这里时（如高优先级集合），
+            // 真的边沿会让它可读，同样补一个EPOLLIN，否则外层的epoll_wait永远看不到
+            owed_list[kept++] = fd;
+            if ((w->events & EPOLLOUT) && w->epfd >= 0 && w->epfd < FAULT_MAX_FDS &&
+                watches[w->epfd].epfd == epfd && (watches[w->epfd].events & EPOLLIN)) {
+                merge_event(events, &nfds, maxevents, watches[w->epfd].data, EPOLLIN);
+            }
+            continue;
+        }
+        if (!(w->events & EPOLLOUT)) {
+            // 没监听EPOLLOUT：之后MOD打开时内核会报告
+            owed[fd] = 0;
+            continue;
+        }
+        if (merge_event(events, &nfds, maxevents, w->data, EPOLLOUT) == -1) {
+            owed_list[kept++] = fd;
+            continue;
+        }
+        owed[fd] = 0;
+    }
+    owed_count = kept;
+    return nfds;
+}
@@ -0,0 +1,507 @@
+// 故障注入下的收发校验和吞吐测试：配合 LD_PRELOAD=./fault_inject.so 启动的服务器使用
+// 每个连接按种子生成一串流水线文本命令（ping / echo随机长度 / stream随机长度 / 可选large），
+// 边发边收，逐字节核对回复；服务器在短写、EAGAIN后靠EPOLLOUT续发，丢字节、重复、乱序、卡住都会被发现
+// 用法: ./fault_test [-c connections] [-n requests] [-s seed] [-t timeout_sec] [-r rcvbuf] [-l] [-a] [-k] host:port
+//   -l  每个连接额外请求一次large（10MB）
+//   -r  连接的SO_RCVBUF，调小让回复在服务器的发送队列里积压
+//   -k  每个连接先set一个KV_VALUE_SIZE字节的值并订阅自己的频道，脚本里混入get和向该频道publish，最后del；
+//       结束后查stats，要求kv的retained和pubsub的buffers回到0（发送队列持有的引用都放掉了）；
+//       不能和-l一起用：10MB的回复让积压超过服务器的SUB_MAX_PENDING，推给自己的消息会被丢掉
+//   -a  允许连接提前关闭（服务器开了FAULT_RESET/FAULT_ABORT），只要求关闭前收到的部分正确
+// 退出码: 0=全部正确, 1=有字节不一致、连接卡住或者不允许时提前关闭
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WELCOME_MSG "Welcome to Carlos's Echo Server!\n"
+#define STREAM_CHUNK (16 * 1024)            // 和服务器的CO_STREAM_CHUNK一致，生成数据每块从'A'重新开始
+#define LARGE_SIZE (10 * 1024 * 1024)       // 和服务器的LARGE_DATA_SIZE一致
+#define MAX_ECHO 2000
+#define MAX_STREAM (256 * 1024)
+#define KV_VALUE_SIZE 3000                  // 超过 -Z 的常用阈值，get的回复会走零拷贝
+#define MIN_PUBLISH 1024                    // publish消息的长度范围，推送同样大多会走零拷贝
+#define MAX_PUBLISH 3000
+#define STATS_SIZE 8192
+#define MAX_EVENTS 64
+#define READ_SIZE 65536
+
+enum expect_kind {
+    EXPECT_TEXT,        // 固定文本（欢迎消息、pong）
+    EXPECT_COPY,        // 请求里的一段原样返回（echo）
+    EXPECT_STREAM,      // stream生成的数据
+    EXPECT_LARGE,       // large生成的数据
+};
+
+struct expect {
+    enum expect_kind kind;
+    const char *text;   // EXPECT_TEXT/EXPECT_COPY的内容
+    size_t len;
+};
+
+enum conn_state { CONN_ACTIVE, CONN_DONE, CONN_CLOSED_EARLY, CONN_MISMATCH };
+
+struct test_conn {
+    int fd;
+    enum conn_state state;
+    char *script;       // 全部请求
+    size_t script_len;
+    size_t sent;
+    struct expect *expects;
+    int expect_count;
+    int expect_index;
+    size_t expect_offset;
+    unsigned long long received;
+    unsigned long long expected_total;
+};
+
+static unsigned int rand_next(unsigned int *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 按种子生成请求序列和对应的预期回复
+static int build_script(struct test_conn *c, int id, int requests, int with_large, int with_kv,
+                        unsigned int seed) {
+    size_t cap = (size_t)requests * (MAX_PUBLISH + 32) + KV_VALUE_SIZE + 128;
+    c->script = malloc(cap);
+    c->expects = malloc(sizeof(struct expect) * (requests * 3 + 8));
+    if (!c->script || !c->expects) {
+        return -1;
+    }
+    c->expects[c->expect_count++] = (struct expect){ EXPECT_TEXT, WELCOME_MSG, strlen(WELCOME_MSG) };
+
+    // get的回复就是set行里的值加换行，直接指向脚本里那一段；推送的消息同理
+    const char *value = NULL;
+    if (with_kv) {
+        char *line = c->script;
+        int n = sprintf(line, "set ft%d ", id);
+        for (size_t k = 0; k < KV_VALUE_SIZE; k++) {
+            line[n + k] = "abcdefghijklmnopqrstuvwxyz0123456789"[rand_next(&seed) % 36];
+        }
+        line[n + KV_VALUE_SIZE] = '\n';
+        value = line + n;
+        c->script_len += n + KV_VALUE_SIZE + 1;
+        c->expects[c->expect_count++] = (struct expect){ EXPECT_TEXT, "OK\n", 3 };
+        c->script_len += sprintf(c->script + c->script_len, "subscribe fc%d\n", id);
+        c->expects[c->expect_count++] = (struct expect){ EXPECT_TEXT, "OK\n", 3 };
+        c->expected_total += 6;
+    }
+
+    int large_at = with_large ? (int)(rand_next(&seed) % requests) : -1;
+    for (int i = 0; i < requests; i++) {
+        char *line = c->script + c->script_len;
+        struct expect *e = &c->expects[c->expect_count++];
+        unsigned int r = rand_next(&seed);
+
+        if (i == large_at) {
+            c->script_len += sprintf(line, "large\n");
+            *e = (struct expect){ EXPECT_LARGE, NULL, LARGE_SIZE };
+        } else if (with_kv && r % 5 == 0) {
+            c->script_len += sprintf(line, "get ft%d\n", id);
+            *e = (struct expect){ EXPECT_COPY, value, KV_VALUE_SIZE + 1 };
+        } else if (with_kv && r % 5 == 1) {
+            // 先收到推给自己的 "message fc<id> <msg>\n"，再收到 "OK 1"
+            size_t n = MIN_PUBLISH + rand_next(&seed) % (MAX_PUBLISH - MIN_PUBLISH + 1);
+            int k = sprintf(line, "publish fc%d ", id);
+            for (size_t j = 0; j < n; j++) {
+                line[k + j] = "abcdefghijklmnopqrstuvwxyz0123456789"[rand_next(&seed) % 36];
+            }
+            line[k + n] = '\n';
+            c->script_len += k + n + 1;
+            *e = (struct expect){ EXPECT_TEXT, "message ", 8 };
+            c->expects[c->expect_count++] = (struct expect){ EXPECT_COPY, line + 8, k - 8 + n + 1 };
+            c->expects[c->expect_count++] = (struct expect){ EXPECT_TEXT, "OK 1\n", 5 };
+            c->expected_total += k - 8 + n + 1 + 5;
+        } else if (r % 10 < 4) {
+            c->script_len += sprintf(line, "ping\n");
+            *e = (struct expect){ EXPECT_TEXT, "pong\n", 5 };
+        } else if (r % 10 < 8) {
+            size_t n = 1 + rand_next(&seed) % MAX_ECHO;
+            memcpy(line, "echo ", 5);
+            for (size_t k = 0; k < n; k++) {
+                line[5 + k] = "abcdefghijklmnopqrstuvwxyz0123456789"[rand_next(&seed) % 36];
+            }
+            line[5 + n] = '\n';
+            c->script_len += n + 6;
+            *e = (struct expect){ EXPECT_COPY, line + 5, n + 1 };
+        } else {
+            size_t n = 1 + rand_next(&seed) % MAX_STREAM;
+            c->script_len += sprintf(line, "stream %zu\n", n);
+            *e = (struct expect){ EXPECT_STREAM, NULL, n };
+        }
+        c->expected_total += e->len;
+    }
+    c->expected_total += strlen(WELCOME_MSG);
+    if (with_kv) {
+        c->script_len += sprintf(c->script + c->script_len, "del ft%d\n", id);
+        c->expects[c->expect_count++] = (struct expect){ EXPECT_TEXT, "OK\n", 3 };
+        c->expected_total += 3;
+    }
+    return 0;
+}
+
+static char expected_byte(const struct expect *e, size_t offset) {
+    switch (e->kind) {
+    case EXPECT_TEXT:
+    case EXPECT_COPY:
+        return e->text[offset];
+    case EXPECT_STREAM:
+        return 'A' + (offset % STREAM_CHUNK) % 26;
+    default:
+        return 'A' + offset % 26;
+    }
+}
+
+// 核对收到的一段数据；返回-1表示不一致
+static int verify(struct test_conn *c, int id, const char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (c->expect_index == c->expect_count) {
+            fprintf(stderr, "conn %d: %zu unexpected extra bytes after %llu\n", id, len - i, c->received);
+            return -1;
+        }
+        const struct expect *e = &c->expects[c->expect_index];
+        char want = expected_byte(e, c->expect_offset);
+        if (buf[i] != want) {
+            fprintf(stderr, "conn %d: mismatch at byte %llu (reply %d offset %zu): got 0x%02x want 0x%02x\n",
+                    id, c->received, c->expect_index, c->expect_offset,
+                    (unsigned char)buf[i], (unsigned char)want);
+            return -1;
+        }
+        c->received++;
+        if (++c->expect_offset == e->len) {
+            c->expect_index++;
+            c->expect_offset = 0;
+        }
+    }
+    return 0;
+}
+
+static int connect_to(const char *host, const char *port, int rcvbuf) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
+    if (fd != -1 && rcvbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    if (fd != -1 && connect(fd, res->ai_addr, res->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        perror("connect");
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static void conn_finish(struct test_conn *c, int epfd, enum conn_state state) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->state = state;
+}
+
+// 发送剩余的请求；返回-1表示连接已被关闭
+static int conn_send(struct test_conn *c, int epfd) {
+    while (c->sent < c->script_len) {
+        ssize_t n = send(c->fd, c->script + c->sent, c->script_len - c->sent, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            conn_finish(c, epfd, CONN_CLOSED_EARLY);
+            return -1;
+        }
+        c->sent += n;
+    }
+    // 全部发出，之后只等回复
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    return 0;
+}
+
+static void conn_recv(struct test_conn *c, int id, int epfd, char *buf) {
+    while (1) {
+        ssize_t n = recv(c->fd, buf, READ_SIZE, 0);
+        if (n > 0) {
+            if (verify(c, id, buf, n) == -1) {
+                conn_finish(c, epfd, CONN_MISMATCH);
+                return;
+            }
+            if (c->received == c->expected_total) {
+                conn_finish(c, epfd, CONN_DONE);
+                return;
+            }
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        conn_finish(c, epfd, CONN_CLOSED_EARLY);
+        return;
+    }
+}
+
+// 新开一个连接取stats，读到最后的memory行为止；返回-1表示失败
+static int query_stats(const char *host, const char *port, char *buf, size_t size) {
+    int fd = connect_to(host, port, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    size_t len = 0;
+    int sent = 0;
+    double deadline = now_sec() + 5;
+    while (now_sec() < deadline) {
+        struct pollfd pfd = { fd, sent ? POLLIN : POLLOUT, 0 };
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        if (!sent) {
+            sent = send(fd, "stats\n", 6, MSG_NOSIGNAL) == 6;
+            if (!sent) {
+                break;
+            }
+            continue;
+        }
+        ssize_t n = recv(fd, buf + len, size - len - 1, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        buf[len] = '\0';
+        char *memory = strstr(buf, "memory:");
+        if (memory && strchr(memory, '\n')) {
+            close(fd);
+            return 0;
+        }
+        if (len == size - 1) {
+            break;
+        }
+    }
+    close(fd);
+    return -1;
+}
+
+// stats里某个字段的值，如 "retained="；找不到返回-1
+static long long stats_field(const char *stats, const char *line, const char *field) {
+    const char *p = strstr(stats, line);
+    const char *end = p ? strchr(p, '\n') : NULL;
+    p = p ? strstr(p, field) : NULL;
+    if (!p || p > end) {
+        return -1;
+    }
+    return strtoll(p + strlen(field), NULL, 10);
+}
+
+// 回复都收完、连接都关了之后，发送队列里的引用应该全部放掉；服务器处理关闭有先后，给一点时间
+static int check_released(const char *host, const char *port) {
+    char *buf = malloc(STATS_SIZE);
+    long long retained = -1, buffers = -1;
+    if (!buf) {
+        return -1;
+    }
+    for (int i = 0; i < 20; i++) {
+        if (query_stats(host, port, buf, STATS_SIZE) == 0) {
+            retained = stats_field(buf, "kv:", " retained=");
+            buffers = stats_field(buf, "pubsub:", " buffers=");
+            if (retained == 0 && buffers == 0) {
+                break;
+            }
+        }
+        usleep(100000);
+    }
+    printf("kv retained=%lld pubsub buffers=%lld\n", retained, buffers);
+    free(buf);
+    return retained == 0 && buffers == 0 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c connections] [-n requests] [-s seed] [-t timeout_sec] [-r rcvbuf] [-l] [-a] [-k] host:port\n", prog);
+    fprintf(stderr, "  -r  SO_RCVBUF for test connections, small values make replies queue up on the server\n");
+    fprintf(stderr, "  -l  also request 'large' (10MB) once per connection\n");
+    fprintf(stderr, "  -a  allow early close (server runs with FAULT_RESET/FAULT_ABORT)\n");
+    fprintf(stderr, "  -k  mix 'get' of a %d-byte value and self-'publish' into the script,\n"
+            "      then require kv retained=0 and pubsub buffers=0 in stats (not with -l)\n", KV_VALUE_SIZE);
+}
+
+int main(int argc, char *argv[]) {
+    int connections = 16;
+    int requests = 1000;
+    unsigned int seed = 1;
+    double timeout = 60;
+    int with_large = 0;
+    int allow_close = 0;
+    int with_kv = 0;
+    int rcvbuf = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:s:t:r:lakh")) != -1) {
+        switch (opt) {
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            timeout = atof(optarg);
+            break;
+        case 'r':
+            rcvbuf = atoi(optarg);
+            break;
+        case 'l':
+            with_large = 1;
+            break;
+        case 'a':
+            allow_close = 1;
+            break;
+        case 'k':
+            with_kv = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || connections <= 0 || requests <= 0 || (with_kv && with_large)) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    char *host = argv[optind];
+    char *port = strrchr(host, ':');
+    if (!port) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    *port++ = '\0';
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct test_conn *conns = calloc(connections, sizeof(*conns));
+    char *buf = malloc(READ_SIZE);
+    if (epfd == -1 || !conns || !buf) {
+        perror("setup");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long long expected_total = 0;
+    for (int i = 0; i < connections; i++) {
+        struct test_conn *c = &conns[i];
+        if (build_script(c, i, requests, with_large, with_kv, seed + i) == -1) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        expected_total += c->expected_total;
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < connections; i++) {
+        struct test_conn *c = &conns[i];
+        c->fd = connect_to(host, port, rcvbuf);
+        if (c->fd == -1) {
+            exit(EXIT_FAILURE);
+        }
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = c };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+            perror("epoll_ctl");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int active = connections;
+    while (active > 0 && now_sec() - start < timeout) {
+        struct epoll_event events[MAX_EVENTS];
+        int nfds = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        if (nfds == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < nfds; i++) {
+            struct test_conn *c = events[i].data.ptr;
+            int id = (int)(c - conns);
+            if (c->state != CONN_ACTIVE) {
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && conn_send(c, epfd) == -1) {
+                active--;
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                conn_recv(c, id, epfd, buf);
+            }
+            if (c->state != CONN_ACTIVE) {
+                active--;
+            }
+        }
+    }
+    double elapsed = now_sec() - start;
+
+    int done = 0, closed = 0, mismatched = 0, stalled = 0;
+    unsigned long long received = 0;
+    for (int i = 0; i < connections; i++) {
+        struct test_conn *c = &conns[i];
+        received += c->received;
+        switch (c->state) {
+        case CONN_DONE:
+            done++;
+            break;
+        case CONN_CLOSED_EARLY:
+            closed++;
+            break;
+        case CONN_MISMATCH:
+            mismatched++;
+            break;
+        default:
+            stalled++;
+            fprintf(stderr, "conn %d: stalled after %llu/%llu bytes (reply %d/%d), sent %zu/%zu request bytes\n",
+                    i, c->received, c->expected_total, c->expect_index, c->expect_count,
+                    c->sent, c->script_len);
+            close(c->fd);
+            break;
+        }
+        free(c->script);
+        free(c->expects);
+    }
+
+    printf("connections=%d requests=%d seed=%u large=%s kv=%s\n", connections, requests, seed,
+           with_large ? "yes" : "no", with_kv ? "yes" : "no");
+    printf("done=%d closed_early=%d mismatched=%d stalled=%d\n", done, closed, mismatched, stalled);
+    printf("received %llu/%llu bytes in %.2fs: %.1f MB/s, %.0f requests/s\n",
+           received, expected_total, elapsed, received / elapsed / 1e6,
+           (double)done * requests / elapsed);
+
+    free(conns);
+    free(buf);
+    close(epfd);
+    int ok = mismatched == 0 && stalled == 0 && (allow_close || closed == 0);
+    if (with_kv && check_released(host, port) == -1) {
+        ok = 0;
+    }
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
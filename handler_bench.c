@@ -0,0 +1,321 @@
+// 请求处理路径的进程内基准：不经过socket，把命令流从内存喂给连接，
+// 走完整的 切分(process_input) -> 分发(handle_text_command/process_message) -> 回复入队(connection_sendv)，
+// 回复写进内存里的计数器而不是内核
+// 报告每个请求的耗时、内存分配次数，以及perf_event_open能用时的用户态指令数和周期数
+// 命令组成按locustfile.py里各任务的权重生成；-m kv换成键值命令
+// 服务器对每个请求打印的日志也算在内（标准输出重定向到/dev/null），和线上的处理路径一致
+#define EPOLL_SERVER_NO_MAIN
+#include "epoll_server.c"
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define DEFAULT_COMMANDS 20000
+#define DEFAULT_ROUNDS 50
+#define DEFAULT_CHUNK 4096                  // 每次"读到"的字节数，和服务器的接收缓冲区一样大
+
+// 内存分配计数：链接时用 -Wl,--wrap=malloc 等把调用转到这里
+static unsigned long long alloc_count = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void *ptr, size_t size);
+void* __wrap_malloc(size_t size);
+void* __wrap_calloc(size_t n, size_t size);
+void* __wrap_realloc(void *ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    alloc_count++;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+// 回复写到这里：只计数；sink_budget不为0时每轮最多接受这么多字节，之后返回EAGAIN，
+// 回复进入发送队列，由基准模拟EPOLLOUT继续发送
+static unsigned long long sink_bytes = 0;
+static size_t sink_budget = 0;
+static size_t sink_left = 0;
+
+static ssize_t sink_writev(int fd, const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    (void)fd;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (sink_budget > 0) {
+        if (sink_left == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (total > sink_left) {
+            total = sink_left;
+        }
+        sink_left -= total;
+    }
+    sink_bytes += total;
+    return (ssize_t)total;
+}
+
+// 用户态的硬件计数器；不可用（容器里perf_event_paranoid太高等）时fd为-1
+static int perf_open(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t perf_read(int fd) {
+    uint64_t value = 0;
+    if (fd != -1 && read(fd, &value, sizeof(value)) != sizeof(value)) {
+        value = 0;
+    }
+    return value;
+}
+
+static void perf_toggle(int fd, int enable) {
+    if (fd != -1) {
+        ioctl(fd, enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* echo_payload(unsigned int r) {
+    static char lengths[5][512];
+    static const size_t sizes[5] = { 0, 0, 0, 100, 500 };
+    static const char *fixed[3] = {
+        "short",
+        "medium length message for testing",
+        "this is a longer message to test the echo functionality of the epoll server",
+    };
+    int i = r % 5;
+    if (i < 3) {
+        return fixed[i];
+    }
+    if (!lengths[i][0]) {
+        memset(lengths[i], i == 3 ? 'a' : 'b', sizes[i]);
+    }
+    return lengths[i];
+}
+
+// 按locustfile.py的任务权重生成一条命令：
+// EpollServerUser: ping 10, time 5, echo(5种长度) 8, help 2, 随机命令序列 3
+// StressTestUser: ping 20, echo stress_test_N 10
+// LongConnectionUser: ping 5, time 3, echo 1000-3000个x 2
+static int locust_command(char *line, size_t size, unsigned int *seed) {
+    static const char *sequence[] = {
+        "ping", "time", "help", "echo hello", "echo world", "echo test message",
+        "echo locust performance testing",
+    };
+    unsigned int r = rand_r(seed);
+    unsigned int pick = r % 68;
+    if (pick < 35) {
+        return snprintf(line, size, "ping\n");
+    }
+    if (pick < 43) {
+        return snprintf(line, size, "time\n");
+    }
+    if (pick < 51) {
+        return snprintf(line, size, "echo %s\n", echo_payload(r / 68));
+    }
+    if (pick < 53) {
+        return snprintf(line, size, "help\n");
+    }
+    if (pick < 56) {
+        return snprintf(line, size, "%s\n", sequence[(r / 68) % 7]);
+    }
+    if (pick < 66) {
+        return snprintf(line, size, "echo stress_test_%u\n", 1 + (r / 68) % 1000);
+    }
+    int n = 1000 + (r / 68) % 2001;
+    memcpy(line, "echo ", 5);
+    memset(line + 5, 'x', n);
+    line[5 + n] = '\n';
+    return n + 6;
+}
+
+static int kv_command(char *line, size_t size, unsigned int *seed) {
+    unsigned int r = rand_r(seed);
+    switch (r % 4) {
+    case 0:
+        return snprintf(line, size, "set user:%04u value-%08u\n", (r / 4) % 1000, r);
+    case 1:
+    case 2:
+        return snprintf(line, size, "get user:%04u\n", (r / 4) % 1000);
+    default:
+        return snprintf(line, size, "mget user:%04u user:%04u user:%04u\n",
+                        (r / 4) % 1000, (r / 8) % 1000, (r / 16) % 1000);
+    }
+}
+
+static char* generate(int commands, int kv_mix, size_t *len) {
+    size_t cap = (size_t)commands * 64 + BUFFER_SIZE;
+    char *buf = malloc(cap);
+    unsigned int seed = 12345;
+    *len = 0;
+    for (int i = 0; buf && i < commands; i++) {
+        char line[BUFFER_SIZE];
+        int n = kv_mix ? kv_command(line, sizeof(line), &seed) : locust_command(line, sizeof(line), &seed);
+        if (*len + n > cap) {
+            // 长echo较多时64字节/条不够
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) {
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        memcpy(buf + *len, line, n);
+        *len += n;
+    }
+    return buf;
+}
+
+// 把整个命令流按chunk字节一次喂给连接；限制了写出量时每次喂完都像收到EPOLLOUT一样发完发送队列
+static void run_round(struct connection *conn, const char *buf, size_t len, size_t chunk) {
+    for (size_t pos = 0; pos < len; pos += chunk) {
+        size_t n = len - pos < chunk ? len - pos : chunk;
+        sink_left = sink_budget;
+        if (connection_feed(conn, buf + pos, n) == -1) {
+            fprintf(stderr, "connection_feed failed\n");
+            exit(EXIT_FAILURE);
+        }
+        while (conn->out_head) {
+            sink_left = sink_budget;
+            if (connection_flush(conn) == -1) {
+                fprintf(stderr, "connection_flush failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int commands = DEFAULT_COMMANDS;
+    int rounds = DEFAULT_ROUNDS;
+    size_t chunk = DEFAULT_CHUNK;
+    int kv_mix = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:b:w:m:Eh")) != -1) {
+        switch (opt) {
+        case 'n':
+            commands = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'b':
+            chunk = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            sink_budget = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            kv_mix = strcmp(optarg, "kv") == 0;
+            if (!kv_mix && strcmp(optarg, "locust") != 0) {
+                fprintf(stderr, "Unknown mix: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'E':
+            epollout_always = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n commands] [-r rounds] [-b read_chunk] [-w write_budget] [-m locust|kv] [-E]\n",
+                    argv[0]);
+            fprintf(stderr, "  -w bytes   accept at most this many reply bytes per feed, the rest goes through the send queue\n");
+            fprintf(stderr, "  -E         keep EPOLLOUT registered, like epoll_server -E\n");
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (commands <= 0 || rounds <= 0 || chunk == 0) {
+        fprintf(stderr, "Invalid arguments\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t len;
+    char *buf = generate(commands, kv_mix, &len);
+    kv = kv_create((size_t)KV_DEFAULT_MEMORY_MB * 1024 * 1024);
+    if (!buf || !kv) {
+        perror("setup");
+        exit(EXIT_FAILURE);
+    }
+
+    // 连接的fd用eventfd占位：能注册进epoll（发送队列写不完时要MOD EPOLLOUT），回复不会真的写给它
+    conn_writev = sink_writev;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd == -1 || fd == -1 ||
+        interest_set(fd, EPOLLIN | EPOLLRDHUP | EPOLLET | (epollout_always ? EPOLLOUT : 0)) == -1) {
+        perror("epoll/eventfd");
+        exit(EXIT_FAILURE);
+    }
+    struct connection *conn = connection_create(fd, &socket_profiles[0]);
+    if (!conn) {
+        exit(EXIT_FAILURE);
+    }
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+        exit(EXIT_FAILURE);
+    }
+
+    int perf_instructions = perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+    int perf_cycles = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+
+    // 预热一轮：接收缓冲区、数据块池、键值存储都到稳定状态
+    run_round(conn, buf, len, chunk);
+    unsigned long long bytes_before = sink_bytes;
+    unsigned long long allocs_before = alloc_count;
+    unsigned long long ctl_before = stats.epoll_ctl_add + stats.epoll_ctl_mod + stats.epoll_ctl_del;
+    perf_toggle(perf_instructions, 1);
+    perf_toggle(perf_cycles, 1);
+    double t0 = now_sec();
+    for (int i = 0; i < rounds; i++) {
+        run_round(conn, buf, len, chunk);
+    }
+    double elapsed = now_sec() - t0;
+    perf_toggle(perf_instructions, 0);
+    perf_toggle(perf_cycles, 0);
+
+    double requests = (double)commands * rounds;
+    unsigned long long ctl = stats.epoll_ctl_add + stats.epoll_ctl_mod + stats.epoll_ctl_del - ctl_before;
+    uint64_t instructions = perf_read(perf_instructions);
+    uint64_t cycles = perf_read(perf_cycles);
+    fprintf(stderr, "mix=%s commands=%d rounds=%d input=%zu bytes (%.1f bytes/request) read_chunk=%zu write_budget=%zu\n",
+            kv_mix ? "kv" : "locust", commands, rounds, len, (double)len / commands, chunk, sink_budget);
+    fprintf(stderr, "%.1f ns/request  %.0f requests/s  %.2f allocs/request  %.1f reply bytes/request\n",
+            elapsed * 1e9 / requests, requests / elapsed, (alloc_count - allocs_before) / requests,
+            (sink_bytes - bytes_before) / requests);
+    fprintf(stderr, "%.3f epoll_ctl/request (EPOLLOUT %s)\n", ctl / requests, epollout_always ? "always" : "on demand");
+    if (instructions > 0 && cycles > 0) {
+        fprintf(stderr, "%.0f instructions/request  %.0f cycles/request  IPC %.2f\n",
+                instructions / requests, cycles / requests, (double)instructions / cycles);
+    } else {
+        fprintf(stderr, "instructions/request: n/a (perf_event_open unavailable)\n");
+    }
+
+    connection_destroy(fd);
+    close(fd);
+    kv_destroy(kv);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE // gmtime_r
+#include <string.h>
+#include <time.h>
+#include "http.h"
+
+// 大小写无关地比较请求头名（name全是小写）
+static int header_is(const char *p, size_t len, const char *name) {
+    size_t n = strlen(name);
+    if (len != n) {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        char c = p[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c != name[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 值里是否含有某个逗号分隔的token（Connection: keep-alive, Upgrade）
+static int value_has_token(const char *p, size_t len, const char *token) {
+    size_t n = strlen(token);
+    for (size_t i = 0; i + n <= len; i++) {
+        if (header_is(p + i, n, token) &&
+            (i == 0 || p[i - 1] == ' ' || p[i - 1] == ',') &&
+            (i + n == len || p[i + n] == ' ' || p[i + n] == ',')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static const char* trim_line(const char *start, const char *end) {
+    // 去掉行尾的\r
+    return end > start && end[-1] == '\r' ? end - 1 : end;
+}
+
+// 请求行：METHOD SP target SP HTTP/1.x
+static int parse_request_line(const char *p, const char *end, struct http_request *req) {
+    const char *sp = memchr(p, ' ', end - p);
+    if (!sp || sp == p) {
+        return HTTP_BAD;
+    }
+    req->method = p;
+    req->method_len = sp - p;
+    p = sp + 1;
+    sp = memchr(p, ' ', end - p);
+    if (!sp || sp == p || *p != '/') {
+        return HTTP_BAD;
+    }
+    const char *q = memchr(p, '?', sp - p);
+    req->path = p;
+    req->path_len = (q ? q : sp) - p;
+    req->query = q ? q + 1 : NULL;
+    req->query_len = q ? (size_t)(sp - q - 1) : 0;
+    p = sp + 1;
+    if (end - p != 8 || memcmp(p, "HTTP/1.", 7) != 0 || p[7] < '0' || p[7] > '9') {
+        return HTTP_BAD;
+    }
+    req->version_minor = p[7] - '0';
+    return 0;
+}
+
+static int parse_headers(const char *buf, size_t header_len, struct http_request *req) {
+    const char *p = buf;
+    const char *end = buf + header_len;
+    const char *nl = memchr(p, '\n', end - p);
+    int result = parse_request_line(p, trim_line(p, nl), req);
+    if (result != 0) {
+        return result;
+    }
+    req->keep_alive = req->version_minor >= 1;
+    req->content_length = 0;
+
+    for (p = nl + 1; p < end; p = nl + 1) {
+        nl = memchr(p, '\n', end - p);
+        const char *line_end = trim_line(p, nl);
+        if (line_end == p) {
+            break;
+        }
+        const char *colon = memchr(p, ':', line_end - p);
+        if (!colon) {
+            return HTTP_BAD;
+        }
+        const char *v = colon + 1;
+        while (v < line_end && (*v == ' ' || *v == '\t')) {
+            v++;
+        }
+        const char *v_end = line_end;
+        while (v_end > v && (v_end[-1] == ' ' || v_end[-1] == '\t')) {
+            v_end--;
+        }
+        size_t name_len = colon - p;
+        if (header_is(p, name_len, "connection")) {
+            if (value_has_token(v, v_end - v, "close")) {
+                req->keep_alive = 0;
+            } else if (value_has_token(v, v_end - v, "keep-alive")) {
+                req->keep_alive = 1;
+            }
+        } else if (header_is(p, name_len, "content-length")) {
+            size_t n = 0;
+            if (v == v_end) {
+                return HTTP_BAD;
+            }
+            for (; v < v_end; v++) {
+                if (*v < '0' || *v > '9') {
+                    return HTTP_BAD;
+                }
+                n = n * 10 + (*v - '0');
+                if (n > HTTP_MAX_BODY) {
+                    return HTTP_BODY_TOO_LARGE;
+                }
+            }
+            req->content_length = n;
+        } else if (header_is(p, name_len, "transfer-encoding")) {
+            return HTTP_UNSUPPORTED;
+        }
+    }
+    return 0;
+}
+
+int http_parse_request(const char *buf, size_t len, size_t *scanned, struct http_request *req) {
+    // 逐行找结尾的空行，*scanned总是停在一行的开头
+    size_t pos = *scanned;
+    size_t header_len = 0;
+    while (pos < len) {
+        const char *nl = memchr(buf + pos, '\n', len - pos);
+        if (!nl) {
+            break;
+        }
+        size_t line_len = nl - (buf + pos);
+        if (pos > 0 && (line_len == 0 || (line_len == 1 && buf[pos] == '\r'))) {
+            header_len = nl - buf + 1;
+            break;
+        }
+        pos = nl - buf + 1;
+    }
+    if (header_len == 0) {
+        *scanned = pos;
+        return len > HTTP_MAX_HEADER ? HTTP_HEADER_TOO_LARGE : HTTP_INCOMPLETE;
+    }
+    if (header_len > HTTP_MAX_HEADER) {
+        return HTTP_HEADER_TOO_LARGE;
+    }
+
+    int result = parse_headers(buf, header_len, req);
+    if (result != 0) {
+        return result;
+    }
+    req->header_len = header_len;
+    if (len < header_len + req->content_length) {
+        // 请求头已完整，只差请求体：下次从空行那一行开始，马上就能找到
+        *scanned = pos;
+        return HTTP_INCOMPLETE;
+    }
+    return (int)(header_len + req->content_length);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+int http_query_param(const struct http_request *req, const char *name, char *out, size_t cap) {
+    size_t name_len = strlen(name);
+    const char *p = req->query;
+    const char *end = req->query + req->query_len;
+
+    while (p && p < end) {
+        const char *amp = memchr(p, '&', end - p);
+        const char *param_end = amp ? amp : end;
+        if ((size_t)(param_end - p) > name_len && memcmp(p, name, name_len) == 0 && p[name_len] == '=') {
+            size_t n = 0;
+            for (const char *v = p + name_len + 1; v < param_end && n < cap; v++) {
+                if (*v == '+') {
+                    out[n++] = ' ';
+                } else if (*v == '%' && param_end - v >= 3 && hex_value(v[1]) >= 0 && hex_value(v[2]) >= 0) {
+                    out[n++] = (char)(hex_value(v[1]) * 16 + hex_value(v[2]));
+                    v += 2;
+                } else {
+                    out[n++] = *v;
+                }
+            }
+            return (int)n;
+        }
+        p = amp ? amp + 1 : NULL;
+    }
+    return -1;
+}
+
+const char* http_date_header(size_t *len) {
+    static char header[64];
+    static size_t header_len = 0;
+    static time_t formatted = 0;
+    time_t now = time(NULL);
+
+    if (now != formatted) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        header_len = strftime(header, sizeof(header), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        formatted = now;
+    }
+    *len = header_len;
+    return header;
+}
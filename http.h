@@ -0,0 +1,45 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stddef.h>
+
+// HTTP/1.1监听端口（-l port:http）用的最小请求解析，供wrk等通用压测工具使用
+// - 不拷贝：解析结果是指向接收缓冲区的指针和长度
+// - 增量：请求头没收全时记下已检查到的位置，下次从那里继续找空行，不重复扫描
+// - 只认识Connection、Content-Length、Transfer-Encoding三个请求头，其余跳过
+
+#define HTTP_MAX_HEADER 8192            // 请求行加请求头的最大字节数
+#define HTTP_MAX_BODY (1024 * 1024)     // 请求体（读掉丢弃）的最大字节数
+
+enum http_parse_result {
+    HTTP_INCOMPLETE = 0,                // 数据不够，等下次读取
+    HTTP_BAD = -1,                      // 格式错误（400）
+    HTTP_HEADER_TOO_LARGE = -2,         // 请求行加请求头超过HTTP_MAX_HEADER（431）
+    HTTP_BODY_TOO_LARGE = -3,           // Content-Length超过HTTP_MAX_BODY（413）
+    HTTP_UNSUPPORTED = -4,              // chunked请求体等不支持的特性（501）
+};
+
+struct http_request {
+    const char *method;
+    size_t method_len;
+    const char *path;                   // 不含查询串
+    size_t path_len;
+    const char *query;                  // '?'之后的部分，没有时为NULL
+    size_t query_len;
+    int version_minor;                  // HTTP/1.x的x
+    int keep_alive;                     // 回复后保持连接
+    size_t header_len;                  // 请求行和请求头（含结尾空行）的字节数
+    size_t content_length;
+};
+
+// 解析buf开头的一个请求；*scanned是上次已检查到的偏移（新请求从0开始），数据不够时更新它
+// 返回请求的总字节数（请求头+请求体），或enum http_parse_result
+int http_parse_request(const char *buf, size_t len, size_t *scanned, struct http_request *req);
+
+// 取查询参数name的值，做百分号解码（'+'解码为空格）写入out，返回长度；没有该参数返回-1
+int http_query_param(const struct http_request *req, const char *name, char *out, size_t cap);
+
+// "Date: ...\r\n"，每秒最多格式化一次
+const char* http_date_header(size_t *len);
+
+#endif
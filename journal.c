@@ -0,0 +1,369 @@
+#define _GNU_SOURCE // O_CLOEXEC, pthread, eventfd
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "journal.h"
+
+#define JOURNAL_MASK (JOURNAL_BUFFER_SIZE - 1)
+
+struct journal {
+    int fd;
+    int interval_ms;
+    int wake_fd;                        // 事件循环 -> 写线程：缓冲区过半或要停止
+    int event_fd;                       // 写线程 -> 事件循环：有新的已落盘序号
+    pthread_t thread;
+    char *buf;
+    // 生产者（事件循环）只写head和appended_seq，消费者（写线程）只写tail和synced_seq
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t appended_seq;              // head之前最后一条记录的序号
+    int wake_pending;                   // 已经叫醒过写线程，它取走数据前不再写wake_fd
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t synced_seq;
+    int failed;                         // fdatasync失败过，写线程置位后不再清除
+    int stopping;
+    struct journal_stats stats;         // records/bytes/dropped由事件循环更新，其余由写线程更新
+};
+
+struct journal_reader {
+    FILE *file;
+    char *data;
+    size_t data_cap;
+};
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    if (crc_table[1]) {
+        return;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// 记录头crc之后的字段和数据
+static uint32_t record_crc(const struct journal_header *hdr, const void *data) {
+    uint32_t crc = crc_update(0xFFFFFFFF, &hdr->seq, sizeof(*hdr) - offsetof(struct journal_header, seq));
+    return ~crc_update(crc, data, hdr->len);
+}
+
+static uint64_t clock_us(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 写入环形缓冲区的pos位置，跨过末尾时分两段
+static void ring_copy(struct journal *j, uint64_t pos, const void *data, size_t len) {
+    size_t offset = pos & JOURNAL_MASK;
+    size_t first = JOURNAL_BUFFER_SIZE - offset;
+    if (first >= len) {
+        memcpy(j->buf + offset, data, len);
+    } else {
+        memcpy(j->buf + offset, data, first);
+        memcpy(j->buf, (const char*)data + first, len - first);
+    }
+}
+
+// 把[tail, head)写进文件；出错时已写入的部分照样前进，下次从断点继续
+static int flush_range(struct journal *j, uint64_t head) {
+    while (j->tail < head) {
+        size_t offset = j->tail & JOURNAL_MASK;
+        size_t len = head - j->tail;
+        struct iovec iov[2];
+        int iovcnt = 1;
+        iov[0].iov_base = j->buf + offset;
+        iov[0].iov_len = len;
+        if (offset + len > JOURNAL_BUFFER_SIZE) {
+            iov[0].iov_len = JOURNAL_BUFFER_SIZE - offset;
+            iov[1].iov_base = j->buf;
+            iov[1].iov_len = len - iov[0].iov_len;
+            iovcnt = 2;
+        }
+        ssize_t n = writev(j->fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write journal");
+            return -1;
+        }
+        // 写进页缓存后这段缓冲区就可以给生产者复用了
+        __atomic_store_n(&j->tail, j->tail + n, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// 一次组提交：把当前缓冲区里的全部记录写出并fdatasync
+static void journal_commit(struct journal *j) {
+    // 先取序号再取head：生产者先发布head再发布序号，看到的序号对应的记录一定都在head之前
+    uint64_t seq = __atomic_load_n(&j->appended_seq, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&j->head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&j->wake_pending, 0, __ATOMIC_RELEASE);
+    if (seq == j->synced_seq || __atomic_load_n(&j->failed, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (flush_range(j, head) == -1) {
+        __atomic_fetch_add(&j->stats.errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    uint64_t start = clock_us(CLOCK_MONOTONIC);
+    uint64_t one = 1;
+    if (fdatasync(j->fd) == -1) {
+        // 写回失败的页已被标成干净，再同步一次也不代表落盘：不再前进序号，通知事件循环
+        perror("fdatasync journal");
+        __atomic_fetch_add(&j->stats.errors, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&j->failed, 1, __ATOMIC_RELEASE);
+        if (write(j->event_fd, &one, sizeof(one)) == -1) {
+            perror("write journal eventfd");
+        }
+        return;
+    }
+    unsigned long long batch = seq - j->synced_seq;
+    __atomic_fetch_add(&j->stats.sync_us, clock_us(CLOCK_MONOTONIC) - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&j->stats.batches, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&j->stats.synced_records, batch, __ATOMIC_RELAXED);
+    if (batch > __atomic_load_n(&j->stats.max_batch, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&j->stats.max_batch, batch, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&j->synced_seq, seq, __ATOMIC_RELEASE);
+
+    if (write(j->event_fd, &one, sizeof(one)) == -1) {
+        perror("write journal eventfd");
+    }
+}
+
+static void* journal_main(void *arg) {
+    struct journal *j = arg;
+    uint64_t next = clock_us(CLOCK_MONOTONIC) + (uint64_t)j->interval_ms * 1000;
+
+    while (!__atomic_load_n(&j->stopping, __ATOMIC_ACQUIRE)) {
+        uint64_t now = clock_us(CLOCK_MONOTONIC);
+        if (now < next) {
+            struct pollfd pfd = { .fd = j->wake_fd, .events = POLLIN };
+            int ready = poll(&pfd, 1, (int)((next - now + 999) / 1000));
+            if (ready > 0) {
+                // 缓冲区过半：不等间隔到期，马上提交
+                uint64_t count;
+                if (read(j->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+                    perror("read journal wake");
+                }
+            } else {
+                continue;
+            }
+        }
+        journal_commit(j);
+        next = clock_us(CLOCK_MONOTONIC) + (uint64_t)j->interval_ms * 1000;
+    }
+    // 停止前把剩下的记录也落盘
+    journal_commit(j);
+    return NULL;
+}
+
+struct journal* journal_open(const char *path, int interval_ms) {
+    struct journal *j = calloc(1, sizeof(*j));
+    if (!j) {
+        perror("calloc journal");
+        return NULL;
+    }
+    crc_init();
+    j->interval_ms = interval_ms > 0 ? interval_ms : 1;
+    j->wake_fd = j->event_fd = -1;
+    j->buf = malloc(JOURNAL_BUFFER_SIZE);
+    j->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (!j->buf || j->fd == -1) {
+        perror(j->buf ? "open journal" : "malloc journal buffer");
+        goto fail;
+    }
+    struct stat st;
+    if (fstat(j->fd, &st) == 0 && st.st_size == 0 &&
+        write(j->fd, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != (ssize_t)strlen(JOURNAL_MAGIC)) {
+        perror("write journal header");
+        goto fail;
+    }
+    j->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    j->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (j->wake_fd == -1 || j->event_fd == -1) {
+        perror("eventfd journal");
+        goto fail;
+    }
+    int err = pthread_create(&j->thread, NULL, journal_main, j);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create journal: %s\n", strerror(err));
+        goto fail;
+    }
+    return j;
+
+fail:
+    if (j->fd != -1) {
+        close(j->fd);
+    }
+    if (j->wake_fd != -1) {
+        close(j->wake_fd);
+    }
+    if (j->event_fd != -1) {
+        close(j->event_fd);
+    }
+    free(j->buf);
+    free(j);
+    return NULL;
+}
+
+void journal_close(struct journal *j) {
+    if (!j) {
+        return;
+    }
+    __atomic_store_n(&j->stopping, 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    if (write(j->wake_fd, &one, sizeof(one)) == -1) {
+        perror("write journal wake");
+    }
+    pthread_join(j->thread, NULL);
+    close(j->fd);
+    close(j->wake_fd);
+    close(j->event_fd);
+    free(j->buf);
+    free(j);
+}
+
+int journal_event_fd(const struct journal *j) {
+    return j->event_fd;
+}
+
+uint64_t journal_append(struct journal *j, uint8_t op, uint32_t addr, uint16_t port,
+                        const void *data, size_t len) {
+    size_t size = sizeof(struct journal_header) + len;
+    uint64_t tail = __atomic_load_n(&j->tail, __ATOMIC_ACQUIRE);
+    if (len > JOURNAL_MAX_DATA || __atomic_load_n(&j->failed, __ATOMIC_ACQUIRE) || j->head + size - tail > JOURNAL_BUFFER_SIZE) {
+        j->stats.dropped++;
+        return 0;
+    }
+
+    struct journal_header hdr = {
+        .len = (uint32_t)len,
+        .seq = j->appended_seq + 1,
+        .time_us = clock_us(CLOCK_REALTIME),
+        .addr = addr,
+        .port = port,
+        .op = op,
+    };
+    hdr.crc = record_crc(&hdr, data);
+    ring_copy(j, j->head, &hdr, sizeof(hdr));
+    if (len > 0) {
+        ring_copy(j, j->head + sizeof(hdr), data, len);
+    }
+    __atomic_store_n(&j->head, j->head + size, __ATOMIC_RELEASE);
+    __atomic_store_n(&j->appended_seq, hdr.seq, __ATOMIC_RELEASE);
+    j->stats.records++;
+    j->stats.bytes += size;
+
+    // 缓冲区过半才叫醒写线程，平时由它按间隔自己醒来
+    if (j->head - tail > JOURNAL_BUFFER_SIZE / 2 &&
+        !__atomic_exchange_n(&j->wake_pending, 1, __ATOMIC_ACQ_REL)) {
+        uint64_t one = 1;
+        if (write(j->wake_fd, &one, sizeof(one)) == -1) {
+            perror("write journal wake");
+        }
+    }
+    return hdr.seq;
+}
+
+uint64_t journal_synced(struct journal *j) {
+    uint64_t count;
+    if (read(j->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("read journal eventfd");
+    }
+    return __atomic_load_n(&j->synced_seq, __ATOMIC_ACQUIRE);
+}
+
+int journal_failed(const struct journal *j) {
+    return __atomic_load_n(&j->failed, __ATOMIC_ACQUIRE);
+}
+
+void journal_get_stats(const struct journal *j, struct journal_stats *stats) {
+    stats->records = j->stats.records;
+    stats->bytes = j->stats.bytes;
+    stats->dropped = j->stats.dropped;
+    stats->batches = __atomic_load_n(&j->stats.batches, __ATOMIC_RELAXED);
+    stats->synced_records = __atomic_load_n(&j->stats.synced_records, __ATOMIC_RELAXED);
+    stats->max_batch = __atomic_load_n(&j->stats.max_batch, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&j->stats.errors, __ATOMIC_RELAXED);
+    stats->sync_us = __atomic_load_n(&j->stats.sync_us, __ATOMIC_RELAXED);
+    stats->failed = journal_failed(j);
+    stats->synced_seq = __atomic_load_n(&j->synced_seq, __ATOMIC_ACQUIRE);
+}
+
+struct journal_reader* journal_reader_open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("fopen journal");
+        return NULL;
+    }
+    char magic[sizeof(JOURNAL_MAGIC)];
+    if (fread(magic, 1, strlen(JOURNAL_MAGIC), file) != strlen(JOURNAL_MAGIC) ||
+        memcmp(magic, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a journal file\n", path);
+        fclose(file);
+        return NULL;
+    }
+    struct journal_reader *reader = calloc(1, sizeof(*reader));
+    if (!reader) {
+        perror("calloc journal_reader");
+        fclose(file);
+        return NULL;
+    }
+    crc_init();
+    reader->file = file;
+    return reader;
+}
+
+void journal_reader_close(struct journal_reader *reader) {
+    if (!reader) {
+        return;
+    }
+    fclose(reader->file);
+    free(reader->data);
+    free(reader);
+}
+
+int journal_read(struct journal_reader *reader, struct journal_header *hdr, const char **data) {
+    if (fread(hdr, sizeof(*hdr), 1, reader->file) != 1 || hdr->len > JOURNAL_MAX_DATA) {
+        return 0;
+    }
+    if (hdr->len + 1 > reader->data_cap) {
+        char *grown = realloc(reader->data, hdr->len + 1);
+        if (!grown) {
+            perror("realloc journal data");
+            return 0;
+        }
+        reader->data = grown;
+        reader->data_cap = hdr->len + 1;
+    }
+    if (fread(reader->data, 1, hdr->len, reader->file) != hdr->len || record_crc(hdr, reader->data) != hdr->crc) {
+        return 0;
+    }
+    reader->data[hdr->len] = '\0';
+    *data = reader->data;
+    return 1;
+}
@@ -0,0 +1,82 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 变更和管理命令的审计日志（只追加），组提交
+// - 事件循环journal_append把记录拷进无锁环形缓冲区（单生产者单消费者，只用原子的head/tail同步），
+//   不加锁也不做系统调用；缓冲区超过一半时才写eventfd叫醒写线程
+// - 写线程每隔interval_ms把攒下的全部记录一次writev写进文件，再fdatasync一次：
+//   一次fsync落盘的是这段时间里的所有命令，而不是每条命令一次
+// - 每批同步完成后更新已落盘序号并写eventfd通知事件循环，事件循环据此放行等待持久化确认的回复
+// - 写入失败时数据留在缓冲区，下一个间隔重试；fdatasync失败是永久的：内核已经把写回失败的页标成干净，
+//   重试的fdatasync会“成功”却不保证数据在盘上，所以之后已落盘序号不再前进、也不再接受新记录，
+//   通知事件循环，由它断开还在等确认的连接
+// 文件格式：文件头JOURNAL_MAGIC（新文件才写），之后是一串记录，每条记录：
+//   struct journal_header（整数为本机字节序，地址和端口为网络字节序） + len字节数据
+// crc覆盖记录头crc之后的字段和数据；进程崩溃时末尾写了一半的记录CRC对不上，读取时当作文件结束
+// 序号在每个进程内从1递增
+
+#define JOURNAL_MAGIC "EPJRNL01"
+#define JOURNAL_BUFFER_SIZE (8 * 1024 * 1024)   // 环形缓冲区字节数，2的幂
+#define JOURNAL_MAX_DATA (64 * 1024)            // 单条记录数据的最大字节数
+#define JOURNAL_OP_TEXT 0                       // 文本命令行；其余op为二进制协议的opcode，数据为payload
+
+struct journal_header {
+    uint32_t len;           // 记录头之后的数据字节数
+    uint32_t crc;           // CRC32
+    uint64_t seq;
+    uint64_t time_us;       // CLOCK_REALTIME微秒
+    uint32_t addr;          // 客户端IPv4地址，0表示未知
+    uint16_t port;
+    uint8_t op;
+    uint8_t reserved;
+};
+
+struct journal_stats {
+    unsigned long long records;         // 追加成功的记录数
+    unsigned long long bytes;           // 追加成功的字节数（含记录头）
+    unsigned long long dropped;         // 缓冲区满追加失败的记录数
+    unsigned long long batches;         // 组提交次数（每次一个fdatasync）
+    unsigned long long synced_records;  // 已落盘的记录数
+    unsigned long long max_batch;       // 单次组提交的最多记录数
+    unsigned long long errors;          // 写入或同步失败次数
+    unsigned long long sync_us;         // fdatasync累计耗时
+    int failed;                         // fdatasync失败过，日志不再可用
+    uint64_t synced_seq;                // 已落盘的最大序号
+};
+
+struct journal;
+struct journal_reader;
+
+// 以追加方式打开（不存在则创建）日志文件并启动写线程，interval_ms为组提交间隔；失败返回NULL
+struct journal* journal_open(const char *path, int interval_ms);
+
+// 停止写线程：缓冲区里剩下的记录写完并同步后关闭文件
+void journal_close(struct journal *j);
+
+// 同步完成通知的eventfd，注册到epoll监听EPOLLIN
+int journal_event_fd(const struct journal *j);
+
+// 追加一条记录，返回它的序号；缓冲区满、数据过大或日志已失败返回0（记录不写入）
+uint64_t journal_append(struct journal *j, uint8_t op, uint32_t addr, uint16_t port,
+                        const void *data, size_t len);
+
+// 读掉eventfd计数，返回已落盘的最大序号（序号不大于它的记录都已fdatasync）
+uint64_t journal_synced(struct journal *j);
+
+// fdatasync是否失败过：为真时序号大于journal_synced的记录永远不会确认落盘
+int journal_failed(const struct journal *j);
+
+void journal_get_stats(const struct journal *j, struct journal_stats *stats);
+
+// 读取日志文件
+struct journal_reader* journal_reader_open(const char *path);
+void journal_reader_close(struct journal_reader *reader);
+
+// 读取下一条记录，data只在下一次journal_read之前有效
+// 返回值: 1=读到记录, 0=文件结束（包括末尾不完整或CRC不对的记录）
+int journal_read(struct journal_reader *reader, struct journal_header *hdr, const char **data);
+
+#endif
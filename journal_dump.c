@@ -0,0 +1,59 @@
+// 打印审计日志（epoll_server -j 写入）：每条记录一行
+// 用法: ./journal_dump journal_file
+#define _GNU_SOURCE // localtime_r
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "journal.h"
+
+// 二进制payload里的不可打印字节转义输出
+static void print_data(const char *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)data[i];
+        if (c >= 0x20 && c < 0x7F && c != '\\') {
+            putchar(c);
+        } else {
+            printf("\\x%02x", c);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s journal_file\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    struct journal_reader *reader = journal_reader_open(argv[1]);
+    if (!reader) {
+        return EXIT_FAILURE;
+    }
+
+    struct journal_header hdr;
+    const char *data;
+    unsigned long long count = 0;
+    while (journal_read(reader, &hdr, &data) == 1) {
+        time_t sec = hdr.time_us / 1000000;
+        struct tm tm_info;
+        char when[32];
+        char addr[INET_ADDRSTRLEN] = "-";
+        localtime_r(&sec, &tm_info);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm_info);
+        if (hdr.addr) {
+            inet_ntop(AF_INET, &hdr.addr, addr, sizeof(addr));
+        }
+        printf("%llu %s.%06llu %s:%d ", (unsigned long long)hdr.seq, when,
+               (unsigned long long)(hdr.time_us % 1000000), addr, ntohs(hdr.port));
+        if (hdr.op == JOURNAL_OP_TEXT) {
+            printf("%s\n", data);
+        } else {
+            printf("op=%d ", hdr.op);
+            print_data(data, hdr.len);
+            putchar('\n');
+        }
+        count++;
+    }
+    fprintf(stderr, "%llu records\n", count);
+    journal_reader_close(reader);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,550 @@
+#define _GNU_SOURCE // posix_memalign
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kv_store.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// 哈希表
+#define KV_GROUP_SIZE 16                 // 每组16个控制字节，一条SSE2指令比较完
+#define KV_CTRL_EMPTY ((int8_t)-128)     // 0x80：空槽，探测到这里就可以停止
+#define KV_CTRL_DELETED ((int8_t)-2)     // 0xFE：墓碑，探测需要继续
+                                         // 0..127：占用，值为哈希的低7位(h2)
+#define KV_MIN_CAPACITY 64
+#define KV_REHASH_STEP 64                // 每次操作从旧表迁移的槽数
+
+// slab分配器
+#define KV_PAGE_SIZE (1024 * 1024)       // 页按自身大小对齐，条目地址可以直接算出所在页
+#define KV_PAGE_HEADER 64
+#define KV_MIN_CHUNK 64
+#define KV_GROWTH_FACTOR 1.25
+#define KV_MAX_CLASSES 48
+
+#define ITEM_LINKED 0x01                 // 在哈希表中
+#define ITEM_REFERENCED 0x02             // 上次CLOCK扫描之后被访问过
+
+struct kv_item {
+    uint32_t hash;
+    uint32_t value_len;
+    uint32_t refs;                       // 发送队列等外部引用
+    uint16_t key_len;
+    uint8_t cls;                         // 所属大小级别
+    uint8_t flags;
+    char data[];                         // 键，紧跟着值
+};
+
+// 页头，后面是chunk_size大小的chunk数组
+struct kv_page {
+    struct kv_store *store;
+    uint32_t cls;
+    uint32_t used;                       // 已切出去的chunk数
+};
+
+struct kv_class {
+    size_t chunk_size;
+    size_t per_page;
+    struct kv_page **pages;
+    size_t page_count;
+    size_t page_cap;
+    struct kv_item *free_list;           // 空闲chunk，next指针存在data里
+    size_t hand_page;                    // CLOCK指针
+    size_t hand_idx;
+};
+
+struct kv_table {
+    int8_t *ctrl;
+    struct kv_item **slots;
+    size_t capacity;                     // 2的幂，且是KV_GROUP_SIZE的倍数；0表示不存在
+    size_t size;
+    size_t tombstones;
+};
+
+struct kv_store {
+    struct kv_table table;               // 当前表，所有插入都进这里
+    struct kv_table old;                 // 渐进式rehash中的旧表
+    size_t rehash_pos;                   // 旧表中下一个待迁移的槽
+    struct kv_class classes[KV_MAX_CLASSES];
+    int class_count;
+    size_t mem_used;
+    size_t mem_limit;
+    size_t items;
+    size_t retained;                     // 已摘除但仍被引用、等最后一次release回收的条目
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+};
+
+// 64位乘法/移位混合，最后折叠成32位：低7位做h2，其余位选组
+static uint32_t kv_hash(const char *key, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ (len * 0xff51afd7ed558ccdull);
+    uint64_t k;
+
+    while (len >= 8) {
+        memcpy(&k, key, 8);
+        h ^= k * 0xbf58476d1ce4e5b9ull;
+        h = ((h << 27) | (h >> 37)) * 0x94d049bb133111ebull;
+        key += 8;
+        len -= 8;
+    }
+    k = 0;
+    memcpy(&k, key, len);
+    h ^= k * 0xbf58476d1ce4e5b9ull;
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// 组内等于value的控制字节位图
+static inline uint32_t group_match(const int8_t *ctrl, int8_t value) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < KV_GROUP_SIZE; i++) {
+        if (ctrl[i] == value) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+// 组内空槽或墓碑的位图（两者最高位都是1）
+static inline uint32_t group_match_free(const int8_t *ctrl) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < KV_GROUP_SIZE; i++) {
+        if (ctrl[i] < 0) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static int table_init(struct kv_table *t, size_t capacity) {
+    t->ctrl = malloc(capacity);
+    t->slots = malloc(capacity * sizeof(*t->slots));
+    if (!t->ctrl || !t->slots) {
+        free(t->ctrl);
+        free(t->slots);
+        return -1;
+    }
+    memset(t->ctrl, (unsigned char)KV_CTRL_EMPTY, capacity);
+    t->capacity = capacity;
+    t->size = 0;
+    t->tombstones = 0;
+    return 0;
+}
+
+static void table_free(struct kv_table *t) {
+    free(t->ctrl);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+// 按组做三角探测（组数是2的幂，能遍历到所有组）
+// item不为NULL时按指针查找，否则按键查找；返回槽位，找不到返回-1
+static long table_find(const struct kv_table *t, uint32_t hash, const char *key, size_t key_len,
+                       const struct kv_item *item) {
+    if (t->capacity == 0) {
+        return -1;
+    }
+
+    size_t group_mask = t->capacity / KV_GROUP_SIZE - 1;
+    size_t g = (hash >> 7) & group_mask;
+    int8_t h2 = hash & 0x7f;
+
+    for (size_t step = 1; step <= group_mask + 1; step++) {
+        const int8_t *ctrl = t->ctrl + g * KV_GROUP_SIZE;
+        uint32_t match = group_match(ctrl, h2);
+        while (match) {
+            size_t idx = g * KV_GROUP_SIZE + __builtin_ctz(match);
+            const struct kv_item *candidate = t->slots[idx];
+            if (item ? candidate == item :
+                (candidate->hash == hash && candidate->key_len == key_len &&
+                 memcmp(candidate->data, key, key_len) == 0)) {
+                return (long)idx;
+            }
+            match &= match - 1;
+        }
+        if (group_match(ctrl, KV_CTRL_EMPTY)) {
+            return -1;
+        }
+        g = (g + step) & group_mask;
+    }
+    return -1;
+}
+
+// 插入到探测序列上第一个空槽或墓碑（调用方保证键不存在且表未满）
+static void table_insert(struct kv_table *t, struct kv_item *item) {
+    size_t group_mask = t->capacity / KV_GROUP_SIZE - 1;
+    size_t g = (item->hash >> 7) & group_mask;
+
+    for (size_t step = 1; ; step++) {
+        int8_t *ctrl = t->ctrl + g * KV_GROUP_SIZE;
+        uint32_t free_mask = group_match_free(ctrl);
+        if (free_mask) {
+            size_t idx = g * KV_GROUP_SIZE + __builtin_ctz(free_mask);
+            if (t->ctrl[idx] == KV_CTRL_DELETED) {
+                t->tombstones--;
+            }
+            t->ctrl[idx] = item->hash & 0x7f;
+            t->slots[idx] = item;
+            t->size++;
+            return;
+        }
+        g = (g + step) & group_mask;
+    }
+}
+
+static void table_remove(struct kv_table *t, size_t idx) {
+    t->ctrl[idx] = KV_CTRL_DELETED;
+    t->size--;
+    t->tombstones++;
+}
+
+// 从旧表迁移最多n个槽到当前表，迁移完释放旧表
+static void rehash_step(struct kv_store *s, size_t n) {
+    if (s->old.capacity == 0) {
+        return;
+    }
+
+    size_t end = s->rehash_pos + n;
+    if (end > s->old.capacity || end < s->rehash_pos) {
+        end = s->old.capacity;
+    }
+    for (; s->rehash_pos < end; s->rehash_pos++) {
+        size_t idx = s->rehash_pos;
+        if (s->old.ctrl[idx] >= 0) {
+            table_insert(&s->table, s->old.slots[idx]);
+            // 标记为墓碑而不是空槽，旧表里剩余条目的探测链不能断
+            table_remove(&s->old, idx);
+        }
+    }
+    if (s->rehash_pos == s->old.capacity) {
+        table_free(&s->old);
+    }
+}
+
+// 插入前检查负载（含墓碑）是否超过7/8，超过则开始新一轮渐进式rehash
+static int maybe_grow(struct kv_store *s) {
+    struct kv_table *t = &s->table;
+    if ((t->size + t->tombstones + 1) * 8 <= t->capacity * 7) {
+        return 0;
+    }
+
+    // 上一轮还没迁移完就一次做完（新表是旧表两倍大，很少发生）
+    rehash_step(s, (size_t)-1);
+
+    // 主要是墓碑时按原容量重建，否则翻倍
+    size_t capacity = t->size * 2 >= t->capacity ? t->capacity * 2 : t->capacity;
+    struct kv_table next;
+    if (table_init(&next, capacity) == -1) {
+        return -1;
+    }
+    s->old = s->table;
+    s->table = next;
+    s->rehash_pos = 0;
+    return 0;
+}
+
+static inline struct kv_item* chunk_at(const struct kv_class *c, struct kv_page *page, size_t idx) {
+    return (struct kv_item*)((char*)page + KV_PAGE_HEADER + idx * c->chunk_size);
+}
+
+static inline struct kv_page* page_of(const struct kv_item *item) {
+    return (struct kv_page*)((uintptr_t)item & ~(uintptr_t)(KV_PAGE_SIZE - 1));
+}
+
+// chunk归还给所属级别的空闲链表
+static void chunk_free(struct kv_store *s, struct kv_item *item) {
+    struct kv_class *c = &s->classes[item->cls];
+    item->flags = 0;
+    memcpy(item->data, &c->free_list, sizeof(c->free_list));
+    c->free_list = item;
+}
+
+// 从哈希表摘除条目；没有外部引用时立即回收
+static void item_unlink(struct kv_store *s, struct kv_table *t, size_t idx) {
+    struct kv_item *item = t->slots[idx];
+    table_remove(t, idx);
+    item->flags &= ~(ITEM_LINKED | ITEM_REFERENCED);
+    s->items--;
+    if (item->refs == 0) {
+        chunk_free(s, item);
+    } else {
+        s->retained++;
+    }
+}
+
+// 在当前表和旧表中查找键
+static struct kv_item* store_lookup(struct kv_store *s, uint32_t hash, const char *key, size_t key_len,
+                                    struct kv_table **table, long *idx) {
+    struct kv_table *tables[2] = { &s->table, &s->old };
+    for (int i = 0; i < 2; i++) {
+        long found = table_find(tables[i], hash, key, key_len, NULL);
+        if (found >= 0) {
+            *table = tables[i];
+            *idx = found;
+            return tables[i]->slots[found];
+        }
+    }
+    return NULL;
+}
+
+// CLOCK淘汰：指针扫过该级别的所有chunk，访问过的清掉标记放过，没访问过的淘汰
+// 扫两圈仍拿不到空闲chunk（都被发送队列引用着）时返回NULL
+static struct kv_item* clock_evict(struct kv_store *s, struct kv_class *c) {
+    size_t total = c->page_count * c->per_page;
+
+    for (size_t scanned = 0; scanned < 2 * total; scanned++) {
+        struct kv_page *page = c->pages[c->hand_page];
+        struct kv_item *item = chunk_at(c, page, c->hand_idx);
+        if (++c->hand_idx == page->used) {
+            c->hand_idx = 0;
+            c->hand_page = (c->hand_page + 1) % c->page_count;
+        }
+
+        if (!(item->flags & ITEM_LINKED)) {
+            continue; // 空闲，或已摘除但还被引用
+        }
+        if (item->flags & ITEM_REFERENCED) {
+            item->flags &= ~ITEM_REFERENCED;
+            continue;
+        }
+
+        struct kv_table *t = &s->table;
+        long idx = table_find(t, item->hash, NULL, 0, item);
+        if (idx < 0) {
+            t = &s->old;
+            idx = table_find(t, item->hash, NULL, 0, item);
+        }
+        if (idx < 0) {
+            continue;
+        }
+        item_unlink(s, t, idx);
+        s->evictions++;
+
+        if (c->free_list) {
+            break;
+        }
+    }
+
+    struct kv_item *item = c->free_list;
+    if (item) {
+        memcpy(&c->free_list, item->data, sizeof(c->free_list));
+    }
+    return item;
+}
+
+// 分配一个chunk：空闲链表 -> 当前页剩余 -> 新页（不超过内存上限）-> 淘汰
+// 每个级别至少能分到一页，所以总内存最多超出上限级别数个页
+static struct kv_item* chunk_alloc(struct kv_store *s, int cls) {
+    struct kv_class *c = &s->classes[cls];
+    struct kv_item *item = NULL;
+
+    if (c->free_list) {
+        item = c->free_list;
+        memcpy(&c->free_list, item->data, sizeof(c->free_list));
+    } else if (c->page_count > 0 && c->pages[c->page_count - 1]->used < c->per_page) {
+        struct kv_page *page = c->pages[c->page_count - 1];
+        item = chunk_at(c, page, page->used++);
+    } else if (s->mem_used + KV_PAGE_SIZE <= s->mem_limit || c->page_count == 0) {
+        void *mem;
+        if (c->page_count == c->page_cap) {
+            size_t cap = c->page_cap ? c->page_cap * 2 : 8;
+            struct kv_page **pages = realloc(c->pages, cap * sizeof(*pages));
+            if (!pages) {
+                return NULL;
+            }
+            c->pages = pages;
+            c->page_cap = cap;
+        }
+        if (posix_memalign(&mem, KV_PAGE_SIZE, KV_PAGE_SIZE) != 0) {
+            return NULL;
+        }
+        struct kv_page *page = mem;
+        page->store = s;
+        page->cls = cls;
+        page->used = 1;
+        c->pages[c->page_count++] = page;
+        s->mem_used += KV_PAGE_SIZE;
+        item = chunk_at(c, page, 0);
+    } else {
+        item = clock_evict(s, c);
+    }
+
+    if (item) {
+        item->cls = cls;
+        item->flags = 0;
+        item->refs = 0;
+    }
+    return item;
+}
+
+// 能放下size字节的最小级别
+static int class_for(const struct kv_store *s, size_t size) {
+    int lo = 0, hi = s->class_count - 1;
+    if (size > s->classes[hi].chunk_size) {
+        return -1;
+    }
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (s->classes[mid].chunk_size >= size) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+struct kv_store* kv_create(size_t mem_limit) {
+    struct kv_store *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    if (table_init(&s->table, KV_MIN_CAPACITY) == -1) {
+        free(s);
+        return NULL;
+    }
+    s->mem_limit = mem_limit;
+
+    // 级别大小按1.25倍递增（8字节对齐），最大一级一页只放一个chunk
+    size_t max_chunk = KV_PAGE_SIZE - KV_PAGE_HEADER;
+    size_t size = KV_MIN_CHUNK;
+    while (s->class_count < KV_MAX_CLASSES - 1 && size < max_chunk) {
+        s->classes[s->class_count++].chunk_size = size;
+        size = ((size_t)(size * KV_GROWTH_FACTOR) + 7) & ~(size_t)7;
+    }
+    s->classes[s->class_count++].chunk_size = max_chunk;
+    for (int i = 0; i < s->class_count; i++) {
+        s->classes[i].per_page = max_chunk / s->classes[i].chunk_size;
+    }
+    return s;
+}
+
+void kv_destroy(struct kv_store *s) {
+    if (!s) {
+        return;
+    }
+    for (int i = 0; i < s->class_count; i++) {
+        for (size_t p = 0; p < s->classes[i].page_count; p++) {
+            free(s->classes[i].pages[p]);
+        }
+        free(s->classes[i].pages);
+    }
+    table_free(&s->table);
+    table_free(&s->old);
+    free(s);
+}
+
+int kv_set(struct kv_store *s, const char *key, size_t key_len,
+           const char *value, size_t value_len) {
+    if (key_len == 0 || key_len > KV_MAX_KEY_LEN || value_len > UINT32_MAX) {
+        return -1;
+    }
+    int cls = class_for(s, sizeof(struct kv_item) + key_len + value_len);
+    if (cls < 0) {
+        return -1;
+    }
+
+    uint32_t hash = kv_hash(key, key_len);
+    rehash_step(s, KV_REHASH_STEP);
+
+    // 先分配再替换：分配失败时旧值保留
+    struct kv_item *item = chunk_alloc(s, cls);
+    if (!item) {
+        return -1;
+    }
+    item->hash = hash;
+    item->key_len = key_len;
+    item->value_len = value_len;
+    memcpy(item->data, key, key_len);
+    memcpy(item->data + key_len, value, value_len);
+
+    // 扩容也要在摘除旧值之前：新表分配失败时同样保留旧值
+    if (maybe_grow(s) == -1) {
+        chunk_free(s, item);
+        return -1;
+    }
+
+    struct kv_table *t;
+    long idx;
+    if (store_lookup(s, hash, key, key_len, &t, &idx)) {
+        item_unlink(s, t, idx);
+    }
+    table_insert(&s->table, item);
+    item->flags = ITEM_LINKED;
+    s->items++;
+    return 0;
+}
+
+struct kv_item* kv_get(struct kv_store *s, const char *key, size_t key_len) {
+    struct kv_table *t;
+    long idx;
+
+    rehash_step(s, KV_REHASH_STEP);
+    struct kv_item *item = store_lookup(s, kv_hash(key, key_len), key, key_len, &t, &idx);
+    if (!item) {
+        s->misses++;
+        return NULL;
+    }
+    item->flags |= ITEM_REFERENCED;
+    s->hits++;
+    return item;
+}
+
+int kv_del(struct kv_store *s, const char *key, size_t key_len) {
+    struct kv_table *t;
+    long idx;
+
+    rehash_step(s, KV_REHASH_STEP);
+    if (!store_lookup(s, kv_hash(key, key_len), key, key_len, &t, &idx)) {
+        return 0;
+    }
+    item_unlink(s, t, idx);
+    return 1;
+}
+
+const char* kv_item_value(const struct kv_item *item, size_t *len) {
+    *len = item->value_len;
+    return item->data + item->key_len;
+}
+
+void kv_item_retain(void *p) {
+    struct kv_item *item = p;
+    item->refs++;
+}
+
+void kv_item_release(void *p) {
+    struct kv_item *item = p;
+    if (--item->refs == 0 && !(item->flags & ITEM_LINKED)) {
+        struct kv_store *s = page_of(item)->store;
+        s->retained--;
+        chunk_free(s, item);
+    }
+}
+
+void kv_get_stats(const struct kv_store *s, struct kv_stats *stats) {
+    stats->items = s->items;
+    stats->retained = s->retained;
+    stats->mem_used = s->mem_used;
+    stats->mem_limit = s->mem_limit;
+    stats->table_capacity = s->table.capacity;
+    stats->rehashing = s->old.capacity != 0;
+    stats->hits = s->hits;
+    stats->misses = s->misses;
+    stats->evictions = s->evictions;
+}
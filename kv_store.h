@@ -0,0 +1,54 @@
+#ifndef KV_STORE_H
+#define KV_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 内存键值存储：
+// - 开放寻址哈希表，每16个槽一组，组内用SSE2一次比较16个控制字节
+// - 键和值放在slab分配器里（按大小分级的1MB页），不单独malloc
+// - 扩容时渐进式rehash，每次操作只迁移一小批槽，不会因为扩容卡住某个请求
+// - 内存上限 + 每个大小级别一个CLOCK指针做近似LRU淘汰
+// - 条目带引用计数：发送队列可以直接引用值的内存，不用拷贝
+
+#define KV_MAX_KEY_LEN 250
+
+struct kv_store;
+struct kv_item;
+
+struct kv_stats {
+    size_t items;
+    size_t retained;            // 已删除或被覆盖、仍被发送队列引用的条目
+    size_t mem_used;            // 已分配的slab页字节数
+    size_t mem_limit;
+    size_t table_capacity;
+    int rehashing;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+};
+
+// 创建存储，mem_limit为slab页总字节数上限
+struct kv_store* kv_create(size_t mem_limit);
+void kv_destroy(struct kv_store *store);
+
+// 写入/覆盖；返回0成功，-1失败（键或值过大、内存不足且无法淘汰）
+int kv_set(struct kv_store *store, const char *key, size_t key_len,
+           const char *value, size_t value_len);
+
+// 查找，未找到返回NULL；返回的条目只在下一次修改存储之前有效，
+// 需要跨事件持有（例如放进发送队列）时先kv_item_retain
+struct kv_item* kv_get(struct kv_store *store, const char *key, size_t key_len);
+
+// 删除；返回1已删除，0不存在
+int kv_del(struct kv_store *store, const char *key, size_t key_len);
+
+const char* kv_item_value(const struct kv_item *item, size_t *len);
+
+// 引用计数；被删除/覆盖/淘汰的条目在最后一个引用释放后才回收内存
+void kv_item_retain(void *item);
+void kv_item_release(void *item);
+
+void kv_get_stats(const struct kv_store *store, struct kv_stats *stats);
+
+#endif
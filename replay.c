@@ -0,0 +1,484 @@
+#define _GNU_SOURCE // SOCK_NONBLOCK, SOCK_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "capture.h"
+
+// 按录制文件（epoll_server -c）的时间线重放流量：
+// 每个录制的连接对应一个新连接，按原来的时间间隔（或N倍速、全速）发出同样的字节，
+// 连接的并发关系和每个连接内的字节顺序都和录制时一致
+// 延迟：连接上发出数据到收到第一个回复字节的时间（回复边界由协议决定，这里不解析）
+
+#define REPLAY_MAX_EVENTS 256
+#define REPLAY_BATCH 256            // 每轮最多执行的记录数，之间处理一次网络事件
+#define REPLAY_READ_SIZE (64 * 1024)
+#define DEFAULT_LINGER 5            // 录制结束后等待未关闭连接的秒数
+#define REPLAY_CLOSE_QUIET_MS 50    // 录制里已关闭的连接：数据发完且这么久没有收发后再关闭
+
+struct replay_conn {
+    uint64_t id;
+    int fd;
+    int connected;
+    int closing;                    // 录制里客户端已经关闭，等回复收完再关闭
+    char *out;                      // 还没写进socket的数据
+    size_t out_len;
+    size_t out_off;
+    size_t out_cap;
+    uint64_t pending_since;         // 已发出、还没收到回复的第一份数据的时间，0表示没有
+    uint64_t last_io;               // 最近一次收发数据的时间
+};
+
+struct replay_stats {
+    unsigned long long records;
+    unsigned long long connections;
+    unsigned long long connect_errors;
+    unsigned long long server_closed;   // 录制里没有关闭、重放时被服务器关闭的连接
+    unsigned long long bytes_sent;
+    unsigned long long bytes_received;
+    uint64_t max_lag_us;                // 记录执行时间落后于计划时间的最大值
+};
+
+static int epoll_fd = -1;
+static struct sockaddr_in target;
+static int target_port = 0;             // 0表示使用录制时的端口
+static struct replay_conn **conns = NULL;   // 按录制的连接编号索引
+static size_t conns_size = 0;
+static int open_count = 0;
+static uint32_t *latencies = NULL;
+static size_t latency_count = 0;
+static size_t latency_cap = 0;
+static uint64_t *closing_ids = NULL;    // 等待关闭的连接
+static size_t closing_count = 0;
+static size_t closing_cap = 0;
+static FILE *csv = NULL;
+static uint64_t start_us;
+static struct replay_stats stats;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void record_latency(struct replay_conn *c, uint64_t now) {
+    uint64_t latency = now - c->pending_since;
+    c->pending_since = 0;
+    if (latency_count == latency_cap) {
+        size_t cap = latency_cap ? latency_cap * 2 : 65536;
+        uint32_t *p = realloc(latencies, cap * sizeof(*p));
+        if (!p) {
+            perror("realloc latencies");
+            return;
+        }
+        latencies = p;
+        latency_cap = cap;
+    }
+    latencies[latency_count++] = latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency;
+    if (csv) {
+        fprintf(csv, "%llu,%llu,%llu\n", (unsigned long long)c->id,
+                (unsigned long long)(now - start_us), (unsigned long long)latency);
+    }
+}
+
+static void conn_destroy(struct replay_conn *c) {
+    close(c->fd);
+    conns[c->id] = NULL;
+    free(c->out);
+    free(c);
+    open_count--;
+}
+
+// 把待发数据写进socket
+// 返回值: 0=正常（可能还有数据等EPOLLOUT）, -1=连接出错
+static int conn_flush(struct replay_conn *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        c->out_off += n;
+        stats.bytes_sent += n;
+        c->last_io = now_us();
+        if (!c->pending_since) {
+            c->pending_since = c->last_io;
+        }
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+static void replay_open(const struct capture_record *rec) {
+    if (rec->conn >= conns_size) {
+        size_t size = conns_size ? conns_size : 1024;
+        while (size <= rec->conn) {
+            size *= 2;
+        }
+        struct replay_conn **table = realloc(conns, size * sizeof(*table));
+        if (!table) {
+            perror("realloc conns");
+            return;
+        }
+        memset(table + conns_size, 0, (size - conns_size) * sizeof(*table));
+        conns = table;
+        conns_size = size;
+    }
+
+    struct replay_conn *c = calloc(1, sizeof(*c));
+    if (!c) {
+        perror("calloc replay_conn");
+        return;
+    }
+    c->id = rec->conn;
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd == -1) {
+        perror("socket");
+        free(c);
+        stats.connect_errors++;
+        return;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in addr = target;
+    addr.sin_port = htons(target_port ? target_port : rec->port);
+    if (connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+        perror("connect");
+        close(c->fd);
+        free(c);
+        stats.connect_errors++;
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = c;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &event) == -1) {
+        perror("epoll_ctl");
+        close(c->fd);
+        free(c);
+        stats.connect_errors++;
+        return;
+    }
+    conns[c->id] = c;
+    open_count++;
+    stats.connections++;
+}
+
+static void replay_data(const struct capture_record *rec) {
+    struct replay_conn *c = rec->conn < conns_size ? conns[rec->conn] : NULL;
+    if (!c) {
+        // 连接失败或已被服务器关闭
+        return;
+    }
+    if (c->out_len + rec->len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + rec->len) {
+            cap *= 2;
+        }
+        char *out = realloc(c->out, cap);
+        if (!out) {
+            perror("realloc out");
+            return;
+        }
+        c->out = out;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, rec->data, rec->len);
+    c->out_len += rec->len;
+    if (c->connected && conn_flush(c) == -1) {
+        conn_destroy(c);
+    }
+}
+
+static void replay_close(const struct capture_record *rec) {
+    struct replay_conn *c = rec->conn < conns_size ? conns[rec->conn] : NULL;
+    if (!c) {
+        return;
+    }
+    if (closing_count == closing_cap) {
+        size_t cap = closing_cap ? closing_cap * 2 : 1024;
+        uint64_t *ids = realloc(closing_ids, cap * sizeof(*ids));
+        if (!ids) {
+            perror("realloc closing_ids");
+            return;
+        }
+        closing_ids = ids;
+        closing_cap = cap;
+    }
+    c->closing = 1;
+    closing_ids[closing_count++] = c->id;
+}
+
+// 录制里的关闭发生在客户端收完回复之后，重放时也要等回复收完；
+// 不能提前shutdown(SHUT_WR)：服务器看到EPOLLRDHUP会直接关闭连接，没处理的请求和回复都会丢失
+// 回复的边界由协议决定，这里用“数据已发完并且一段时间没有收发”近似
+static void close_quiet_conns(uint64_t now) {
+    size_t kept = 0;
+    for (size_t i = 0; i < closing_count; i++) {
+        struct replay_conn *c = conns[closing_ids[i]];
+        if (!c) {
+            continue;
+        }
+        if (c->connected && c->out_len == 0 && now - c->last_io >= REPLAY_CLOSE_QUIET_MS * 1000) {
+            conn_destroy(c);
+            continue;
+        }
+        closing_ids[kept++] = closing_ids[i];
+    }
+    closing_count = kept;
+}
+
+static void handle_event(struct replay_conn *c, uint32_t events) {
+    if (!c->connected) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+            fprintf(stderr, "connect: %s\n", strerror(err ? err : errno));
+            stats.connect_errors++;
+            conn_destroy(c);
+            return;
+        }
+        if (!(events & (EPOLLOUT | EPOLLIN))) {
+            return;
+        }
+        c->connected = 1;
+        events |= EPOLLOUT;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        static char buf[REPLAY_READ_SIZE];
+        while (1) {
+            ssize_t n = read(c->fd, buf, sizeof(buf));
+            if (n > 0) {
+                stats.bytes_received += n;
+                c->last_io = now_us();
+                if (c->pending_since) {
+                    record_latency(c, c->last_io);
+                }
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (!c->closing) {
+                stats.server_closed++;
+            }
+            conn_destroy(c);
+            return;
+        }
+    }
+
+    if ((events & EPOLLOUT) && conn_flush(c) == -1) {
+        conn_destroy(c);
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_report(uint64_t elapsed_us) {
+    printf("replayed %llu records in %.3f s: connections=%llu connect_errors=%llu server_closed=%llu\n",
+           stats.records, elapsed_us / 1e6, stats.connections, stats.connect_errors, stats.server_closed);
+    printf("bytes: sent=%llu received=%llu\n", stats.bytes_sent, stats.bytes_received);
+    printf("max lag behind schedule: %.3f ms%s\n", stats.max_lag_us / 1e3,
+           stats.max_lag_us > 10000 ? " (replayer could not keep up, timings are compressed)" : "");
+    if (latency_count == 0) {
+        printf("latency: no replies\n");
+        return;
+    }
+    qsort(latencies, latency_count, sizeof(*latencies), compare_u32);
+    printf("latency_us: samples=%zu p50=%u p90=%u p99=%u p999=%u max=%u\n", latency_count,
+           latencies[latency_count * 50 / 100], latencies[latency_count * 90 / 100],
+           latencies[latency_count * 99 / 100], latencies[latency_count * 999 / 1000],
+           latencies[latency_count - 1]);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s speed] [-H host] [-p port] [-t seconds] [-o latencies.csv] capture_file\n", prog);
+    fprintf(stderr, "  -s speed         1 = recorded pace (default), 2 = twice as fast, 0 or max = no waiting\n");
+    fprintf(stderr, "  -H host          server to replay against (default: 127.0.0.1)\n");
+    fprintf(stderr, "  -p port          send every connection to this port (default: the recorded port)\n");
+    fprintf(stderr, "  -t seconds       after the last record, wait this long for open connections (default: %d)\n", DEFAULT_LINGER);
+    fprintf(stderr, "  -o file          write conn,offset_us,latency_us for every reply\n");
+}
+
+int main(int argc, char *argv[]) {
+    double speed = 1;
+    const char *host = "127.0.0.1";
+    int linger = DEFAULT_LINGER;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:H:p:t:o:h")) != -1) {
+        switch (opt) {
+        case 's':
+            speed = strcmp(optarg, "max") == 0 ? 0 : atof(optarg);
+            if (speed < 0) {
+                fprintf(stderr, "Invalid speed: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            target_port = atoi(optarg);
+            if (target_port <= 0 || target_port > 65535) {
+                fprintf(stderr, "Invalid port number: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            linger = atoi(optarg);
+            break;
+        case 'o':
+            csv = fopen(optarg, "w");
+            if (!csv) {
+                perror(optarg);
+                exit(EXIT_FAILURE);
+            }
+            fprintf(csv, "conn,offset_us,latency_us\n");
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    memcpy(&target, res->ai_addr, sizeof(target));
+    freeaddrinfo(res);
+
+    struct capture_reader *reader = capture_reader_open(argv[optind]);
+    if (!reader) {
+        exit(EXIT_FAILURE);
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    struct capture_record rec;
+    int have = capture_read(reader, &rec);
+    uint64_t first_us = have == 1 ? rec.time_us : 0;
+    uint64_t linger_deadline = 0;
+    struct epoll_event events[REPLAY_MAX_EVENTS];
+    start_us = now_us();
+
+    while (have == 1 || open_count > 0) {
+        uint64_t now = now_us();
+        int timeout;
+
+        if (have == 1) {
+            // 执行已经到时间的记录；全速时每轮执行一批，中间照常处理回复
+            int batch = 0;
+            while (have == 1 && batch < REPLAY_BATCH) {
+                uint64_t due = speed > 0 ? start_us + (uint64_t)((rec.time_us - first_us) / speed) : now;
+                if (due > now) {
+                    break;
+                }
+                if (now - due > stats.max_lag_us) {
+                    stats.max_lag_us = now - due;
+                }
+                if (rec.type == CAPTURE_OPEN) {
+                    replay_open(&rec);
+                } else if (rec.type == CAPTURE_DATA) {
+                    replay_data(&rec);
+                } else {
+                    replay_close(&rec);
+                }
+                stats.records++;
+                batch++;
+                have = capture_read(reader, &rec);
+                now = now_us();
+            }
+            if (have == -1) {
+                fprintf(stderr, "Stopping at the malformed record\n");
+            }
+            timeout = 0;
+            if (have == 1 && batch < REPLAY_BATCH && speed > 0) {
+                uint64_t due = start_us + (uint64_t)((rec.time_us - first_us) / speed);
+                // 不足1ms的等待直接进入下一轮，最多提前1ms发出
+                timeout = due > now ? (int)((due - now) / 1000) : 0;
+            }
+        } else {
+            if (!linger_deadline) {
+                linger_deadline = now + (uint64_t)linger * 1000000;
+            }
+            if (now >= linger_deadline) {
+                break;
+            }
+            timeout = (int)((linger_deadline - now) / 1000);
+        }
+        if (closing_count > 0 && (timeout == -1 || timeout > REPLAY_CLOSE_QUIET_MS)) {
+            timeout = REPLAY_CLOSE_QUIET_MS;
+        }
+
+        int nfds = epoll_wait(epoll_fd, events, REPLAY_MAX_EVENTS, timeout);
+        if (nfds == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < nfds; i++) {
+            handle_event(events[i].data.ptr, events[i].events);
+        }
+        close_quiet_conns(now_us());
+    }
+    uint64_t elapsed = now_us() - start_us;
+
+    if (open_count > 0) {
+        printf("closing %d connections still open after %d s\n", open_count, linger);
+    }
+    for (size_t i = 0; i < conns_size; i++) {
+        if (conns[i]) {
+            conn_destroy(conns[i]);
+        }
+    }
+    print_report(elapsed);
+
+    if (csv) {
+        fclose(csv);
+    }
+    capture_reader_close(reader);
+    close(epoll_fd);
+    free(conns);
+    free(closing_ids);
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <string.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef size_t (*scan_fn)(const char *buf, size_t len, char c, uint32_t *pos, size_t max, size_t *scanned);
+
+// 从start开始逐字节扫描剩余部分，n为已找到的个数（调用方保证n < max）
+static size_t scan_tail(const char *buf, size_t len, size_t start, char c,
+                        uint32_t *pos, size_t n, size_t max, size_t *scanned) {
+    for (size_t i = start; i < len; i++) {
+        if (buf[i] == c) {
+            pos[n++] = (uint32_t)i;
+            if (n == max) {
+                *scanned = i + 1;
+                return n;
+            }
+        }
+    }
+    *scanned = len;
+    return n;
+}
+
+static size_t scan_scalar(const char *buf, size_t len, char c, uint32_t *pos, size_t max, size_t *scanned) {
+    if (max == 0) {
+        *scanned = 0;
+        return 0;
+    }
+    return scan_tail(buf, len, 0, c, pos, 0, max, scanned);
+}
+
+#ifdef SCAN_X86
+// 把比较结果的位掩码展开成位置，找满max个时直接返回
+#define SCAN_EMIT_MASK(mask, base)                              \
+    while (mask) {                                              \
+        pos[n++] = (uint32_t)((base) + __builtin_ctzll(mask));  \
+        if (n == max) {                                         \
+            *scanned = pos[n - 1] + 1;                          \
+            return n;                                           \
+        }                                                       \
+        mask &= mask - 1;                                       \
+    }
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char *buf, size_t len, char c, uint32_t *pos, size_t max, size_t *scanned) {
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t n = 0, i = 0;
+    if (max == 0) {
+        *scanned = 0;
+        return 0;
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(buf + i));
+        uint64_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        SCAN_EMIT_MASK(mask, i);
+    }
+    return scan_tail(buf, len, i, c, pos, n, max, scanned);
+}
+
+// 每次处理64字节：两次32字节比较合成一个64位掩码，分隔符稀疏时大多数轮次只有一次判断
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *buf, size_t len, char c, uint32_t *pos, size_t max, size_t *scanned) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t n = 0, i = 0;
+    if (max == 0) {
+        *scanned = 0;
+        return 0;
+    }
+    for (; i + 64 <= len; i += 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(buf + i + 32));
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle)) |
+                        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle)) << 32;
+        SCAN_EMIT_MASK(mask, i);
+    }
+    // 不足64字节的部分（短命令行的常见情况）先按32、16字节处理，剩下的才逐字节
+    if (i + 32 <= len) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(buf + i));
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        SCAN_EMIT_MASK(mask, i);
+        i += 32;
+    }
+    if (i + 16 <= len) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(buf + i));
+        uint64_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm256_castsi256_si128(needle)));
+        SCAN_EMIT_MASK(mask, i);
+        i += 16;
+    }
+    return scan_tail(buf, len, i, c, pos, n, max, scanned);
+}
+#endif
+
+struct scan_kernel {
+    const char *name;
+    scan_fn fn;
+    const char *cpu_feature;    // __builtin_cpu_supports的参数，NULL表示总是可用
+};
+
+static const struct scan_kernel kernels[] = {
+#ifdef SCAN_X86
+    { "avx2", scan_avx2, "avx2" },
+    { "sse2", scan_sse2, "sse2" },
+#endif
+    { "scalar", scan_scalar, NULL },
+};
+
+static const struct scan_kernel *current = NULL;
+
+static int kernel_supported(const struct scan_kernel *k) {
+#ifdef SCAN_X86
+    if (k->cpu_feature) {
+        __builtin_cpu_init();
+        // __builtin_cpu_supports只接受字符串常量
+        if (strcmp(k->cpu_feature, "avx2") == 0) {
+            return __builtin_cpu_supports("avx2");
+        }
+        if (strcmp(k->cpu_feature, "sse2") == 0) {
+            return __builtin_cpu_supports("sse2");
+        }
+        return 0;
+    }
+#endif
+    return k->cpu_feature == NULL;
+}
+
+// 第一次调用时选出CPU支持的最快实现
+static const struct scan_kernel* scan_current(void) {
+    if (!current) {
+        for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+            if (kernel_supported(&kernels[i])) {
+                current = &kernels[i];
+                break;
+            }
+        }
+    }
+    return current;
+}
+
+size_t scan_byte(const char *buf, size_t len, char c, uint32_t *pos, size_t max, size_t *scanned) {
+    return scan_current()->fn(buf, len, c, pos, max, scanned);
+}
+
+const char* scan_kernel_name(void) {
+    return scan_current()->name;
+}
+
+int scan_select_kernel(const char *name) {
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(kernels[i].name, name) == 0 && kernel_supported(&kernels[i])) {
+            current = &kernels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,24 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 批量查找分隔符：一次扫描找出缓冲区里某个字节的所有位置，
+// 供文本协议切分流水线请求（'\n'）和切分参数（' '）使用
+// - x86上按CPU在运行时选择AVX2（每次64字节）或SSE2（每次16字节）实现，其他平台逐字节扫描
+// - 结果写进调用者的数组，找满max个就停下，*scanned返回已扫描的长度，从那里继续
+
+#define SCAN_BATCH 256              // 调用者一次取多少个位置的建议值
+
+// 在buf[0, len)中查找字节c，位置（相对buf）依次写入pos，最多max个，返回找到的个数
+// *scanned: 找满max个时为最后一个位置+1，否则为len
+size_t scan_byte(const char *buf, size_t len, char c, uint32_t *pos, size_t max, size_t *scanned);
+
+// 当前使用的实现："avx2"、"sse2"或"scalar"
+const char* scan_kernel_name(void);
+
+// 指定实现（基准测试对比用）；CPU不支持时返回-1，不改变当前实现
+int scan_select_kernel(const char *name);
+
+#endif
@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "scan.h"
+
+// 请求切分的微基准：生成流水线文本命令（ping/get/set/mget混合）放在一块缓冲区里，
+// 分别用逐条memchr（原来的做法）和scan_byte的各个实现切分整块缓冲区，
+// 报告每秒命令数、GB/s和每个TSC周期处理的字节数
+// framing: 只找换行；framing+tokens: 再对每一行找出所有空格（切分参数）
+
+#define DEFAULT_BUFFER_MB 4
+#define DEFAULT_ROUNDS 50
+
+static uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 生成size字节左右的流水线命令，返回命令数
+static size_t generate(char *buf, size_t size, size_t *used) {
+    size_t len = 0, commands = 0;
+    unsigned int seed = 12345;
+    char line[256];
+
+    while (1) {
+        int n;
+        unsigned int r = rand_r(&seed);
+        switch (r % 4) {
+        case 0:
+            n = snprintf(line, sizeof(line), "ping\n");
+            break;
+        case 1:
+            n = snprintf(line, sizeof(line), "get user:%06u\n", r % 1000000);
+            break;
+        case 2:
+            n = snprintf(line, sizeof(line), "set user:%06u %.*s\n", r % 1000000, 16 + (int)(r % 48),
+                         "vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv");
+            break;
+        default:
+            n = snprintf(line, sizeof(line), "mget user:%06u user:%06u user:%06u user:%06u\n",
+                         r % 1000, r % 1001, r % 1002, r % 1003);
+            break;
+        }
+        if (len + n > size) {
+            break;
+        }
+        memcpy(buf + len, line, n);
+        len += n;
+        commands++;
+    }
+    *used = len;
+    return commands;
+}
+
+// 原来的做法：每条命令一次memchr找换行，再逐字节找空格
+static size_t frame_memchr(const char *buf, size_t len, int tokens, size_t *spaces) {
+    size_t lines = 0, pos = 0;
+    while (pos < len) {
+        const char *nl = memchr(buf + pos, '\n', len - pos);
+        if (!nl) {
+            break;
+        }
+        if (tokens) {
+            for (const char *p = buf + pos; p < nl; p++) {
+                *spaces += *p == ' ';
+            }
+        }
+        lines++;
+        pos = nl - buf + 1;
+    }
+    return lines;
+}
+
+// 和epoll_server的process_input一样：一次取一批换行位置，再逐条处理
+static size_t frame_scan(const char *buf, size_t len, int tokens, size_t *spaces) {
+    uint32_t nl[SCAN_BATCH];
+    uint32_t sp[SCAN_BATCH];
+    size_t lines = 0, base = 0, line_start = 0;
+
+    while (base < len) {
+        size_t scanned;
+        size_t count = scan_byte(buf + base, len - base, '\n', nl, SCAN_BATCH, &scanned);
+        for (size_t i = 0; i < count; i++) {
+            size_t end = base + nl[i];
+            if (tokens) {
+                size_t done;
+                *spaces += scan_byte(buf + line_start, end - line_start, ' ', sp, SCAN_BATCH, &done);
+            }
+            line_start = end + 1;
+            lines++;
+        }
+        base += scanned;
+    }
+    return lines;
+}
+
+static void run(const char *name, const char *buf, size_t len, size_t commands, int rounds, int tokens) {
+    size_t lines = 0, spaces = 0;
+    int use_memchr = strcmp(name, "memchr") == 0;
+
+    // 预热一轮
+    use_memchr ? frame_memchr(buf, len, tokens, &spaces) : frame_scan(buf, len, tokens, &spaces);
+    spaces = 0;
+
+    double t0 = now_sec();
+    uint64_t c0 = cycles();
+    for (int i = 0; i < rounds; i++) {
+        lines += use_memchr ? frame_memchr(buf, len, tokens, &spaces) : frame_scan(buf, len, tokens, &spaces);
+    }
+    uint64_t c1 = cycles();
+    double elapsed = now_sec() - t0;
+
+    if (lines != commands * rounds) {
+        fprintf(stderr, "%s: found %zu lines, expected %zu\n", name, lines, commands * rounds);
+        exit(EXIT_FAILURE);
+    }
+    double bytes = (double)len * rounds;
+    printf("%-16s %-7s %10.1f %8.2f %8.2f %8.1f\n", tokens ? "framing+tokens" : "framing", name,
+           lines / elapsed / 1e6, bytes / elapsed / 1e9, bytes / (c1 - c0),
+           (c1 - c0) / (double)lines);
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = DEFAULT_BUFFER_MB * 1024 * 1024;
+    int rounds = DEFAULT_ROUNDS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:h")) != -1) {
+        switch (opt) {
+        case 's':
+            size = strtoul(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s buffer_MB] [-n rounds]\n", argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (size == 0 || rounds <= 0) {
+        fprintf(stderr, "Invalid buffer size or rounds\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t len;
+    size_t commands = generate(buf, size, &len);
+    printf("buffer: %zu bytes, %zu commands (%.1f bytes/command), %d rounds, default kernel: %s\n",
+           len, commands, (double)len / commands, rounds, scan_kernel_name());
+    printf("%-16s %-7s %10s %8s %8s %8s\n", "test", "kernel", "Mcmd/s", "GB/s", "B/cycle", "cyc/cmd");
+
+    const char *kernels[] = { "memchr", "scalar", "sse2", "avx2" };
+    for (int tokens = 0; tokens <= 1; tokens++) {
+        for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+            if (strcmp(kernels[i], "memchr") != 0 && scan_select_kernel(kernels[i]) == -1) {
+                printf("%-16s %-7s (not supported by this CPU)\n", tokens ? "framing+tokens" : "framing",
+                       kernels[i]);
+                continue;
+            }
+            run(kernels[i], buf, len, commands, rounds, tokens);
+        }
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "shm_ring.h"
+
+// 共享内存传输的客户端：连上epoll_server -S指定的Unix socket，收下memfd和门铃后
+// 请求/回复都经过共享内存里的环形队列
+// - 不带参数：执行一条命令并打印回复
+// - -n count：ping往返延迟基准，可用-t host:port同时测TCP回环作对比
+
+#define SPIN_NS 50000           // 等回复时先自旋这么久，之后才去睡眠等门铃（单CPU时不自旋）
+#define TCP_BUFFER_SIZE 4096
+
+struct shm_client {
+    int ctl_fd;
+    int server_bell;
+    int client_bell;
+    struct shm_channel *ch;
+    uint64_t spin_ns;
+    unsigned long bells_sent;
+    unsigned long sleeps;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int shm_connect(struct shm_client *c, const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    c->ctl_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->ctl_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(c->ctl_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect");
+        return -1;
+    }
+
+    int fds[3];
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    char version;
+    struct iovec iov = { .iov_base = &version, .iov_len = 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t n = recvmsg(c->ctl_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        fprintf(stderr, "Server closed the connection (too many clients?)\n");
+        return -1;
+    }
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        fprintf(stderr, "Unexpected handshake from server\n");
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    c->server_bell = fds[1];
+    c->client_bell = fds[2];
+    c->ch = mmap(NULL, sizeof(struct shm_channel), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (c->ch == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    if (version != SHM_VERSION || c->ch->magic != SHM_MAGIC || c->ch->version != SHM_VERSION) {
+        fprintf(stderr, "Shared-memory version mismatch\n");
+        return -1;
+    }
+    c->spin_ns = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_NS : 0;
+    c->bells_sent = 0;
+    c->sleeps = 0;
+    return 0;
+}
+
+// 发送一条请求并等待回复，返回回复长度
+static int shm_request(struct shm_client *c, const char *request, char *reply, uint32_t cap) {
+    if (shm_ring_push(&c->ch->requests, request, strlen(request)) == -1) {
+        fprintf(stderr, "Request too large or queue full\n");
+        return -1;
+    }
+    if (shm_ring_need_wake(&c->ch->requests)) {
+        uint64_t one = 1;
+        if (write(c->server_bell, &one, sizeof(one)) == -1) {
+            perror("write bell");
+            return -1;
+        }
+        c->bells_sent++;
+    }
+
+    uint64_t spin_until = now_ns() + c->spin_ns;
+    while (1) {
+        int len = shm_ring_pop(&c->ch->replies, reply, cap);
+        if (len != -1) {
+            return len;
+        }
+        if (now_ns() < spin_until) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            continue;
+        }
+        if (shm_ring_prepare_sleep(&c->ch->replies)) {
+            uint64_t count;
+            c->sleeps++;
+            if (read(c->client_bell, &count, sizeof(count)) == -1) {
+                perror("read bell");
+                return -1;
+            }
+        }
+        shm_ring_awake(&c->ch->replies);
+        spin_until = now_ns() + c->spin_ns;
+    }
+}
+
+static int tcp_connect(const char *target) {
+    char host[256];
+    const char *colon = strrchr(target, ':');
+    if (!colon || (size_t)(colon - target) >= sizeof(host)) {
+        fprintf(stderr, "Expected host:port, got %s\n", target);
+        return -1;
+    }
+    memcpy(host, target, colon - target);
+    host[colon - target] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, colon + 1, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "getaddrinfo %s: %s\n", target, gai_strerror(err));
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd == -1 || connect(fd, res->ai_addr, res->ai_addrlen) == -1) {
+        perror("connect");
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// TCP上的一次ping往返：读到以"pong\n"结尾为止（第一次回复前面还带着欢迎消息）
+static int tcp_ping(int fd) {
+    char buf[TCP_BUFFER_SIZE];
+    size_t len = 0;
+    if (write(fd, "ping\n", 5) != 5) {
+        perror("write");
+        return -1;
+    }
+    while (len < 5 || memcmp(buf + len - 5, "pong\n", 5) != 0) {
+        ssize_t n = read(fd, buf + len, sizeof(buf) - len);
+        if (n <= 0) {
+            fprintf(stderr, "TCP connection closed\n");
+            return -1;
+        }
+        len += n;
+        if (len == sizeof(buf)) {
+            // 只关心结尾，保留最后几个字节
+            memmove(buf, buf + len - 5, 5);
+            len = 5;
+        }
+    }
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, uint64_t *samples, int count, double elapsed) {
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    qsort(samples, count, sizeof(samples[0]), compare_u64);
+    printf("%-6s %10d %10.0f %10llu %10llu %10llu %12.0f\n", name, count, (double)total / count,
+           (unsigned long long)samples[count / 2], (unsigned long long)samples[count * 99 / 100],
+           (unsigned long long)samples[count - 1], count / elapsed);
+}
+
+static int bench_shm(struct shm_client *c, uint64_t *samples, int count) {
+    char reply[SHM_MAX_MSG];
+    // 预热：让服务器进入轮询模式，页面都已映射
+    for (int i = 0; i < count / 10 + 1; i++) {
+        if (shm_request(c, "ping", reply, sizeof(reply)) == -1) {
+            return -1;
+        }
+    }
+    c->bells_sent = 0;
+    c->sleeps = 0;
+    uint64_t start = now_ns();
+    for (int i = 0; i < count; i++) {
+        uint64_t t0 = now_ns();
+        int len = shm_request(c, "ping", reply, sizeof(reply));
+        if (len != 5 || memcmp(reply, "pong\n", 5) != 0) {
+            fprintf(stderr, "Unexpected reply\n");
+            return -1;
+        }
+        samples[i] = now_ns() - t0;
+    }
+    report("shm", samples, count, (now_ns() - start) / 1e9);
+    return 0;
+}
+
+static int bench_tcp(const char *target, uint64_t *samples, int count) {
+    int fd = tcp_connect(target);
+    if (fd == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count / 10 + 1; i++) {
+        if (tcp_ping(fd) == -1) {
+            close(fd);
+            return -1;
+        }
+    }
+    uint64_t start = now_ns();
+    for (int i = 0; i < count; i++) {
+        uint64_t t0 = now_ns();
+        if (tcp_ping(fd) == -1) {
+            close(fd);
+            return -1;
+        }
+        samples[i] = now_ns() - t0;
+    }
+    report("tcp", samples, count, (now_ns() - start) / 1e9);
+    close(fd);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n count] [-t host:port] socket_path [command]\n", prog);
+    fprintf(stderr, "  command        send one command over shared memory and print the reply (default: ping)\n");
+    fprintf(stderr, "  -n count       ping round-trip benchmark with count requests\n");
+    fprintf(stderr, "  -t host:port   also run the benchmark over TCP for comparison\n");
+}
+
+int main(int argc, char *argv[]) {
+    int count = 0;
+    const char *tcp_target = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 't':
+            tcp_target = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct shm_client client;
+    if (shm_connect(&client, argv[optind]) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (count <= 0) {
+        char reply[SHM_MAX_MSG];
+        const char *command = optind + 1 < argc ? argv[optind + 1] : "ping";
+        int len = shm_request(&client, command, reply, sizeof(reply));
+        if (len == -1) {
+            exit(EXIT_FAILURE);
+        }
+        fwrite(reply, 1, len, stdout);
+        return 0;
+    }
+
+    uint64_t *samples = malloc(sizeof(uint64_t) * count);
+    if (!samples) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    printf("%-6s %10s %10s %10s %10s %10s %12s\n", "path", "requests", "avg_ns", "p50_ns", "p99_ns",
+           "max_ns", "req/s");
+    if (bench_shm(&client, samples, count) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    printf("shm bells sent: %lu, client sleeps: %lu\n", client.bells_sent, client.sleeps);
+    if (tcp_target && bench_tcp(tcp_target, samples, count) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    free(samples);
+    return 0;
+}
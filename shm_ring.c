@@ -0,0 +1,86 @@
+#include <string.h>
+#include "shm_ring.h"
+
+#define SHM_WRAP 0xFFFFFFFFu            // 回绕标记：本轮剩下的空间不用，下一条记录从头开始
+#define SHM_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+// 记录占用的字节数：4字节长度 + 数据，按8字节对齐
+static uint64_t record_size(uint32_t len) {
+    return SHM_ALIGN(4 + (uint64_t)len);
+}
+
+int shm_ring_push(struct shm_ring *ring, const void *msg, uint32_t len) {
+    if (len > SHM_MAX_MSG) {
+        return -1;
+    }
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    // 对齐掩码：即使对方改坏了head，写入也不会越过数据区
+    uint64_t offset = head & (SHM_RING_SIZE - 1) & ~(uint64_t)7;
+    uint64_t need = record_size(len);
+    uint64_t pad = SHM_RING_SIZE - offset < need ? SHM_RING_SIZE - offset : 0;
+
+    if (head + pad + need - tail > SHM_RING_SIZE) {
+        return -1;
+    }
+    if (pad) {
+        uint32_t wrap = SHM_WRAP;
+        memcpy(ring->data + offset, &wrap, 4);
+        head += pad;
+        offset = 0;
+    }
+    memcpy(ring->data + offset, &len, 4);
+    memcpy(ring->data + offset + 4, msg, len);
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int shm_ring_need_wake(struct shm_ring *ring) {
+    // 发布head与读取sleeping之间需要StoreLoad屏障，和prepare_sleep里的屏障配对
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED) != 0;
+}
+
+int shm_ring_has_room(const struct shm_ring *ring) {
+    uint64_t used = ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    // 最坏情况：回绕浪费的空间加上一条最大的记录
+    return SHM_RING_SIZE - used >= 2 * record_size(SHM_MAX_MSG);
+}
+
+int shm_ring_pop(struct shm_ring *ring, void *buf, uint32_t cap) {
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail == head) {
+        return -1;
+    }
+    uint64_t offset = tail & (SHM_RING_SIZE - 1);
+    uint32_t len;
+    memcpy(&len, ring->data + offset, 4);
+    if (len == SHM_WRAP) {
+        tail += SHM_RING_SIZE - offset;
+        offset = 0;
+        memcpy(&len, ring->data, 4);
+    }
+    if (len > cap || len > SHM_MAX_MSG || offset + record_size(len) > SHM_RING_SIZE) {
+        // 共享内存对方可写，内容不可信：长度非法时丢弃整个队列的内容
+        __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+        return -1;
+    }
+    memcpy(buf, ring->data + offset + 4, len);
+    __atomic_store_n(&ring->tail, tail + record_size(len), __ATOMIC_RELEASE);
+    return (int)len;
+}
+
+int shm_ring_prepare_sleep(struct shm_ring *ring) {
+    __atomic_store_n(&ring->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) {
+        __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void shm_ring_awake(struct shm_ring *ring) {
+    __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+}
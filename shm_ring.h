@@ -0,0 +1,53 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 同机客户端的共享内存传输：一块memfd里放两个单生产者/单消费者环形队列（请求、回复）
+// - 客户端连上服务器的Unix socket（epoll_server -S），经SCM_RIGHTS收到memfd和两个eventfd门铃
+// - 消息是长度前缀的记录，按8字节对齐；放不下时写一个回绕标记，从头开始
+// - 门铃只在对方睡眠时才敲：消费者睡前置sleeping再检查一次队列，生产者发布后检查sleeping，
+//   两边中间都有完整内存屏障，不会出现双方都以为对方醒着的情况
+// - Unix socket只用来交换fd和发现对方退出（EOF），不传数据
+
+#define SHM_RING_SIZE (64 * 1024)       // 每个方向的数据区字节数，2的幂
+#define SHM_MAX_MSG 4096                // 单条消息最大字节数
+#define SHM_MAGIC 0x53484D52            // "SHMR"
+#define SHM_VERSION 1
+
+struct shm_ring {
+    uint64_t head __attribute__((aligned(64)));     // 生产者已发布的位置（只由生产者写）
+    uint32_t sleeping __attribute__((aligned(64))); // 消费者在等门铃（只由消费者写）
+    uint64_t tail __attribute__((aligned(64)));     // 消费者已读到的位置（只由消费者写）
+    char data[SHM_RING_SIZE] __attribute__((aligned(64)));
+};
+
+// memfd的内容
+struct shm_channel {
+    uint32_t magic;
+    uint32_t version;
+    struct shm_ring requests __attribute__((aligned(64)));  // 客户端 -> 服务器
+    struct shm_ring replies __attribute__((aligned(64)));   // 服务器 -> 客户端
+};
+
+// 生产者：写入一条消息；队列满或消息过大返回-1
+int shm_ring_push(struct shm_ring *ring, const void *msg, uint32_t len);
+
+// 生产者：发布之后调用，消费者正在睡眠（需要敲门铃）时返回1
+int shm_ring_need_wake(struct shm_ring *ring);
+
+// 生产者：剩余空间能否再放一条最大长度的消息
+int shm_ring_has_room(const struct shm_ring *ring);
+
+// 消费者：取出一条消息复制到buf（cap不小于SHM_MAX_MSG），返回长度；队列空返回-1
+int shm_ring_pop(struct shm_ring *ring, void *buf, uint32_t cap);
+
+// 消费者：准备睡眠。置sleeping后再检查一次，仍然为空返回1（可以去等门铃），
+// 否则撤销sleeping返回0（有新消息，继续处理）
+int shm_ring_prepare_sleep(struct shm_ring *ring);
+
+// 消费者：醒来后清除sleeping，之后生产者不再敲门铃
+void shm_ring_awake(struct shm_ring *ring);
+
+#endif
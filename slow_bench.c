@@ -0,0 +1,508 @@
+// 慢消费者/队头阻塞场景：N个快客户端定时ping，M个慢客户端请求large却限速读取
+// 慢客户端的回复在服务器发送队列里越积越多，看快客户端的延迟、服务器内存和待发字节数怎么变化
+// 快客户端每隔-p毫秒发一个ping（上一个还没回来就跳过这一拍并计数），记录往返延迟
+// 慢客户端连上就流水线发-q个large，按-r字节/秒读取（接收缓冲区用-R固定，内核不会替它攒太多），
+// 每读完一个large再补一个，让服务器上始终有-q个在排队
+// 另开一个连接每隔-i毫秒发stats，取memory行（RSS、所有连接的待发字节）和tcp行（慢消费者数），
+// 和这段时间快客户端的延迟分位数、stats本身的往返时间一起打印一行；stats在下一次采样前都没回来时服务器那几列打印"-"
+// -A把stats发到另一个地址（如admin档案的高优先级端口），对比管理查询在负载下的延迟
+// 用法: ./slow_bench [-f fast] [-s slow] [-r bytes_per_sec] [-q depth] [-R rcvbuf] [-p ping_ms] [-i interval_ms] [-d seconds] [-A host:port] host:port
+// -s 0 得到同样负载下没有慢客户端时的基线
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WELCOME_MSG "Welcome to Carlos's Echo Server!\n"
+#define LARGE_SIZE (10 * 1024 * 1024)       // 和服务器的LARGE_DATA_SIZE一致
+#define TICK_US 10000                       // 慢客户端每10ms读一次
+#define MAX_EVENTS 64
+#define READ_SIZE 65536
+#define LINE_SIZE 4096
+
+// 快客户端和stats连接按行解析回复
+struct line_conn {
+    int fd;
+    char line[LINE_SIZE];
+    size_t line_len;
+    uint64_t sent_at;           // 未完成请求的发送时间，0表示没有
+    uint64_t next_at;           // 快客户端：下一次发ping的时间
+};
+
+struct slow_client {
+    int fd;
+    unsigned long long received;
+    int requested;              // 已发出的large个数
+    double budget;              // 还能读的字节数（令牌桶）
+};
+
+struct latencies {
+    uint32_t *v;
+    size_t count;
+    size_t cap;
+};
+
+// 一个采样区间的结果，stats回来后连同服务器的数据一起打印
+struct sample_row {
+    double t;
+    size_t pings;
+    uint32_t p50, p99, max;
+    double slow_rate;           // 慢客户端合计读取速度（字节/秒）
+    uint64_t stats_sent_at;
+};
+
+static struct latencies total_lat;
+static struct latencies interval_lat;
+static unsigned long long pings_skipped = 0;  // 到点时上一个ping还没回来
+static unsigned long long fast_closed = 0;
+static struct sample_row pending_row;
+static int row_pending = 0;
+static long rss_kb = 0;
+static unsigned long long out_pending = 0;
+static int slow_consumers = 0;
+static long peak_rss_kb = 0;
+static unsigned long long peak_out_pending = 0;
+static struct latencies stats_lat;            // stats请求的往返时间
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void latency_add(struct latencies *l, uint64_t us) {
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 65536;
+        uint32_t *p = realloc(l->v, cap * sizeof(*p));
+        if (!p) {
+            perror("realloc latencies");
+            return;
+        }
+        l->v = p;
+        l->cap = cap;
+    }
+    l->v[l->count++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// 排序后取分位数，per_mille为千分位（990 = p99）
+static uint32_t percentile(struct latencies *l, int per_mille) {
+    if (l->count == 0) {
+        return 0;
+    }
+    return l->v[l->count * per_mille / 1000];
+}
+
+static int connect_to(const char *host, const char *port, int rcvbuf) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+    if (fd == -1) {
+        perror("socket");
+        freeaddrinfo(res);
+        return -1;
+    }
+    // 接收窗口在建连时协商，必须在connect之前设置
+    if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1) {
+        perror("setsockopt SO_RCVBUF");
+    }
+    // 建连用阻塞connect，不计入测量；之后切到非阻塞
+    if (connect(fd, res->ai_addr, res->ai_addrlen) == -1 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+        perror("connect");
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // 请求只有几个字节，发送缓冲区满说明服务器早已不读，按出错处理
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void print_row(const struct sample_row *row, uint64_t stats_us, int have_server) {
+    printf("%7.1f %7zu %8u %8u %8u %10.0f", row->t, row->pings, row->p50, row->p99, row->max,
+           row->slow_rate / 1024);
+    if (have_server) {
+        printf(" %9llu %9ld %12llu %5d\n", (unsigned long long)stats_us, rss_kb, out_pending / 1024,
+               slow_consumers);
+    } else {
+        printf(" %9s %9s %12s %5s\n", "-", "-", "-", "-");
+    }
+    fflush(stdout);
+}
+
+// stats回复里只关心两行，memory行到了说明回复已经完整
+static void stats_line(const char *line, uint64_t now) {
+    if (strncmp(line, "tcp:", 4) == 0) {
+        const char *p = strstr(line, "slow_consumers=");
+        if (p) {
+            slow_consumers = atoi(p + strlen("slow_consumers="));
+        }
+    } else if (sscanf(line, "memory: rss_kb=%ld out_pending=%llu", &rss_kb, &out_pending) == 2) {
+        if (rss_kb > peak_rss_kb) {
+            peak_rss_kb = rss_kb;
+        }
+        if (out_pending > peak_out_pending) {
+            peak_out_pending = out_pending;
+        }
+        if (row_pending) {
+            latency_add(&stats_lat, now - pending_row.stats_sent_at);
+            print_row(&pending_row, now - pending_row.stats_sent_at, 1);
+            row_pending = 0;
+        }
+    }
+}
+
+// 读出所有数据并逐行处理；stats连接交给stats_line，快客户端每收到一行pong完成一次ping
+// 返回-1表示连接已关闭
+static int line_conn_read(struct line_conn *c, int is_stats) {
+    char buf[READ_SIZE];
+    for (;;) {
+        ssize_t n = read(c->fd, buf, sizeof(buf));
+        if (n == 0) {
+            return -1;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        uint64_t now = now_us();
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != '\n') {
+                if (c->line_len < LINE_SIZE - 1) {
+                    c->line[c->line_len++] = buf[i];
+                }
+                continue;
+            }
+            c->line[c->line_len] = '\0';
+            c->line_len = 0;
+            if (is_stats) {
+                stats_line(c->line, now);
+            } else if (strcmp(c->line, "pong") == 0 && c->sent_at) {
+                latency_add(&total_lat, now - c->sent_at);
+                latency_add(&interval_lat, now - c->sent_at);
+                c->sent_at = 0;
+            }
+        }
+    }
+}
+
+// 按令牌桶读取，读完的large补上，保持depth个在服务器上排队
+static void slow_client_tick(struct slow_client *c, double grant, int depth, char *buf) {
+    c->budget += grant;
+    while (c->budget >= 1) {
+        size_t want = c->budget < READ_SIZE ? (size_t)c->budget : READ_SIZE;
+        ssize_t n = read(c->fd, buf, want);
+        if (n > 0) {
+            c->received += n;
+            c->budget -= n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // 服务器没跟上：令牌不累积，否则之后会突发读取
+            c->budget = 0;
+            break;
+        }
+        fprintf(stderr, "slow client fd %d closed after %llu bytes\n", c->fd, c->received);
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
+    size_t welcome = strlen(WELCOME_MSG);
+    int completed = c->received > welcome ? (int)((c->received - welcome) / LARGE_SIZE) : 0;
+    while (c->requested - completed < depth) {
+        if (send_all(c->fd, "large\n", 6) == -1) {
+            perror("send large");
+            close(c->fd);
+            c->fd = -1;
+            return;
+        }
+        c->requested++;
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f fast] [-s slow] [-r bytes_per_sec] [-q depth] [-R rcvbuf] [-p ping_ms] [-i interval_ms] [-d seconds] [-A host:port] host:port\n", prog);
+    fprintf(stderr, "  -f n    fast clients sending ping (default: 50)\n");
+    fprintf(stderr, "  -s n    slow clients requesting large (default: 4, 0 = baseline)\n");
+    fprintf(stderr, "  -r n    read rate of each slow client in bytes/s (default: 262144)\n");
+    fprintf(stderr, "  -q n    large requests each slow client keeps queued (default: 2)\n");
+    fprintf(stderr, "  -R n    SO_RCVBUF of slow clients (default: 65536)\n");
+    fprintf(stderr, "  -p ms   ping interval of each fast client (default: 10)\n");
+    fprintf(stderr, "  -i ms   sampling interval of the report (default: 1000)\n");
+    fprintf(stderr, "  -d s    duration (default: 10)\n");
+    fprintf(stderr, "  -A addr send the stats queries to this address instead, e.g. an admin listener\n");
+}
+
+int main(int argc, char *argv[]) {
+    int fast_count = 50;
+    int slow_count = 4;
+    double slow_rate = 256 * 1024;
+    int depth = 2;
+    int rcvbuf = 65536;
+    int ping_ms = 10;
+    int interval_ms = 1000;
+    double duration = 10;
+    char *admin = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:s:r:q:R:p:i:d:A:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            fast_count = atoi(optarg);
+            break;
+        case 's':
+            slow_count = atoi(optarg);
+            break;
+        case 'r':
+            slow_rate = atof(optarg);
+            break;
+        case 'q':
+            depth = atoi(optarg);
+            break;
+        case 'R':
+            rcvbuf = atoi(optarg);
+            break;
+        case 'p':
+            ping_ms = atoi(optarg);
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'A':
+            admin = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || fast_count <= 0 || slow_count < 0 || slow_rate <= 0 || depth <= 0 ||
+        ping_ms <= 0 || interval_ms <= 0 || duration <= 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    char *host = argv[optind];
+    char *port = strrchr(host, ':');
+    if (!port) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    *port++ = '\0';
+    char *admin_host = host;
+    char *admin_port = port;
+    if (admin) {
+        admin_host = admin;
+        admin_port = strrchr(admin, ':');
+        if (!admin_port) {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        *admin_port++ = '\0';
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct line_conn *fast = calloc(fast_count, sizeof(*fast));
+    struct slow_client *slow = calloc(slow_count ? slow_count : 1, sizeof(*slow));
+    char *buf = malloc(READ_SIZE);
+    if (epfd == -1 || !fast || !slow || !buf) {
+        perror("setup");
+        exit(EXIT_FAILURE);
+    }
+
+    // stats连接用data.ptr == NULL区分
+    struct line_conn stats_conn = { .fd = connect_to(admin_host, admin_port, 0) };
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (stats_conn.fd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, stats_conn.fd, &ev) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < slow_count; i++) {
+        slow[i].fd = connect_to(host, port, rcvbuf);
+        if (slow[i].fd == -1) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint64_t start = now_us();
+    for (int i = 0; i < fast_count; i++) {
+        fast[i].fd = connect_to(host, port, 0);
+        ev.data.ptr = &fast[i];
+        if (fast[i].fd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, fast[i].fd, &ev) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        // 发送时间错开，不要所有ping挤在同一时刻
+        fast[i].next_at = start + (uint64_t)ping_ms * 1000 * i / fast_count;
+    }
+
+    printf("fast=%d slow=%d slow_rate=%.0f B/s depth=%d rcvbuf=%d ping_ms=%d\n",
+           fast_count, slow_count, slow_rate, depth, rcvbuf, ping_ms);
+    printf("%7s %7s %8s %8s %8s %10s %9s %9s %12s %5s\n", "t_s", "pings", "p50_us", "p99_us", "max_us",
+           "slow_KB/s", "stats_us", "rss_kb", "pending_KB", "slow");
+
+    uint64_t end = start + (uint64_t)(duration * 1e6);
+    uint64_t last_tick = start;
+    uint64_t next_sample = start + (uint64_t)interval_ms * 1000;
+    unsigned long long slow_received_mark = 0;
+    uint64_t now = start;
+    while (now < end) {
+        // 到点的快客户端发ping，同时算出下一个要醒来的时间
+        uint64_t wake = last_tick + TICK_US < next_sample ? last_tick + TICK_US : next_sample;
+        for (int i = 0; i < fast_count; i++) {
+            struct line_conn *c = &fast[i];
+            if (c->fd == -1) {
+                continue;
+            }
+            if (c->next_at <= now) {
+                c->next_at += (uint64_t)ping_ms * 1000;
+                if (c->sent_at) {
+                    pings_skipped++;
+                } else if (send_all(c->fd, "ping\n", 5) == -1) {
+                    fast_closed++;
+                    close(c->fd);
+                    c->fd = -1;
+                    continue;
+                } else {
+                    c->sent_at = now_us();
+                }
+            }
+            if (c->next_at < wake) {
+                wake = c->next_at;
+            }
+        }
+
+        struct epoll_event events[MAX_EVENTS];
+        int timeout = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+        int nfds = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        if (nfds == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < nfds; i++) {
+            struct line_conn *c = events[i].data.ptr;
+            if (!c) {
+                if (line_conn_read(&stats_conn, 1) == -1) {
+                    fprintf(stderr, "stats connection closed\n");
+                    exit(EXIT_FAILURE);
+                }
+                continue;
+            }
+            if (line_conn_read(c, 0) == -1) {
+                fast_closed++;
+                close(c->fd);
+                c->fd = -1;
+            }
+        }
+
+        now = now_us();
+        if (now - last_tick >= TICK_US) {
+            double grant = slow_rate * (now - last_tick) / 1e6;
+            for (int i = 0; i < slow_count; i++) {
+                if (slow[i].fd != -1) {
+                    slow_client_tick(&slow[i], grant, depth, buf);
+                }
+            }
+            last_tick = now;
+        }
+        if (now >= next_sample) {
+            if (row_pending) {
+                // 上一次的stats还没回来：服务器连管理命令都顾不上了
+                print_row(&pending_row, 0, 0);
+            }
+            unsigned long long slow_received = 0;
+            for (int i = 0; i < slow_count; i++) {
+                slow_received += slow[i].received;
+            }
+            qsort(interval_lat.v, interval_lat.count, sizeof(*interval_lat.v), compare_u32);
+            pending_row.t = (now - start) / 1e6;
+            pending_row.pings = interval_lat.count;
+            pending_row.p50 = percentile(&interval_lat, 500);
+            pending_row.p99 = percentile(&interval_lat, 990);
+            pending_row.max = interval_lat.count ? interval_lat.v[interval_lat.count - 1] : 0;
+            pending_row.slow_rate = (slow_received - slow_received_mark) * 1e6 / (interval_ms * 1000);
+            slow_received_mark = slow_received;
+            interval_lat.count = 0;
+            row_pending = 1;
+            pending_row.stats_sent_at = now_us();
+            if (send_all(stats_conn.fd, "stats\n", 6) == -1) {
+                perror("send stats");
+                exit(EXIT_FAILURE);
+            }
+            next_sample += (uint64_t)interval_ms * 1000;
+        }
+    }
+    double elapsed = (now - start) / 1e6;
+
+    unsigned long long slow_received = 0;
+    int slow_alive = 0;
+    for (int i = 0; i < slow_count; i++) {
+        slow_received += slow[i].received;
+        if (slow[i].fd != -1) {
+            slow_alive++;
+            close(slow[i].fd);
+        }
+    }
+    for (int i = 0; i < fast_count; i++) {
+        if (fast[i].fd != -1) {
+            close(fast[i].fd);
+        }
+    }
+    qsort(total_lat.v, total_lat.count, sizeof(*total_lat.v), compare_u32);
+    printf("fast: pings=%zu skipped=%llu closed=%llu latency_us p50=%u p90=%u p99=%u p999=%u max=%u\n",
+           total_lat.count, pings_skipped, fast_closed, percentile(&total_lat, 500),
+           percentile(&total_lat, 900), percentile(&total_lat, 990), percentile(&total_lat, 999),
+           total_lat.count ? total_lat.v[total_lat.count - 1] : 0);
+    printf("slow: connected=%d/%d received=%llu bytes (%.0f B/s per client)\n", slow_alive, slow_count,
+           slow_received, slow_count ? slow_received / elapsed / slow_count : 0);
+    qsort(stats_lat.v, stats_lat.count, sizeof(*stats_lat.v), compare_u32);
+    printf("stats: replies=%zu latency_us p50=%u max=%u\n", stats_lat.count, percentile(&stats_lat, 500),
+           stats_lat.count ? stats_lat.v[stats_lat.count - 1] : 0);
+    printf("server: peak_rss_kb=%ld peak_pending_KB=%llu\n", peak_rss_kb, peak_out_pending / 1024);
+
+    close(stats_conn.fd);
+    close(epfd);
+    free(total_lat.v);
+    free(interval_lat.v);
+    free(stats_lat.v);
+    free(fast);
+    free(slow);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#define _GNU_SOURCE // pthread, eventfd
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "worker_pool.h"
+
+struct worker_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;                 // 有新任务或要停止
+    struct job *queue_head;              // 待执行任务（FIFO）
+    struct job *queue_tail;
+    struct job *done_head;               // 已执行完、等待事件循环回调的任务（FIFO）
+    struct job *done_tail;
+    int stopping;
+    int event_fd;
+    int thread_count;
+    pthread_t threads[];
+};
+
+static void job_list_append(struct job **head, struct job **tail, struct job *job) {
+    job->next = NULL;
+    if (*tail) {
+        (*tail)->next = job;
+    } else {
+        *head = job;
+    }
+    *tail = job;
+}
+
+static void* worker_main(void *arg) {
+    struct worker_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->queue_head && !pool->stopping) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (!pool->queue_head) {
+            break;
+        }
+        struct job *job = pool->queue_head;
+        pool->queue_head = job->next;
+        if (!pool->queue_head) {
+            pool->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!worker_job_cancelled(job)) {
+            job->run(job);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        // 完成队列由空变非空时才需要唤醒，事件循环一次会取走整个队列
+        int wake = pool->done_head == NULL;
+        job_list_append(&pool->done_head, &pool->done_tail, job);
+        if (wake) {
+            uint64_t one = 1;
+            if (write(pool->event_fd, &one, sizeof(one)) == -1) {
+                perror("write eventfd");
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+struct worker_pool* worker_pool_create(int threads) {
+    struct worker_pool *pool = calloc(1, sizeof(*pool) + threads * sizeof(pthread_t));
+    if (!pool) {
+        perror("calloc worker_pool");
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pool->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->event_fd == -1) {
+        perror("eventfd");
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        int err = pthread_create(&pool->threads[i], NULL, worker_main, pool);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            worker_pool_destroy(pool);
+            return NULL;
+        }
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+void worker_pool_destroy(struct worker_pool *pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    // 还没开始的任务不再执行
+    for (struct job *job = pool->queue_head; job; job = job->next) {
+        worker_job_cancel(job);
+    }
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    // 工作线程退出前已把队列里的任务都移到了完成队列
+    worker_pool_complete(pool);
+
+    close(pool->event_fd);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int worker_pool_event_fd(const struct worker_pool *pool) {
+    return pool->event_fd;
+}
+
+void worker_pool_submit(struct worker_pool *pool, struct job *job) {
+    job->cancelled = 0;
+    pthread_mutex_lock(&pool->lock);
+    job_list_append(&pool->queue_head, &pool->queue_tail, job);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int worker_pool_complete(struct worker_pool *pool) {
+    uint64_t count;
+    int handled = 0;
+
+    if (read(pool->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("read eventfd");
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    struct job *job = pool->done_head;
+    pool->done_head = pool->done_tail = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    while (job) {
+        struct job *next = job->next;
+        job->complete(job);
+        job = next;
+        handled++;
+    }
+    return handled;
+}
+
+void worker_job_cancel(struct job *job) {
+    __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELEASE);
+}
+
+int worker_job_cancelled(struct job *job) {
+    return __atomic_load_n(&job->cancelled, __ATOMIC_ACQUIRE);
+}
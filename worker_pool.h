@@ -0,0 +1,38 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+// 工作线程池：把耗CPU的任务移出事件循环
+// - 事件循环worker_pool_submit提交任务，工作线程执行run
+// - 执行完的任务挂到完成队列，并写eventfd唤醒事件循环（eventfd注册在epoll里）
+// - 事件循环在eventfd可读时调用worker_pool_complete，逐个在本线程执行complete
+// complete总是在事件循环线程执行，可以放心访问连接状态；被取消的任务也会回调complete
+// （跳过了run），由它负责释放任务
+
+struct worker_pool;
+
+struct job {
+    void (*run)(struct job *job);       // 工作线程中执行
+    void (*complete)(struct job *job);  // 事件循环线程中执行
+    int cancelled;                      // 用worker_job_cancel/worker_job_cancelled访问
+    struct job *next;                   // 线程池内部队列
+};
+
+// 创建threads个工作线程，失败返回NULL
+struct worker_pool* worker_pool_create(int threads);
+
+// 停止并回收工作线程；尚未完成的任务标记为取消后回调complete
+void worker_pool_destroy(struct worker_pool *pool);
+
+// 完成通知的eventfd，注册到epoll监听EPOLLIN
+int worker_pool_event_fd(const struct worker_pool *pool);
+
+void worker_pool_submit(struct worker_pool *pool, struct job *job);
+
+// 读掉eventfd计数，按完成顺序回调所有已完成任务的complete，返回处理的任务数
+int worker_pool_complete(struct worker_pool *pool);
+
+// 取消任务：还没开始的任务不再执行run，已经在执行的照常完成（complete里应检查）
+void worker_job_cancel(struct job *job);
+int worker_job_cancelled(struct job *job);
+
+#endif